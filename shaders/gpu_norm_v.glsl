@@ -0,0 +1,65 @@
+#version 330 core
+
+out vec3 f_pos;
+out vec3 f_norm;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// Tightly packed xyz floats of every mass, GL_R32F since rgb32f buffer
+// textures need GL 4.0
+uniform samplerBuffer positions;
+uniform int size;
+
+vec3 fetch(int y, int z)
+{
+    int i = 3 * (y * size + z);
+    return vec3(texelFetch(positions, i).r,
+                texelFetch(positions, i + 1).r,
+                texelFetch(positions, i + 2).r);
+}
+
+bool quad(int y, int z)
+{
+    return y >= 0 && z >= 0 && y < size - 1 && z < size - 1;
+}
+
+// Same triangles and winding as mesh_construct
+vec3 tri_a(int y, int z)
+{
+    vec3 p = fetch(y, z);
+    return cross(fetch(y + 1, z + 1) - p, fetch(y + 1, z) - p);
+}
+
+vec3 tri_b(int y, int z)
+{
+    vec3 p = fetch(y, z);
+    return cross(fetch(y, z + 1) - p, fetch(y + 1, z + 1) - p);
+}
+
+void main()
+{
+    int y = gl_VertexID / size;
+    int z = gl_VertexID % size;
+
+    vec3 norm = vec3(0.);
+
+    if (quad(y, z))
+        norm += tri_a(y, z) + tri_b(y, z);
+
+    if (quad(y - 1, z - 1))
+        norm += tri_a(y - 1, z - 1) + tri_b(y - 1, z - 1);
+
+    if (quad(y - 1, z))
+        norm += tri_a(y - 1, z);
+
+    if (quad(y, z - 1))
+        norm += tri_b(y, z - 1);
+
+    vec3 pos = fetch(y, z);
+
+    f_pos = vec3(model * vec4(pos, 1.));
+    f_norm = norm;
+    gl_Position = projection * view * vec4(pos, 1.);
+}
@@ -0,0 +1,209 @@
+#include "aero.h"
+#include "mesh.h"
+#include "normals.h"
+#include "pool.h"
+#include "simd.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ROW_GRAIN 16
+
+struct AeroJob
+{
+    struct Mesh *m;
+    // Mesh::vel, or Aero::rel with a field
+    vec3 *vel;
+    float dt;
+};
+
+#define TRI_FORCE(a, m, t, c) ((a)->tri_force + ((t) * 3 + (c)) * (m)->fnorm_stride)
+
+
+void aero_init(struct Aero *a)
+{
+    glm_vec3_zero(a->wind);
+    a->field = 0;
+    a->drag = AERO_DRAG;
+    a->lift = AERO_LIFT;
+    a->friction = AERO_FRICTION;
+
+    a->tri_force = 0;
+    a->stride = 0;
+    a->force = 0;
+    a->air = 0;
+    a->rel = 0;
+    a->field_time = 0.f;
+    a->nsampled = 0;
+    a->cap = 0;
+}
+
+
+void aero_free(struct Aero *a)
+{
+    free(a->tri_force);
+    free(a->force);
+    free(a->air);
+    free(a->rel);
+}
+
+
+static void grid_job(void *arg, size_t begin, size_t end)
+{
+    struct AeroJob *j = arg;
+    struct Mesh *m = j->m;
+    struct Aero *a = &m->aero;
+
+    int s = m->size;
+    float k = (a->drag + a->lift + a->friction) / m->mass * j->dt;
+
+    for (size_t y = begin; y < end; ++y)
+    {
+        // Quads of a row are consecutive in Mesh::indices, both triangles of
+        // each in the order of FNORM
+        unsigned int *tris = m->indices + y * (s - 1) * 6;
+        size_t q = (y + 1) * (s + 1) + 1;
+
+        for (int t = 0; t < 2; ++t)
+        {
+            float *const norm[3] = { FNORM(m, t, 0) + q, FNORM(m, t, 1) + q, FNORM(m, t, 2) + q };
+            float *const force[3] = {
+                TRI_FORCE(a, m, t, 0) + q, TRI_FORCE(a, m, t, 1) + q, TRI_FORCE(a, m, t, 2) + q
+            };
+
+            simd.aero(tris + t * 3, 6, s - 1, j->vel, norm, force, a->wind, a->drag, a->lift, a->friction, k);
+        }
+    }
+}
+
+
+static void tri_job(void *arg, size_t begin, size_t end)
+{
+    struct AeroJob *j = arg;
+    struct Mesh *m = j->m;
+    struct Aero *a = &m->aero;
+
+    float k = (a->drag + a->lift + a->friction) / m->mass * j->dt;
+
+    float *const norm[3] = { FNORM(m, 0, 0) + begin, FNORM(m, 0, 1) + begin, FNORM(m, 0, 2) + begin };
+    float *const force[3] = {
+        TRI_FORCE(a, m, 0, 0) + begin, TRI_FORCE(a, m, 0, 1) + begin, TRI_FORCE(a, m, 0, 2) + begin
+    };
+
+    simd.aero(m->indices + begin * 3, 3, end - begin, j->vel, norm, force, a->wind, a->drag, a->lift, a->friction, k);
+}
+
+
+static void sample_job(void *arg, size_t begin, size_t end)
+{
+    struct AeroJob *j = arg;
+    struct Mesh *m = j->m;
+
+    wind_sample_many(m->aero.field, m->pos + begin, end - begin, m->aero.air + begin);
+}
+
+
+static void rel_job(void *arg, size_t begin, size_t end)
+{
+    struct AeroJob *j = arg;
+    struct Mesh *m = j->m;
+    vec3 *air = m->aero.air, *rel = m->aero.rel;
+
+    #pragma omp simd
+    for (size_t i = begin; i < end; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+            rel[i][c] = m->vel[i][c] - air[i][c];
+    }
+}
+
+
+static void apply_job(void *arg, size_t begin, size_t end)
+{
+    struct AeroJob *j = arg;
+    struct Mesh *m = j->m;
+    vec3 *force = m->aero.force;
+    float dt = j->dt;
+
+    #pragma omp simd
+    for (size_t i = begin; i < end; ++i)
+    {
+        // Zero for pinned masses
+        float w = m->inv_mass[i] * dt;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            float dv = force[i][c] * w;
+            m->vel[i][c] += dv;
+            m->pos[i][c] += dv * dt;
+        }
+    }
+}
+
+
+bool aero_active(struct Aero *a)
+{
+    return a->drag != 0.f || a->lift != 0.f || a->friction != 0.f;
+}
+
+
+void aero_step(struct Mesh *m, float dt)
+{
+    struct Aero *a = &m->aero;
+
+    if (!aero_active(a))
+        return;
+
+    // Tearing swaps the grid layout for one slot per triangle and adds
+    // masses
+    if (a->stride != m->fnorm_stride)
+    {
+        free(a->tri_force);
+
+        size_t bytes = sizeof(float) * 6 * m->fnorm_stride;
+        a->tri_force = util_alloc_aligned(bytes);
+        memset(a->tri_force, 0, bytes);
+        a->stride = m->fnorm_stride;
+    }
+
+    if (a->cap != m->mass_cap)
+    {
+        free(a->force);
+        free(a->air);
+        free(a->rel);
+        a->force = util_alloc_aligned(sizeof(vec3) * m->mass_cap);
+        a->air = util_alloc_aligned(sizeof(vec3) * m->mass_cap);
+        a->rel = util_alloc_aligned(sizeof(vec3) * m->mass_cap);
+        a->cap = m->mass_cap;
+        a->nsampled = 0;
+    }
+
+    // Normally left by the last mesh_update, only the first step and steps
+    // after a transform or tearing was switched on need a pass of their own
+    if (m->fnorm_time != m->time)
+        normals_faces(m, m->pos);
+
+    struct AeroJob j = { m, m->vel, dt };
+
+    if (a->field)
+    {
+        // Resampled every period and for masses added by tearing
+        if (a->nsampled != m->nmasses || m->time >= a->field_time + AERO_FIELD_PERIOD)
+        {
+            pool_for(pool_global(), m->nmasses, WIND_BLOCK * 16, sample_job, &j);
+            a->field_time = m->time;
+            a->nsampled = m->nmasses;
+        }
+
+        pool_for(pool_global(), m->nmasses, ROW_GRAIN * 256, rel_job, &j);
+        j.vel = a->rel;
+    }
+
+    if (m->grid)
+        pool_for(pool_global(), m->size - 1, ROW_GRAIN, grid_job, &j);
+    else
+        pool_for(pool_global(), m->nindices / 3, ROW_GRAIN * 256, tri_job, &j);
+
+    normals_sum(m, a->tri_force, a->force);
+    pool_for(pool_global(), m->nmasses, ROW_GRAIN * 256, apply_job, &j);
+}
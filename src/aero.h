@@ -0,0 +1,54 @@
+#ifndef AERO_H
+#define AERO_H
+
+#include "wind.h"
+#include <cglm/cglm.h>
+
+// Default coefficients, force per unit area and squared speed
+#define AERO_DRAG .02f
+#define AERO_LIFT .01f
+#define AERO_FRICTION .02f
+// Seconds between samples of Aero::field at the masses. Fields are coarse
+// enough that cloth barely moves across a cell in between.
+#define AERO_FIELD_PERIOD (1.f / 60.f)
+
+struct Mesh;
+
+// Air pushing on every triangle. Drag acts along the face normal, lift
+// across the air flow and friction along the face, all scale with the area
+// and the squared speed of the triangle through the air. Each corner takes
+// a third.
+// The speed is capped so that the six triangles around a grid mass never
+// take more than its velocity along them in one step.
+struct Aero
+{
+    // Velocity of the air, plus field sampled at every mass unless null.
+    // The field is not owned.
+    vec3 wind;
+    struct Wind *field;
+    float drag, lift, friction;
+
+    // Force on every triangle in the layout of Mesh::fnorm, then summed per
+    // mass. Sized on first use and whenever the mesh outgrows them.
+    float *tri_force;
+    size_t stride;
+    vec3 *force;
+    // Field at every mass as of field_time, and the velocity of every mass
+    // relative to it, only used with a field
+    vec3 *air, *rel;
+    float field_time;
+    size_t nsampled;
+    size_t cap;
+};
+
+void aero_init(struct Aero *a);
+void aero_free(struct Aero *a);
+
+// Whether any coefficient is set, aero_step does nothing otherwise
+bool aero_active(struct Aero *a);
+
+// Velocity the air adds over dt, from the face normals mesh_update left at
+// the start of the step
+void aero_step(struct Mesh *m, float dt);
+
+#endif
@@ -0,0 +1,550 @@
+#include "bvh.h"
+#include "geom.h"
+#include "model.h"
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define BVH_BINS 16
+#define BVH_LEAF 4
+#define BVH_STACK 64
+
+#define CACHE_MAGIC 0x43485642 // "BVHC"
+#define CACHE_VERSION 2
+
+struct Bin
+{
+    vec3 lo, hi;
+    size_t n;
+};
+
+struct CacheHeader
+{
+    uint32_t magic, version;
+
+    // Of the source file, a mismatch means it changed since the cache was
+    // written
+    int64_t mtime, size;
+
+    uint64_t nverts, ntris, nnodes;
+};
+
+
+static float area(vec3 lo, vec3 hi)
+{
+    vec3 d;
+    glm_vec3_sub(hi, lo, d);
+
+    if (d[0] < 0.f)
+        return 0.f;
+
+    return 2.f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+
+static void grow(vec3 lo, vec3 hi, vec3 p)
+{
+    glm_vec3_minv(lo, p, lo);
+    glm_vec3_maxv(hi, p, hi);
+}
+
+
+static void empty(vec3 lo, vec3 hi)
+{
+    glm_vec3_fill(lo, FLT_MAX);
+    glm_vec3_fill(hi, -FLT_MAX);
+}
+
+
+static struct Bvh *bvh_new(size_t nverts, size_t ntris)
+{
+    struct Bvh *b = malloc(sizeof(struct Bvh));
+    b->nverts = nverts;
+    b->ntris = ntris;
+    b->nnodes = 0;
+
+    b->verts = malloc(sizeof(vec3) * (nverts ? nverts : 1));
+    b->tris = malloc(sizeof(unsigned int) * 3 * (ntris ? ntris : 1));
+    b->norms = malloc(sizeof(vec3) * (ntris ? ntris : 1));
+    b->vnorms = calloc(nverts ? nverts : 1, sizeof(vec3));
+    b->enorms = calloc(ntris ? ntris * 3 : 1, sizeof(vec3));
+    b->nodes = malloc(sizeof(struct BvhNode) * (ntris ? 2 * ntris - 1 : 1));
+
+    return b;
+}
+
+
+// Best binned split of tris [begin, end), false if not splitting is cheaper
+static bool split(vec3 *cent, unsigned int *order, size_t begin, size_t end,
+                  struct BvhNode *node, int *axis, float *pos)
+{
+    vec3 clo, chi;
+    empty(clo, chi);
+
+    for (size_t i = begin; i < end; ++i)
+        grow(clo, chi, cent[order[i]]);
+
+    float best = (end - begin) * area(node->lo, node->hi);
+    bool found = false;
+
+    for (int a = 0; a < 3; ++a)
+    {
+        float ext = chi[a] - clo[a];
+
+        if (ext <= 0.f)
+            continue;
+
+        struct Bin bins[BVH_BINS];
+
+        for (int k = 0; k < BVH_BINS; ++k)
+        {
+            empty(bins[k].lo, bins[k].hi);
+            bins[k].n = 0;
+        }
+
+        float scale = BVH_BINS / ext;
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            int k = (int)((cent[order[i]][a] - clo[a]) * scale);
+            k = k < BVH_BINS ? k : BVH_BINS - 1;
+
+            grow(bins[k].lo, bins[k].hi, cent[order[i]]);
+            ++bins[k].n;
+        }
+
+        // Centroid bounds stand in for triangle bounds, which keeps the
+        // sweep cheap at a small cost in split quality
+        float right[BVH_BINS];
+        vec3 lo, hi;
+        empty(lo, hi);
+        size_t n = 0;
+
+        for (int k = BVH_BINS - 1; k > 0; --k)
+        {
+            n += bins[k].n;
+            glm_vec3_minv(lo, bins[k].lo, lo);
+            glm_vec3_maxv(hi, bins[k].hi, hi);
+            right[k] = n * area(lo, hi);
+        }
+
+        empty(lo, hi);
+        n = 0;
+
+        for (int k = 0; k < BVH_BINS - 1; ++k)
+        {
+            n += bins[k].n;
+            glm_vec3_minv(lo, bins[k].lo, lo);
+            glm_vec3_maxv(hi, bins[k].hi, hi);
+
+            float cost = n * area(lo, hi) + right[k + 1];
+
+            if (n > 0 && n < end - begin && cost < best)
+            {
+                best = cost;
+                *axis = a;
+                *pos = clo[a] + (k + 1) / scale;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+
+static int cmp_key(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+static void pseudonormals(struct Bvh *b)
+{
+    for (size_t t = 0; t < b->ntris; ++t)
+    {
+        unsigned int *tri = b->tris + t * 3;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            vec3 e1, e2;
+            glm_vec3_sub(b->verts[tri[(k + 1) % 3]], b->verts[tri[k]], e1);
+            glm_vec3_sub(b->verts[tri[(k + 2) % 3]], b->verts[tri[k]], e2);
+
+            float angle = glm_vec3_angle(e1, e2);
+
+            if (angle == angle)
+                glm_vec3_muladds(b->norms[t], angle, b->vnorms[tri[k]]);
+        }
+    }
+
+    for (size_t v = 0; v < b->nverts; ++v)
+        glm_vec3_normalize(b->vnorms[v]);
+
+    // Side k of triangle t runs from corner k to k + 1. Sorting sides by
+    // their sorted corner pair groups the ones shared between faces.
+    size_t n = b->ntris * 3;
+    uint64_t (*keys)[2] = malloc(sizeof(uint64_t) * 2 * (n ? n : 1));
+
+    for (size_t t = 0; t < b->ntris; ++t)
+    {
+        unsigned int *tri = b->tris + t * 3;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            uint64_t a = tri[k], c = tri[(k + 1) % 3];
+            keys[t * 3 + k][0] = a < c ? a << 32 | c : c << 32 | a;
+            keys[t * 3 + k][1] = t * 3 + k;
+        }
+    }
+
+    qsort(keys, n, sizeof(uint64_t) * 2, cmp_key);
+
+    for (size_t i = 0; i < n;)
+    {
+        size_t j = i;
+        vec3 sum = { 0.f, 0.f, 0.f };
+
+        for (; j < n && keys[j][0] == keys[i][0]; ++j)
+            glm_vec3_add(sum, b->norms[keys[j][1] / 3], sum);
+
+        glm_vec3_normalize(sum);
+
+        for (; i < j; ++i)
+            glm_vec3_copy(sum, b->enorms[keys[i][1]]);
+    }
+
+    free(keys);
+}
+
+
+struct Bvh *bvh_build(vec3 *verts, size_t nverts, unsigned int *indices, size_t nindices)
+{
+    size_t ntris = nindices / 3;
+    struct Bvh *b = bvh_new(nverts, ntris);
+    memcpy(b->verts, verts, sizeof(vec3) * nverts);
+
+    vec3 *cent = malloc(sizeof(vec3) * (ntris ? ntris : 1));
+    unsigned int *order = malloc(sizeof(unsigned int) * (ntris ? ntris : 1));
+
+    for (size_t t = 0; t < ntris; ++t)
+    {
+        unsigned int *tri = indices + t * 3;
+        glm_vec3_add(verts[tri[0]], verts[tri[1]], cent[t]);
+        glm_vec3_add(cent[t], verts[tri[2]], cent[t]);
+        glm_vec3_divs(cent[t], 3.f, cent[t]);
+        order[t] = t;
+    }
+
+    if (ntris == 0)
+    {
+        empty(b->nodes[0].lo, b->nodes[0].hi);
+        b->nodes[0].first = 0;
+        b->nodes[0].count = 0;
+        b->nnodes = 1;
+    }
+    else
+    {
+        // Pending nodes and the range of order each covers
+        size_t stack[BVH_STACK * 3];
+        size_t top = 0;
+
+        b->nnodes = 1;
+        stack[top++] = 0;
+        stack[top++] = 0;
+        stack[top++] = ntris;
+
+        while (top)
+        {
+            size_t end = stack[--top], begin = stack[--top], ni = stack[--top];
+            struct BvhNode *node = &b->nodes[ni];
+
+            empty(node->lo, node->hi);
+
+            for (size_t i = begin; i < end; ++i)
+            {
+                for (int k = 0; k < 3; ++k)
+                    grow(node->lo, node->hi, verts[indices[order[i] * 3 + k]]);
+            }
+
+            int axis = 0;
+            float pos = 0.f;
+
+            if (end - begin <= BVH_LEAF || top + 6 > BVH_STACK * 3 ||
+                !split(cent, order, begin, end, node, &axis, &pos))
+            {
+                node->first = begin;
+                node->count = end - begin;
+                continue;
+            }
+
+            size_t mid = begin;
+
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (cent[order[i]][axis] < pos)
+                {
+                    unsigned int tmp = order[i];
+                    order[i] = order[mid];
+                    order[mid++] = tmp;
+                }
+            }
+
+            // Bins can put every centroid on one side after rounding
+            if (mid == begin || mid == end)
+                mid = (begin + end) / 2;
+
+            node->first = b->nnodes;
+            node->count = 0;
+            b->nnodes += 2;
+
+            stack[top++] = node->first;
+            stack[top++] = begin;
+            stack[top++] = mid;
+            stack[top++] = node->first + 1;
+            stack[top++] = mid;
+            stack[top++] = end;
+        }
+    }
+
+    for (size_t i = 0; i < ntris; ++i)
+    {
+        unsigned int *tri = b->tris + i * 3;
+        memcpy(tri, indices + order[i] * 3, sizeof(unsigned int) * 3);
+
+        vec3 ab, ac;
+        glm_vec3_sub(verts[tri[1]], verts[tri[0]], ab);
+        glm_vec3_sub(verts[tri[2]], verts[tri[0]], ac);
+        glm_vec3_crossn(ab, ac, b->norms[i]);
+    }
+
+    free(cent);
+    free(order);
+
+    pseudonormals(b);
+
+    return b;
+}
+
+
+void bvh_free(struct Bvh *b)
+{
+    free(b->nodes);
+    free(b->verts);
+    free(b->tris);
+    free(b->norms);
+    free(b->vnorms);
+    free(b->enorms);
+    free(b);
+}
+
+
+static char *cache_path(const char *path)
+{
+    char *out = malloc(strlen(path) + 5);
+    sprintf(out, "%s.bvh", path);
+    return out;
+}
+
+
+static struct Bvh *cache_load(const char *path, struct stat *st)
+{
+    char *cpath = cache_path(path);
+    FILE *fp = fopen(cpath, "rb");
+    free(cpath);
+
+    if (!fp)
+        return 0;
+
+    struct CacheHeader hdr;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        hdr.magic != CACHE_MAGIC || hdr.version != CACHE_VERSION ||
+        hdr.mtime != (int64_t)st->st_mtime || hdr.size != (int64_t)st->st_size ||
+        hdr.nnodes > (hdr.ntris ? 2 * hdr.ntris - 1 : 1))
+    {
+        fclose(fp);
+        return 0;
+    }
+
+    struct Bvh *b = bvh_new(hdr.nverts, hdr.ntris);
+    b->nnodes = hdr.nnodes;
+
+    bool ok = fread(b->verts, sizeof(vec3), b->nverts, fp) == b->nverts &&
+              fread(b->tris, sizeof(unsigned int) * 3, b->ntris, fp) == b->ntris &&
+              fread(b->norms, sizeof(vec3), b->ntris, fp) == b->ntris &&
+              fread(b->vnorms, sizeof(vec3), b->nverts, fp) == b->nverts &&
+              fread(b->enorms, sizeof(vec3) * 3, b->ntris, fp) == b->ntris &&
+              fread(b->nodes, sizeof(struct BvhNode), b->nnodes, fp) == b->nnodes;
+
+    fclose(fp);
+
+    if (!ok)
+    {
+        bvh_free(b);
+        return 0;
+    }
+
+    return b;
+}
+
+
+static void cache_save(struct Bvh *b, const char *path, struct stat *st)
+{
+    char *cpath = cache_path(path);
+    FILE *fp = fopen(cpath, "wb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "[cache_save] Couldn't write %s\n", cpath);
+        free(cpath);
+        return;
+    }
+
+    free(cpath);
+
+    struct CacheHeader hdr = {
+        CACHE_MAGIC, CACHE_VERSION,
+        st->st_mtime, st->st_size,
+        b->nverts, b->ntris, b->nnodes
+    };
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(b->verts, sizeof(vec3), b->nverts, fp);
+    fwrite(b->tris, sizeof(unsigned int) * 3, b->ntris, fp);
+    fwrite(b->norms, sizeof(vec3), b->ntris, fp);
+    fwrite(b->vnorms, sizeof(vec3), b->nverts, fp);
+    fwrite(b->enorms, sizeof(vec3) * 3, b->ntris, fp);
+    fwrite(b->nodes, sizeof(struct BvhNode), b->nnodes, fp);
+    fclose(fp);
+}
+
+
+struct Bvh *bvh_load(const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        fprintf(stderr, "[bvh_load] Couldn't find '%s'.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct Bvh *b = cache_load(path, &st);
+
+    if (b)
+        return b;
+
+    struct Model *m = model_load(path);
+    b = bvh_build(m->verts, m->nverts, m->indices, m->nindices);
+    model_free(m);
+
+    cache_save(b, path, &st);
+
+    return b;
+}
+
+
+static float box_dist2(struct BvhNode *n, vec3 p)
+{
+    float d = 0.f;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        float e = fmaxf(n->lo[i] - p[i], 0.f) + fmaxf(p[i] - n->hi[i], 0.f);
+        d += e * e;
+    }
+
+    return d;
+}
+
+
+float bvh_closest(struct Bvh *b, vec3 p, float max_dist, vec3 out, unsigned int *tri, float bary[3])
+{
+    float best = max_dist * max_dist;
+    bool hit = false;
+
+    // Builds stop splitting at BVH_STACK pending nodes, so no path is deeper
+    unsigned int stack[BVH_STACK * 2];
+    size_t top = 0;
+
+    if (box_dist2(&b->nodes[0], p) < best)
+        stack[top++] = 0;
+
+    while (top)
+    {
+        struct BvhNode *n = &b->nodes[stack[--top]];
+
+        if (box_dist2(n, p) >= best)
+            continue;
+
+        if (n->count == 0)
+        {
+            // Nearer child last so it is popped first
+            float dl = box_dist2(&b->nodes[n->first], p);
+            float dr = box_dist2(&b->nodes[n->first + 1], p);
+            unsigned int near = dl < dr ? n->first : n->first + 1;
+            unsigned int far = dl < dr ? n->first + 1 : n->first;
+
+            if (fmaxf(dl, dr) < best)
+                stack[top++] = far;
+
+            if (fminf(dl, dr) < best)
+                stack[top++] = near;
+
+            continue;
+        }
+
+        for (unsigned int t = n->first; t < n->first + n->count; ++t)
+        {
+            unsigned int *ix = b->tris + t * 3;
+            float w[3];
+            geom_closest_tri(p, b->verts[ix[0]], b->verts[ix[1]], b->verts[ix[2]], w);
+
+            vec3 q = { 0.f, 0.f, 0.f };
+
+            for (int k = 0; k < 3; ++k)
+                glm_vec3_muladds(b->verts[ix[k]], w[k], q);
+
+            float d = glm_vec3_distance2(p, q);
+
+            if (d < best)
+            {
+                best = d;
+                glm_vec3_copy(q, out);
+                glm_vec3_copy(w, bary);
+                *tri = t;
+                hit = true;
+            }
+        }
+    }
+
+    return hit ? sqrtf(best) : max_dist;
+}
+
+
+void bvh_pseudonormal(struct Bvh *b, unsigned int tri, float bary[3], vec3 out)
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        // On corner k
+        if (bary[k] == 1.f)
+        {
+            glm_vec3_copy(b->vnorms[b->tris[tri * 3 + k]], out);
+            return;
+        }
+
+        // On the side opposite corner k, which starts at corner k + 1
+        if (bary[k] == 0.f)
+        {
+            glm_vec3_copy(b->enorms[tri * 3 + (k + 1) % 3], out);
+            return;
+        }
+    }
+
+    glm_vec3_copy(b->norms[tri], out);
+}
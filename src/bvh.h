@@ -0,0 +1,55 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cglm/cglm.h>
+
+struct BvhNode
+{
+    vec3 lo, hi;
+
+    // Interior nodes have count 0 and children first and first + 1, leaves
+    // hold triangles [first, first + count)
+    unsigned int first, count;
+};
+
+// Bounding volume hierarchy over a static triangle mesh, split by the
+// surface area heuristic
+struct Bvh
+{
+    struct BvhNode *nodes;
+    size_t nnodes;
+
+    vec3 *verts;
+    size_t nverts;
+
+    // Three indices per triangle, sorted so every leaf is contiguous
+    unsigned int *tris;
+    size_t ntris;
+
+    // Unit face normals in tris order
+    vec3 *norms;
+
+    // Angle weighted vertex normals, and per triangle side the sum of the
+    // normals of the faces sharing it. Together they give the inside test
+    // a consistent answer on edges and corners.
+    vec3 *vnorms;
+    vec3 *enorms;
+};
+
+struct Bvh *bvh_build(vec3 *verts, size_t nverts, unsigned int *indices, size_t nindices);
+void bvh_free(struct Bvh *b);
+
+// Builds the hierarchy of the model at path, or reads it from path.bvh if
+// that was written for the same version of the file
+struct Bvh *bvh_load(const char *path);
+
+// Closest point to p on the mesh within max_dist. Returns its distance and
+// writes the point, triangle and barycentric weights, or returns max_dist
+// if there is none.
+float bvh_closest(struct Bvh *b, vec3 p, float max_dist, vec3 out, unsigned int *tri, float bary[3]);
+
+// Normal of the face, side or corner of tri that bary lies on. Points with
+// a negative dot product with it are inside a closed mesh.
+void bvh_pseudonormal(struct Bvh *b, unsigned int tri, float bary[3], vec3 out);
+
+#endif
@@ -8,6 +8,7 @@ struct Camera *cam_alloc(vec3 pos, vec3 rot)
 {
     struct Camera *c = malloc(sizeof(struct Camera));
     glm_vec3_dup(pos, c->pos);
+    glm_vec3_zero(c->rot);
     cam_rot(c, rot);
 
     return c;
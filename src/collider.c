@@ -0,0 +1,547 @@
+#include "collider.h"
+#include "mesh.h"
+#include "pool.h"
+#include <float.h>
+
+
+struct CollideJob
+{
+    struct Mesh *m;
+    struct Collider *c;
+};
+
+
+static struct Collider collider_new(int type, vec3 pos)
+{
+    struct Collider c;
+    c.type = type;
+    glm_vec3_copy(pos, c.pos);
+    glm_mat3_identity(c.rot);
+    glm_vec3_zero(c.half);
+    c.radius = 0.f;
+    c.bvh = 0;
+    c.sdf = 0;
+    c.heightfield = 0;
+    c.friction = .3f;
+    c.restitution = 0.f;
+
+    return c;
+}
+
+
+// Completes rot[1] = up to an orthonormal basis
+static void basis_from_up(mat3 rot, vec3 up)
+{
+    glm_vec3_normalize_to(up, rot[1]);
+
+    vec3 ref = { 1.f, 0.f, 0.f };
+
+    if (fabsf(rot[1][0]) > .9f)
+        glm_vec3_copy((vec3){ 0.f, 0.f, 1.f }, ref);
+
+    glm_vec3_crossn(ref, rot[1], rot[2]);
+    glm_vec3_cross(rot[1], rot[2], rot[0]);
+}
+
+
+struct Collider collider_plane(vec3 point, vec3 normal)
+{
+    struct Collider c = collider_new(COLLIDER_PLANE, point);
+    basis_from_up(c.rot, normal);
+
+    return c;
+}
+
+
+struct Collider collider_sphere(vec3 center, float radius)
+{
+    struct Collider c = collider_new(COLLIDER_SPHERE, center);
+    c.radius = radius;
+
+    return c;
+}
+
+
+struct Collider collider_capsule(vec3 a, vec3 b, float radius)
+{
+    vec3 mid, axis;
+    glm_vec3_lerp(a, b, .5f, mid);
+    glm_vec3_sub(b, a, axis);
+
+    struct Collider c = collider_new(COLLIDER_CAPSULE, mid);
+    c.half[1] = glm_vec3_norm(axis) * .5f;
+    c.radius = radius;
+
+    if (c.half[1] > 0.f)
+        basis_from_up(c.rot, axis);
+
+    return c;
+}
+
+
+struct Collider collider_box(vec3 center, mat3 rot, vec3 half)
+{
+    struct Collider c = collider_new(COLLIDER_BOX, center);
+    glm_mat3_copy(rot, c.rot);
+    glm_vec3_copy(half, c.half);
+
+    return c;
+}
+
+
+struct Collider collider_mesh(const char *path, vec3 pos, mat3 rot)
+{
+    struct Collider c = collider_new(COLLIDER_MESH, pos);
+    glm_mat3_copy(rot, c.rot);
+    c.bvh = bvh_load(path);
+
+    // Deep enough to catch a mass that went a tenth of the way through
+    struct BvhNode *root = &c.bvh->nodes[0];
+    vec3 size;
+    glm_vec3_sub(root->hi, root->lo, size);
+    c.radius = glm_vec3_max(size) * .1f;
+
+    return c;
+}
+
+
+struct Collider collider_sdf(const char *path, float voxel, vec3 pos, mat3 rot)
+{
+    struct Collider c = collider_new(COLLIDER_SDF, pos);
+    glm_mat3_copy(rot, c.rot);
+    c.sdf = sdf_load(path, voxel);
+    c.radius = c.sdf->band;
+
+    return c;
+}
+
+
+struct Collider collider_heightfield(const char *path, vec3 pos, vec3 scale)
+{
+    struct Collider c = collider_new(COLLIDER_HEIGHTFIELD, pos);
+    glm_vec3_copy(scale, c.half);
+    c.heightfield = heightfield_load(path, scale);
+
+    return c;
+}
+
+
+void collider_free(struct Collider *c)
+{
+    if (c->bvh)
+        bvh_free(c->bvh);
+
+    if (c->sdf)
+        sdf_free(c->sdf);
+
+    if (c->heightfield)
+        heightfield_free(c->heightfield);
+
+    c->bvh = 0;
+    c->sdf = 0;
+    c->heightfield = 0;
+}
+
+
+bool collider_bounds(struct Collider *c, vec3 lo, vec3 hi)
+{
+    vec3 ext, center;
+    glm_vec3_copy(c->pos, center);
+
+    switch (c->type)
+    {
+    case COLLIDER_SPHERE:
+        glm_vec3_fill(ext, c->radius);
+        break;
+    case COLLIDER_CAPSULE:
+        for (int i = 0; i < 3; ++i)
+            ext[i] = fabsf(c->rot[1][i]) * c->half[1] + c->radius;
+        break;
+    case COLLIDER_BOX:
+        // Projection of the box onto each world axis
+        for (int i = 0; i < 3; ++i)
+        {
+            ext[i] = fabsf(c->rot[0][i]) * c->half[0] +
+                     fabsf(c->rot[1][i]) * c->half[1] +
+                     fabsf(c->rot[2][i]) * c->half[2];
+        }
+        break;
+    case COLLIDER_MESH:
+    case COLLIDER_SDF:
+    {
+        vec3 lo, hi;
+
+        if (c->type == COLLIDER_MESH)
+        {
+            if (c->bvh->ntris == 0)
+                return false;
+
+            glm_vec3_copy(c->bvh->nodes[0].lo, lo);
+            glm_vec3_copy(c->bvh->nodes[0].hi, hi);
+        }
+        else
+        {
+            // Everything off the grid is outside
+            float size = c->sdf->voxel * SDF_BRICK;
+            glm_vec3_copy(c->sdf->origin, lo);
+
+            for (int i = 0; i < 3; ++i)
+                hi[i] = lo[i] + c->sdf->dims[i] * size;
+        }
+
+        vec3 mid, half;
+        glm_vec3_lerp(lo, hi, .5f, mid);
+        glm_vec3_sub(hi, mid, half);
+        glm_vec3_adds(half, c->radius, half);
+
+        glm_mat3_mulv(c->rot, mid, center);
+        glm_vec3_add(center, c->pos, center);
+
+        for (int i = 0; i < 3; ++i)
+        {
+            ext[i] = fabsf(c->rot[0][i]) * half[0] +
+                     fabsf(c->rot[1][i]) * half[1] +
+                     fabsf(c->rot[2][i]) * half[2];
+        }
+    } break;
+    case COLLIDER_HEIGHTFIELD:
+        // Masses up to a terrain height below the lowest point are pushed up
+        glm_vec3_scale(c->half, .5f, ext);
+        glm_vec3_add(center, ext, center);
+        center[1] = c->pos[1];
+        ext[1] = c->half[1];
+        break;
+    default:
+        return false;
+    }
+
+    glm_vec3_sub(center, ext, lo);
+    glm_vec3_add(center, ext, hi);
+
+    return true;
+}
+
+
+// Distance and direction from the closest point on segment pos +- axis * len
+// swept by radius. A sphere is the segment of length 0.
+static void capsule_distance(struct Collider *c, float len, struct ColliderBatch *b)
+{
+    float cx = c->pos[0], cy = c->pos[1], cz = c->pos[2];
+    float ax = c->rot[1][0], ay = c->rot[1][1], az = c->rot[1][2];
+    float r = c->radius, nlen = -len;
+
+    #pragma omp simd
+    for (size_t i = 0; i < b->n; ++i)
+    {
+        float px = b->x[i] - cx, py = b->y[i] - cy, pz = b->z[i] - cz;
+
+        float t = px * ax + py * ay + pz * az;
+        t = t < nlen ? nlen : t;
+        t = t > len ? len : t;
+
+        float dx = px - t * ax, dy = py - t * ay, dz = pz - t * az;
+        float d = sqrtf(dx * dx + dy * dy + dz * dz);
+        float inv = 1.f / (d > 1e-12f ? d : 1e-12f);
+
+        b->dist[i] = d - r;
+        b->nx[i] = dx * inv;
+        // The centre line has no direction, push up
+        b->ny[i] = d > 1e-12f ? dy * inv : 1.f;
+        b->nz[i] = dz * inv;
+    }
+}
+
+
+static void box_distance(struct Collider *c, struct ColliderBatch *b)
+{
+    float cx = c->pos[0], cy = c->pos[1], cz = c->pos[2];
+    float hx = c->half[0], hy = c->half[1], hz = c->half[2];
+
+    float r00 = c->rot[0][0], r01 = c->rot[0][1], r02 = c->rot[0][2];
+    float r10 = c->rot[1][0], r11 = c->rot[1][1], r12 = c->rot[1][2];
+    float r20 = c->rot[2][0], r21 = c->rot[2][1], r22 = c->rot[2][2];
+
+    #pragma omp simd
+    for (size_t i = 0; i < b->n; ++i)
+    {
+        float wx = b->x[i] - cx, wy = b->y[i] - cy, wz = b->z[i] - cz;
+
+        // Local coordinates, rot is orthonormal so its transpose inverts it
+        float px = wx * r00 + wy * r01 + wz * r02;
+        float py = wx * r10 + wy * r11 + wz * r12;
+        float pz = wx * r20 + wy * r21 + wz * r22;
+
+        float sx = px < 0.f ? -1.f : 1.f, sy = py < 0.f ? -1.f : 1.f, sz = pz < 0.f ? -1.f : 1.f;
+        float qx = fabsf(px) - hx, qy = fabsf(py) - hy, qz = fabsf(pz) - hz;
+
+        float ox = qx > 0.f ? qx : 0.f, oy = qy > 0.f ? qy : 0.f, oz = qz > 0.f ? qz : 0.f;
+        float out = sqrtf(ox * ox + oy * oy + oz * oz);
+        float inv = 1.f / (out > 0.f ? out : 1.f);
+
+        float qm = qx > qy ? qx : qy;
+        qm = qm > qz ? qm : qz;
+        float in = qm < 0.f ? qm : 0.f;
+
+        // Outside the normal points from the closest surface point, inside
+        // it is the face with the least penetration
+        bool fx = qx >= qy && qx >= qz;
+        bool fy = !fx && qy >= qz;
+        bool fz = !fx && !fy;
+
+        float lx = out > 0.f ? sx * ox * inv : (fx ? sx : 0.f);
+        float ly = out > 0.f ? sy * oy * inv : (fy ? sy : 0.f);
+        float lz = out > 0.f ? sz * oz * inv : (fz ? sz : 0.f);
+
+        b->dist[i] = out + in;
+        b->nx[i] = r00 * lx + r10 * ly + r20 * lz;
+        b->ny[i] = r01 * lx + r11 * ly + r21 * lz;
+        b->nz[i] = r02 * lx + r12 * ly + r22 * lz;
+    }
+}
+
+
+static void plane_distance(struct Collider *c, struct ColliderBatch *b)
+{
+    float nx = c->rot[1][0], ny = c->rot[1][1], nz = c->rot[1][2];
+    float off = glm_vec3_dot(c->pos, c->rot[1]);
+
+    #pragma omp simd
+    for (size_t i = 0; i < b->n; ++i)
+    {
+        b->dist[i] = b->x[i] * nx + b->y[i] * ny + b->z[i] * nz - off;
+        b->nx[i] = nx;
+        b->ny[i] = ny;
+        b->nz[i] = nz;
+    }
+}
+
+
+// Closest point queries one mass at a time, the sign comes from the
+// pseudonormal of the closest feature
+static void mesh_distance(struct Collider *c, struct ColliderBatch *b)
+{
+    struct Bvh *bvh = c->bvh;
+
+    for (size_t i = 0; i < b->n; ++i)
+    {
+        vec3 w = { b->x[i] - c->pos[0], b->y[i] - c->pos[1], b->z[i] - c->pos[2] };
+        vec3 p = {
+            glm_vec3_dot(c->rot[0], w),
+            glm_vec3_dot(c->rot[1], w),
+            glm_vec3_dot(c->rot[2], w)
+        };
+
+        vec3 q, n, pn;
+        unsigned int tri;
+        float bary[3];
+        float d = bvh_closest(bvh, p, c->radius, q, &tri, bary);
+
+        if (d >= c->radius)
+        {
+            b->dist[i] = FLT_MAX;
+            b->nx[i] = b->nz[i] = 0.f;
+            b->ny[i] = 1.f;
+            continue;
+        }
+
+        bvh_pseudonormal(bvh, tri, bary, pn);
+
+        glm_vec3_sub(p, q, n);
+        float side = glm_vec3_dot(n, pn) < 0.f ? -1.f : 1.f;
+
+        if (d > 1e-6f)
+            glm_vec3_scale(n, side / d, n);
+        else
+            glm_vec3_copy(pn, n);
+
+        vec3 wn;
+        glm_mat3_mulv(c->rot, n, wn);
+
+        b->dist[i] = side * d;
+        b->nx[i] = wn[0];
+        b->ny[i] = wn[1];
+        b->nz[i] = wn[2];
+    }
+}
+
+
+// Trilinear lookups, a handful of reads per mass regardless of the
+// triangle count
+static void sdf_distance(struct Collider *c, struct ColliderBatch *b)
+{
+    for (size_t i = 0; i < b->n; ++i)
+    {
+        vec3 w = { b->x[i] - c->pos[0], b->y[i] - c->pos[1], b->z[i] - c->pos[2] };
+        vec3 p = {
+            glm_vec3_dot(c->rot[0], w),
+            glm_vec3_dot(c->rot[1], w),
+            glm_vec3_dot(c->rot[2], w)
+        };
+
+        vec3 n, wn;
+        float d = sdf_sample(c->sdf, p, n);
+        glm_mat3_mulv(c->rot, n, wn);
+
+        // Outside past the band the grid holds no distance
+        b->dist[i] = d < c->radius ? d : FLT_MAX;
+        b->nx[i] = wn[0];
+        b->ny[i] = wn[1];
+        b->nz[i] = wn[2];
+    }
+}
+
+
+// Vertical distance to the terrain scaled by the slope, exact wherever the
+// terrain is locally planar
+static void heightfield_distance(struct Collider *c, struct ColliderBatch *b)
+{
+    struct Heightfield *hf = c->heightfield;
+
+    for (size_t i = 0; i < b->n; ++i)
+    {
+        float x = b->x[i] - c->pos[0], z = b->z[i] - c->pos[2];
+
+        vec3 n;
+        float h = heightfield_sample(hf, x, z, n);
+        bool over = x >= 0.f && x <= c->half[0] && z >= 0.f && z <= c->half[2];
+
+        b->dist[i] = over ? (b->y[i] - c->pos[1] - h) * n[1] : FLT_MAX;
+        b->nx[i] = n[0];
+        b->ny[i] = n[1];
+        b->nz[i] = n[2];
+    }
+}
+
+
+void collider_distance(struct Collider *c, struct ColliderBatch *b)
+{
+    switch (c->type)
+    {
+    case COLLIDER_PLANE:
+        plane_distance(c, b);
+        break;
+    case COLLIDER_SPHERE:
+        capsule_distance(c, 0.f, b);
+        break;
+    case COLLIDER_CAPSULE:
+        capsule_distance(c, c->half[1], b);
+        break;
+    case COLLIDER_BOX:
+        box_distance(c, b);
+        break;
+    case COLLIDER_MESH:
+        mesh_distance(c, b);
+        break;
+    case COLLIDER_SDF:
+        sdf_distance(c, b);
+        break;
+    case COLLIDER_HEIGHTFIELD:
+        heightfield_distance(c, b);
+        break;
+    }
+}
+
+
+// Projects mass i out to skin along n and splits its velocity into a
+// normal part, reflected by restitution, and a tangential part slowed by
+// friction in proportion to the normal impulse
+static void respond(struct Mesh *m, struct Collider *c, size_t i, float dist, vec3 n)
+{
+    glm_vec3_muladds(n, m->skin - dist, m->pos[i]);
+
+    float *v = m->vel[i];
+    float vn = glm_vec3_dot(v, n);
+
+    if (vn >= 0.f)
+        return;
+
+    vec3 vt;
+    glm_vec3_copy(v, vt);
+    glm_vec3_muladds(n, -vn, vt);
+
+    float dvn = -(1.f + c->restitution) * vn;
+    float tlen = glm_vec3_norm(vt);
+
+    // Static friction holds the mass if it can cancel all tangential motion
+    if (tlen <= c->friction * dvn)
+        glm_vec3_zero(vt);
+    else
+        glm_vec3_scale(vt, 1.f - c->friction * dvn / tlen, vt);
+
+    glm_vec3_copy(vt, v);
+    glm_vec3_muladds(n, -c->restitution * vn, v);
+}
+
+
+static void collide_job(void *arg, size_t begin, size_t end)
+{
+    struct CollideJob *j = arg;
+    struct Mesh *m = j->m;
+
+    struct ColliderBatch b;
+
+    for (size_t first = begin; first < end; first += COLLIDER_BATCH)
+    {
+        b.n = end - first < COLLIDER_BATCH ? end - first : COLLIDER_BATCH;
+
+        // Distances vectorize across masses once the positions are split
+        // into one array per axis
+        for (size_t k = 0; k < b.n; ++k)
+        {
+            b.x[k] = m->pos[first + k][0];
+            b.y[k] = m->pos[first + k][1];
+            b.z[k] = m->pos[first + k][2];
+        }
+
+        collider_distance(j->c, &b);
+
+        // Contacts are rare, the response only runs for the few hits
+        for (size_t k = 0; k < b.n; ++k)
+        {
+            if (b.dist[k] < m->skin && m->inv_mass[first + k] > 0.f)
+                respond(m, j->c, first + k, b.dist[k], (vec3){ b.nx[k], b.ny[k], b.nz[k] });
+        }
+    }
+}
+
+
+void mesh_collide(struct Mesh *m)
+{
+    if (!m->ncolliders)
+        return;
+
+    vec3 lo, hi;
+    mesh_bounds(m, lo, hi);
+    glm_vec3_subs(lo, m->skin, lo);
+    glm_vec3_adds(hi, m->skin, hi);
+
+    for (size_t i = 0; i < m->ncolliders; ++i)
+    {
+        struct Collider *c = &m->colliders[i];
+        vec3 clo, chi;
+
+        if (collider_bounds(c, clo, chi))
+        {
+            if (clo[0] > hi[0] || clo[1] > hi[1] || clo[2] > hi[2] ||
+                chi[0] < lo[0] || chi[1] < lo[1] || chi[2] < lo[2])
+                continue;
+        }
+        else if (c->type == COLLIDER_PLANE)
+        {
+            // Lowest corner of the cloth's box along the normal
+            vec3 mid, ext;
+            glm_vec3_lerp(lo, hi, .5f, mid);
+            glm_vec3_sub(hi, mid, ext);
+
+            float *n = c->rot[1];
+            float d = glm_vec3_dot(mid, n) - glm_vec3_dot(c->pos, n) -
+                      (fabsf(n[0]) * ext[0] + fabsf(n[1]) * ext[1] + fabsf(n[2]) * ext[2]);
+
+            if (d > 0.f)
+                continue;
+        }
+
+        struct CollideJob j = { m, c };
+        pool_for(pool_global(), m->nmasses, COLLIDER_BATCH * 16, collide_job, &j);
+    }
+}
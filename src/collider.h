@@ -0,0 +1,89 @@
+#ifndef COLLIDER_H
+#define COLLIDER_H
+
+#include "bvh.h"
+#include "heightfield.h"
+#include "sdf.h"
+#include <cglm/cglm.h>
+
+struct Mesh;
+
+enum
+{
+    // Half space below the plane through pos with normal rot[1]
+    COLLIDER_PLANE,
+    COLLIDER_SPHERE,
+    // Segment of length 2 * half[1] along rot[1] through pos, swept by radius
+    COLLIDER_CAPSULE,
+    // Half extents half along the columns of rot
+    COLLIDER_BOX,
+    // Triangle mesh moved by pos and rot, only penetrations shallower than
+    // radius are seen
+    COLLIDER_MESH,
+    // Precomputed distance grid of a triangle mesh, moved by pos and rot
+    COLLIDER_SDF,
+    // Terrain below a heightfield whose first sample is at pos, y is up
+    COLLIDER_HEIGHTFIELD
+};
+
+// Points per distance query, small enough to stay in cache
+#define COLLIDER_BATCH 256
+
+// Query points and results, one array per component so that queries
+// vectorize across points
+struct ColliderBatch
+{
+    size_t n;
+    float x[COLLIDER_BATCH], y[COLLIDER_BATCH], z[COLLIDER_BATCH];
+
+    float dist[COLLIDER_BATCH];
+    float nx[COLLIDER_BATCH], ny[COLLIDER_BATCH], nz[COLLIDER_BATCH];
+};
+
+// Static shape the cloth cannot enter
+struct Collider
+{
+    int type;
+
+    vec3 pos;
+    mat3 rot;
+    vec3 half;
+    float radius;
+
+    // Owned, only for COLLIDER_MESH
+    struct Bvh *bvh;
+    // Owned, only for COLLIDER_SDF
+    struct Sdf *sdf;
+    // Owned, only for COLLIDER_HEIGHTFIELD
+    struct Heightfield *heightfield;
+
+    // Coulomb coefficient, and the fraction of normal speed kept on impact
+    float friction;
+    float restitution;
+};
+
+struct Collider collider_plane(vec3 point, vec3 normal);
+struct Collider collider_sphere(vec3 center, float radius);
+struct Collider collider_capsule(vec3 a, vec3 b, float radius);
+struct Collider collider_box(vec3 center, mat3 rot, vec3 half);
+// Any model assimp can read, see bvh_load
+struct Collider collider_mesh(const char *path, vec3 pos, mat3 rot);
+// Same as collider_mesh but sampled from a grid with cells of size voxel,
+// see sdf_load. Only penetrations shallower than 2 * voxel are seen
+struct Collider collider_sdf(const char *path, float voxel, vec3 pos, mat3 rot);
+// Grayscale image covering scale[0] by scale[2] and scale[1] high, see
+// heightfield_load
+struct Collider collider_heightfield(const char *path, vec3 pos, vec3 scale);
+void collider_free(struct Collider *c);
+
+// World space bounds, false for unbounded shapes
+bool collider_bounds(struct Collider *c, vec3 lo, vec3 hi);
+
+// Signed distance and outward normal of every point, negative inside
+void collider_distance(struct Collider *c, struct ColliderBatch *b);
+
+// Pushes every mass within Mesh::skin of a collider back out and applies
+// restitution and friction to its velocity
+void mesh_collide(struct Mesh *m);
+
+#endif
@@ -0,0 +1,96 @@
+#include "geom.h"
+
+
+void geom_closest_tri(vec3 p, vec3 a, vec3 b, vec3 c, float out[3])
+{
+    vec3 ab, ac, ap, bp, cp;
+    glm_vec3_sub(b, a, ab);
+    glm_vec3_sub(c, a, ac);
+    glm_vec3_sub(p, a, ap);
+
+    float d1 = glm_vec3_dot(ab, ap), d2 = glm_vec3_dot(ac, ap);
+
+    if (d1 <= 0.f && d2 <= 0.f)
+    {
+        glm_vec3_copy((vec3){ 1.f, 0.f, 0.f }, out);
+        return;
+    }
+
+    glm_vec3_sub(p, b, bp);
+    float d3 = glm_vec3_dot(ab, bp), d4 = glm_vec3_dot(ac, bp);
+
+    if (d3 >= 0.f && d4 <= d3)
+    {
+        glm_vec3_copy((vec3){ 0.f, 1.f, 0.f }, out);
+        return;
+    }
+
+    float vc = d1 * d4 - d3 * d2;
+
+    if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+    {
+        float v = d1 / (d1 - d3);
+        glm_vec3_copy((vec3){ 1.f - v, v, 0.f }, out);
+        return;
+    }
+
+    glm_vec3_sub(p, c, cp);
+    float d5 = glm_vec3_dot(ab, cp), d6 = glm_vec3_dot(ac, cp);
+
+    if (d6 >= 0.f && d5 <= d6)
+    {
+        glm_vec3_copy((vec3){ 0.f, 0.f, 1.f }, out);
+        return;
+    }
+
+    float vb = d5 * d2 - d1 * d6;
+
+    if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+    {
+        float w = d2 / (d2 - d6);
+        glm_vec3_copy((vec3){ 1.f - w, 0.f, w }, out);
+        return;
+    }
+
+    float va = d3 * d6 - d5 * d4;
+
+    if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f)
+    {
+        float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        glm_vec3_copy((vec3){ 0.f, 1.f - w, w }, out);
+        return;
+    }
+
+    float denom = 1.f / (va + vb + vc);
+    float v = vb * denom, w = vc * denom;
+    glm_vec3_copy((vec3){ 1.f - v - w, v, w }, out);
+}
+
+
+void geom_closest_seg(vec3 p1, vec3 q1, vec3 p2, vec3 q2, float *s, float *t)
+{
+    vec3 d1, d2, r;
+    glm_vec3_sub(q1, p1, d1);
+    glm_vec3_sub(q2, p2, d2);
+    glm_vec3_sub(p1, p2, r);
+
+    float a = glm_vec3_dot(d1, d1), e = glm_vec3_dot(d2, d2);
+    float f = glm_vec3_dot(d2, r);
+    float c = glm_vec3_dot(d1, r);
+    float b = glm_vec3_dot(d1, d2);
+    float denom = a * e - b * b;
+
+    *s = denom > 1e-12f ? glm_clamp((b * f - c * e) / denom, 0.f, 1.f) : 0.f;
+    *t = e > 1e-12f ? (b * *s + f) / e : 0.f;
+
+    if (*t < 0.f)
+    {
+        *t = 0.f;
+        *s = a > 1e-12f ? glm_clamp(-c / a, 0.f, 1.f) : 0.f;
+    }
+    else if (*t > 1.f)
+    {
+        *t = 1.f;
+        *s = a > 1e-12f ? glm_clamp((b - c) / a, 0.f, 1.f) : 0.f;
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef GEOM_H
+#define GEOM_H
+
+#include <cglm/cglm.h>
+
+// Barycentric weights of the point on abc closest to p
+void geom_closest_tri(vec3 p, vec3 a, vec3 b, vec3 c, float out[3]);
+// Parameters along p1q1 and p2q2 of their closest points
+void geom_closest_seg(vec3 p1, vec3 q1, vec3 p2, vec3 q2, float *s, float *t);
+
+#endif
@@ -0,0 +1,245 @@
+#include "hashgrid.h"
+#include "pool.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCAN_BLOCK 8192
+
+struct BuildJob
+{
+    struct HashGrid *g;
+    vec3 *pts;
+};
+
+
+struct HashGrid *hashgrid_alloc(size_t cap)
+{
+    struct HashGrid *g = malloc(sizeof(struct HashGrid));
+    g->cell = 1.f;
+    g->cap = cap;
+    g->nitems = 0;
+
+    // One chunk per thread of the pool, the calling one included
+    g->nchunks = pool_global()->nthreads + 1;
+
+    g->nbuckets = 1;
+    while (g->nbuckets < cap)
+        g->nbuckets <<= 1;
+
+    g->start = util_alloc_aligned(sizeof(unsigned int) * (g->nbuckets + 1));
+    g->items = util_alloc_aligned(sizeof(unsigned int) * (cap ? cap : 1));
+    g->hashes = util_alloc_aligned(sizeof(unsigned int) * (cap ? cap : 1));
+    g->keys = util_alloc_aligned(sizeof(unsigned int) * (cap ? cap : 1));
+    g->hist = util_alloc_aligned(sizeof(unsigned int) * g->nchunks * g->nbuckets);
+    g->blocks = malloc(sizeof(unsigned int) * ((g->nbuckets + SCAN_BLOCK - 1) / SCAN_BLOCK));
+
+    memset(g->start, 0, sizeof(unsigned int) * (g->nbuckets + 1));
+
+    return g;
+}
+
+
+void hashgrid_free(struct HashGrid *g)
+{
+    free(g->start);
+    free(g->items);
+    free(g->hashes);
+    free(g->keys);
+    free(g->hist);
+    free(g->blocks);
+    free(g);
+}
+
+
+void hashgrid_cell(struct HashGrid *g, vec3 p, int out[3])
+{
+    for (int i = 0; i < 3; ++i)
+        out[i] = (int)floorf(p[i] / g->cell);
+}
+
+
+unsigned int hashgrid_hash(int x, int y, int z)
+{
+    return (unsigned int)x * 73856093u ^
+           (unsigned int)y * 19349663u ^
+           (unsigned int)z * 83492791u;
+}
+
+
+// Chunks are contiguous and scattered in order, so every bucket lists its
+// items in index order whatever the chunk count
+static void chunk_range(struct HashGrid *g, size_t c, size_t *begin, size_t *end)
+{
+    *begin = g->nitems * c / g->nchunks;
+    *end = g->nitems * (c + 1) / g->nchunks;
+}
+
+
+static void count_job(void *arg, size_t begin, size_t end)
+{
+    struct BuildJob *j = arg;
+    struct HashGrid *g = j->g;
+
+    for (size_t c = begin; c < end; ++c)
+    {
+        unsigned int *hist = g->hist + c * g->nbuckets;
+        memset(hist, 0, sizeof(unsigned int) * g->nbuckets);
+
+        size_t b, e;
+        chunk_range(g, c, &b, &e);
+
+        for (size_t i = b; i < e; ++i)
+        {
+            int cell[3];
+            hashgrid_cell(g, j->pts[i], cell);
+
+            g->keys[i] = hashgrid_hash(cell[0], cell[1], cell[2]);
+            ++hist[g->keys[i] & (g->nbuckets - 1)];
+        }
+    }
+}
+
+
+// Turns every chunk's counts into its offset within the bucket, leaving
+// the bucket total in start
+static void offset_job(void *arg, size_t begin, size_t end)
+{
+    struct HashGrid *g = arg;
+
+    for (size_t b = begin; b < end; ++b)
+    {
+        unsigned int total = 0;
+
+        for (size_t c = 0; c < g->nchunks; ++c)
+        {
+            unsigned int n = g->hist[c * g->nbuckets + b];
+            g->hist[c * g->nbuckets + b] = total;
+            total += n;
+        }
+
+        g->start[b] = total;
+    }
+}
+
+
+static void block_sum_job(void *arg, size_t begin, size_t end)
+{
+    struct HashGrid *g = arg;
+
+    for (size_t blk = begin; blk < end; ++blk)
+    {
+        unsigned int *s = g->start + blk * SCAN_BLOCK;
+        unsigned int total = 0;
+
+        for (size_t i = 0; i < SCAN_BLOCK && blk * SCAN_BLOCK + i < g->nbuckets; ++i)
+        {
+            unsigned int n = s[i];
+            s[i] = total;
+            total += n;
+        }
+
+        g->blocks[blk] = total;
+    }
+}
+
+
+static void block_add_job(void *arg, size_t begin, size_t end)
+{
+    struct HashGrid *g = arg;
+
+    for (size_t blk = begin; blk < end; ++blk)
+    {
+        unsigned int *s = g->start + blk * SCAN_BLOCK;
+
+        for (size_t i = 0; i < SCAN_BLOCK && blk * SCAN_BLOCK + i < g->nbuckets; ++i)
+            s[i] += g->blocks[blk];
+    }
+}
+
+
+static void scatter_job(void *arg, size_t begin, size_t end)
+{
+    struct BuildJob *j = arg;
+    struct HashGrid *g = j->g;
+
+    for (size_t c = begin; c < end; ++c)
+    {
+        unsigned int *hist = g->hist + c * g->nbuckets;
+
+        size_t b, e;
+        chunk_range(g, c, &b, &e);
+
+        for (size_t i = b; i < e; ++i)
+        {
+            unsigned int key = g->keys[i] & (g->nbuckets - 1);
+            unsigned int at = g->start[key] + hist[key]++;
+
+            g->items[at] = i;
+            g->hashes[at] = g->keys[i];
+        }
+    }
+}
+
+
+void hashgrid_build(struct HashGrid *g, vec3 *pts, size_t n, float cell)
+{
+    if (n > g->cap)
+    {
+        fprintf(stderr, "[hashgrid_build] %zu points exceed capacity %zu.\n", n, g->cap);
+        exit(EXIT_FAILURE);
+    }
+
+    g->cell = cell;
+    g->nitems = n;
+
+    struct BuildJob j = { g, pts };
+    struct Pool *pool = pool_global();
+
+    pool_for(pool, g->nchunks, 1, count_job, &j);
+    pool_for(pool, g->nbuckets, SCAN_BLOCK, offset_job, g);
+
+    // Exclusive scan of the bucket totals: each block is scanned on its
+    // own, then shifted by the sum of the blocks before it
+    size_t nblocks = (g->nbuckets + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    pool_for(pool, nblocks, 1, block_sum_job, g);
+
+    unsigned int total = 0;
+
+    for (size_t blk = 0; blk < nblocks; ++blk)
+    {
+        unsigned int n = g->blocks[blk];
+        g->blocks[blk] = total;
+        total += n;
+    }
+
+    pool_for(pool, nblocks, 1, block_add_job, g);
+    g->start[g->nbuckets] = total;
+
+    pool_for(pool, g->nchunks, 1, scatter_job, &j);
+}
+
+
+size_t hashgrid_query(struct HashGrid *g, vec3 lo, vec3 hi, unsigned int *out, size_t max)
+{
+    int a[3], b[3];
+    hashgrid_cell(g, lo, a);
+    hashgrid_cell(g, hi, b);
+
+    size_t n = 0;
+
+    for (int x = a[0]; x <= b[0]; ++x)
+    {
+        for (int y = a[1]; y <= b[1]; ++y)
+        {
+            for (int z = a[2]; z <= b[2]; ++z)
+            {
+                if (n < max)
+                    out[n++] = hashgrid_hash(x, y, z);
+            }
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,46 @@
+#ifndef HASHGRID_H
+#define HASHGRID_H
+
+#include <cglm/cglm.h>
+
+// Uniform grid of cubic cells hashed into a power of two bucket count,
+// rebuilt from scratch with a counting sort every time points move. Cells
+// are identified by a 32 bit hash whose low bits pick the bucket, the full
+// hash is kept per item to skip other cells sharing the bucket.
+struct HashGrid
+{
+    float cell;
+
+    size_t nbuckets;
+
+    // Items of bucket b are items[start[b], start[b + 1]), in index order,
+    // hashes holds the cell hash of each
+    unsigned int *start;
+    unsigned int *items;
+    unsigned int *hashes;
+    size_t nitems, cap;
+
+    // Cell hash of every item, per chunk counts and per scan block sums, only
+    // meaningful during a build
+    unsigned int *keys;
+    unsigned int *hist;
+    unsigned int *blocks;
+    // Ranges of items counted and scattered in parallel, one per thread
+    size_t nchunks;
+};
+
+// Room for up to cap points
+struct HashGrid *hashgrid_alloc(size_t cap);
+void hashgrid_free(struct HashGrid *g);
+
+void hashgrid_build(struct HashGrid *g, vec3 *pts, size_t n, float cell);
+
+void hashgrid_cell(struct HashGrid *g, vec3 p, int out[3]);
+unsigned int hashgrid_hash(int x, int y, int z);
+
+// Hashes of the cells overlapping [lo, hi], at most max of them are
+// written to out. Returns how many were written. Two cells can share a hash,
+// so callers must tolerate seeing an item twice.
+size_t hashgrid_query(struct HashGrid *g, vec3 lo, vec3 hi, unsigned int *out, size_t max);
+
+#endif
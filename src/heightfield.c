@@ -0,0 +1,111 @@
+#include "heightfield.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stb/stb_image.h>
+
+
+struct Heightfield *heightfield_load(const char *path, vec3 scale)
+{
+    int w, h, nchannels;
+    float *heights = 0;
+
+    // Terrain is often exported at 16 bits, 8 would step visibly
+    if (stbi_is_16_bit(path))
+    {
+        unsigned short *data = stbi_load_16(path, &w, &h, &nchannels, 1);
+
+        if (data)
+        {
+            heights = malloc(sizeof(float) * w * h);
+
+            for (int i = 0; i < w * h; ++i)
+                heights[i] = data[i] / 65535.f * scale[1];
+
+            stbi_image_free(data);
+        }
+    }
+    else
+    {
+        unsigned char *data = stbi_load(path, &w, &h, &nchannels, 1);
+
+        if (data)
+        {
+            heights = malloc(sizeof(float) * w * h);
+
+            for (int i = 0; i < w * h; ++i)
+                heights[i] = data[i] / 255.f * scale[1];
+
+            stbi_image_free(data);
+        }
+    }
+
+    if (!heights)
+    {
+        fprintf(stderr, "[heightfield_load] Failed to load file '%s'.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (w < 2 || h < 2)
+    {
+        fprintf(stderr, "[heightfield_load] Image '%s' is %dx%d, at least 2x2 is needed.\n", path, w, h);
+        exit(EXIT_FAILURE);
+    }
+
+    struct Heightfield *hf = malloc(sizeof(struct Heightfield));
+    hf->w = w;
+    hf->h = h;
+    hf->heights = heights;
+    hf->dx = scale[0] / (w - 1);
+    hf->dz = scale[2] / (h - 1);
+
+    return hf;
+}
+
+
+void heightfield_free(struct Heightfield *hf)
+{
+    free(hf->heights);
+    free(hf);
+}
+
+
+// Bilinear height at grid coordinates (u, v), already clamped
+static float bilinear(struct Heightfield *hf, float u, float v)
+{
+    int x = (int)u, z = (int)v;
+    x = x < hf->w - 2 ? x : hf->w - 2;
+    z = z < hf->h - 2 ? z : hf->h - 2;
+
+    float tx = u - x, tz = v - z;
+    float *row = hf->heights + (size_t)z * hf->w + x;
+
+    float h0 = row[0] + (row[1] - row[0]) * tx;
+    float h1 = row[hf->w] + (row[hf->w + 1] - row[hf->w]) * tx;
+
+    return h0 + (h1 - h0) * tz;
+}
+
+
+static float clamp_coord(float u, int n)
+{
+    return u < 0.f ? 0.f : (u > n - 1 ? n - 1 : u);
+}
+
+
+float heightfield_sample(struct Heightfield *hf, float x, float z, vec3 norm)
+{
+    float u = clamp_coord(x / hf->dx, hf->w);
+    float v = clamp_coord(z / hf->dz, hf->h);
+
+    // Differences shrink to one sided at the edges
+    float u0 = clamp_coord(u - 1.f, hf->w), u1 = clamp_coord(u + 1.f, hf->w);
+    float v0 = clamp_coord(v - 1.f, hf->h), v1 = clamp_coord(v + 1.f, hf->h);
+
+    float dhdx = (bilinear(hf, u1, v) - bilinear(hf, u0, v)) / ((u1 - u0) * hf->dx);
+    float dhdz = (bilinear(hf, u, v1) - bilinear(hf, u, v0)) / ((v1 - v0) * hf->dz);
+
+    glm_vec3_copy((vec3){ -dhdx, 1.f, -dhdz }, norm);
+    glm_vec3_normalize(norm);
+
+    return bilinear(hf, u, v);
+}
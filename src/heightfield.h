@@ -0,0 +1,27 @@
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include <cglm/cglm.h>
+
+// Terrain sampled on a regular grid in the xz plane
+struct Heightfield
+{
+    // Samples per row and column, heights[z * w + x]
+    int w, h;
+    float *heights;
+
+    // World distance between neighbouring samples along x and z
+    float dx, dz;
+};
+
+// Grayscale image at path, 8 or 16 bit, stretched over scale[0] by scale[2]
+// with black at height 0 and white at scale[1]
+struct Heightfield *heightfield_load(const char *path, vec3 scale);
+void heightfield_free(struct Heightfield *hf);
+
+// Bilinear height at (x, z) from the corner of sample 0, and the normal
+// from central differences a sample apart. Points off the grid are clamped
+// to its edge
+float heightfield_sample(struct Heightfield *hf, float x, float z, vec3 norm);
+
+#endif
@@ -0,0 +1,371 @@
+#include "implicit.h"
+#include "mesh.h"
+#include "pool.h"
+#include "tear.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ROW_GRAIN 2048
+#define SPRING_GRAIN 4096
+
+struct AssembleJob
+{
+    struct Mesh *m;
+    size_t first;
+    float dt;
+};
+
+struct MulJob
+{
+    struct Implicit *im;
+    size_t n;
+    vec3 *in, *out;
+};
+
+
+struct Implicit *implicit_alloc(struct Mesh *m)
+{
+    struct Implicit *im = malloc(sizeof(struct Implicit));
+    size_t n = m->nmasses;
+    size_t cap = m->mass_cap;
+
+    // Row i holds its diagonal block followed by one block per spring
+    im->rows = malloc(sizeof(size_t) * (cap + 1));
+    memset(im->rows, 0, sizeof(size_t) * (n + 1));
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        ++im->rows[m->springs[i].a + 1];
+        ++im->rows[m->springs[i].b + 1];
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        im->rows[i + 1] += im->rows[i] + 1;
+
+    im->nblocks = im->rows[n];
+    im->blocks_cap = im->nblocks;
+    im->cols = malloc(sizeof(unsigned int) * im->blocks_cap);
+    im->blocks = util_alloc_aligned(sizeof(mat3) * im->blocks_cap);
+    im->spring_blocks = malloc(sizeof(size_t) * 2 * m->nsprings);
+
+    size_t *fill = malloc(sizeof(size_t) * n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        im->cols[im->rows[i]] = i;
+        fill[i] = im->rows[i] + 1;
+    }
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        struct Spring *s = &m->springs[i];
+
+        im->spring_blocks[i * 2] = fill[s->a];
+        im->cols[fill[s->a]++] = s->b;
+
+        im->spring_blocks[i * 2 + 1] = fill[s->b];
+        im->cols[fill[s->b]++] = s->a;
+    }
+
+    free(fill);
+
+    im->rhs = util_alloc_aligned(sizeof(vec3) * cap);
+    im->dv = util_alloc_aligned(sizeof(vec3) * cap);
+    im->r = util_alloc_aligned(sizeof(vec3) * cap);
+    im->z = util_alloc_aligned(sizeof(vec3) * cap);
+    im->d = util_alloc_aligned(sizeof(vec3) * cap);
+    im->q = util_alloc_aligned(sizeof(vec3) * cap);
+    im->precond = util_alloc_aligned(sizeof(mat3) * cap);
+
+    memset(im->dv, 0, sizeof(vec3) * cap);
+
+    im->tol = 1e-4f;
+    im->max_iters = 100;
+    im->iters = 0;
+
+    return im;
+}
+
+
+void implicit_free(struct Implicit *im)
+{
+    free(im->rows);
+    free(im->cols);
+    free(im->blocks);
+    free(im->spring_blocks);
+
+    free(im->rhs);
+    free(im->dv);
+    free(im->r);
+    free(im->z);
+    free(im->d);
+    free(im->q);
+    free(im->precond);
+
+    free(im);
+}
+
+
+static void grow_blocks(struct Implicit *im, size_t need)
+{
+    if (need <= im->blocks_cap)
+        return;
+
+    while (im->blocks_cap < need)
+        im->blocks_cap = im->blocks_cap * 2 + 64;
+
+    mat3 *blocks = util_alloc_aligned(sizeof(mat3) * im->blocks_cap);
+    memcpy(blocks, im->blocks, sizeof(mat3) * im->nblocks);
+    free(im->blocks);
+
+    im->blocks = blocks;
+    im->cols = realloc(im->cols, sizeof(unsigned int) * im->blocks_cap);
+}
+
+
+void implicit_tear(struct Mesh *m, size_t first)
+{
+    struct Implicit *im = m->implicit;
+    struct Tear *t = m->tear;
+
+    // New masses come in id order, so their rows simply go on the end
+    for (size_t v = first; v < m->nmasses; ++v)
+    {
+        unsigned int *list = t->vs + t->vs_start[v];
+        unsigned int nsp = t->vs_end[v] - t->vs_start[v];
+
+        grow_blocks(im, im->nblocks + 1 + nsp);
+
+        im->rows[v] = im->nblocks;
+        im->cols[im->nblocks] = v;
+        ++im->nblocks;
+
+        for (unsigned int k = 0; k < nsp; ++k)
+        {
+            struct Spring *s = &m->springs[list[k]];
+            size_t *own = &im->spring_blocks[list[k] * 2 + (s->a != v)];
+            size_t *other = &im->spring_blocks[list[k] * 2 + (s->a == v)];
+
+            // Assembly never writes the slot left behind, it stays zero
+            glm_mat3_zero(im->blocks[*own]);
+
+            *own = im->nblocks;
+            im->cols[im->nblocks] = s->a == v ? s->b : s->a;
+            ++im->nblocks;
+
+            im->cols[*other] = v;
+        }
+
+        im->rows[v + 1] = im->nblocks;
+    }
+}
+
+
+// J = -df_a/dx_a = k (u u^T + c (I - u u^T)), with c clamped at zero so that
+// compressed springs keep the system positive definite
+static void spring_jacobian(struct Spring *s, vec3 diff, float dist, mat3 out)
+{
+    vec3 u;
+    glm_vec3_divs(diff, dist, u);
+
+    float c = 1.f - s->eq_len / dist;
+    if (c < 0.f) c = 0.f;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            out[i][j] = s->k * ((1.f - c) * u[i] * u[j] + (i == j ? c : 0.f));
+    }
+}
+
+
+static void assemble_job(void *arg, size_t begin, size_t end)
+{
+    struct AssembleJob *j = arg;
+    struct Mesh *m = j->m;
+    struct Implicit *im = m->implicit;
+
+    float h2 = j->dt * j->dt;
+
+    for (size_t i = j->first + begin; i < j->first + end; ++i)
+    {
+        struct Spring *s = &m->springs[i];
+
+        vec3 diff;
+        glm_vec3_sub(m->pos[s->a], m->pos[s->b], diff);
+        float dist = glm_vec3_norm(diff);
+
+        vec3 f;
+        glm_vec3_scale(diff, s->k * (s->eq_len - dist) / dist, f);
+
+        mat3 jac;
+        spring_jacobian(s, diff, dist, jac);
+
+        // Pinned masses are removed from the system, their rows become the
+        // identity and their couplings vanish
+        float fa = m->inv_mass[s->a] > 0.f;
+        float fb = m->inv_mass[s->b] > 0.f;
+
+        mat3 *aa = &im->blocks[im->rows[s->a]];
+        mat3 *bb = &im->blocks[im->rows[s->b]];
+        mat3 *ab = &im->blocks[im->spring_blocks[i * 2]];
+        mat3 *ba = &im->blocks[im->spring_blocks[i * 2 + 1]];
+
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                float v = h2 * jac[r][c];
+                (*aa)[r][c] += v * fa;
+                (*bb)[r][c] += v * fb;
+                (*ab)[r][c] = -v * fa * fb;
+                (*ba)[r][c] = -v * fa * fb;
+            }
+        }
+
+        // rhs = dt (f + dt df/dx v)
+        vec3 dvel, kv;
+        glm_vec3_sub(m->vel[s->a], m->vel[s->b], dvel);
+        glm_mat3_mulv(jac, dvel, kv);
+
+        vec3 g;
+        glm_vec3_muladds(kv, -j->dt, f);
+        glm_vec3_scale(f, j->dt, g);
+
+        glm_vec3_muladds(g, fa, im->rhs[s->a]);
+        glm_vec3_muladds(g, -fb, im->rhs[s->b]);
+    }
+}
+
+
+static void mul_job(void *arg, size_t begin, size_t end)
+{
+    struct MulJob *j = arg;
+    struct Implicit *im = j->im;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        vec3 sum = { 0.f, 0.f, 0.f };
+
+        for (size_t b = im->rows[i]; b < im->rows[i + 1]; ++b)
+        {
+            vec3 t;
+            glm_mat3_mulv(im->blocks[b], j->in[im->cols[b]], t);
+            glm_vec3_add(sum, t, sum);
+        }
+
+        glm_vec3_copy(sum, j->out[i]);
+    }
+}
+
+
+static void mul(struct Implicit *im, size_t n, vec3 *in, vec3 *out)
+{
+    struct MulJob j = { im, n, in, out };
+    pool_for(pool_global(), n, ROW_GRAIN, mul_job, &j);
+}
+
+
+static float dot(vec3 *a, vec3 *b, size_t n)
+{
+    float sum = 0.f;
+
+    for (size_t i = 0; i < n; ++i)
+        sum += glm_vec3_dot(a[i], b[i]);
+
+    return sum;
+}
+
+
+static void precondition(struct Implicit *im, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        glm_mat3_mulv(im->precond[i], im->r[i], im->z[i]);
+}
+
+
+static void solve(struct Implicit *im, size_t n)
+{
+    // Warm started from the previous step's dv
+    mul(im, n, im->dv, im->q);
+
+    for (size_t i = 0; i < n; ++i)
+        glm_vec3_sub(im->rhs[i], im->q[i], im->r[i]);
+
+    precondition(im, n);
+    memcpy(im->d, im->z, sizeof(vec3) * n);
+
+    float delta = dot(im->r, im->z, n);
+    float target = im->tol * im->tol * dot(im->rhs, im->rhs, n);
+
+    for (im->iters = 0; im->iters < im->max_iters; ++im->iters)
+    {
+        if (dot(im->r, im->r, n) <= target)
+            break;
+
+        mul(im, n, im->d, im->q);
+
+        float dq = dot(im->d, im->q, n);
+        if (dq <= 0.f)
+            break;
+
+        float alpha = delta / dq;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            glm_vec3_muladds(im->d[i], alpha, im->dv[i]);
+            glm_vec3_muladds(im->q[i], -alpha, im->r[i]);
+        }
+
+        precondition(im, n);
+
+        float next = dot(im->r, im->z, n);
+        float beta = next / delta;
+        delta = next;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            glm_vec3_scale(im->d[i], beta, im->d[i]);
+            glm_vec3_add(im->d[i], im->z[i], im->d[i]);
+        }
+    }
+}
+
+
+void implicit_step(struct Mesh *m, float dt)
+{
+    struct Implicit *im = m->implicit;
+    size_t n = m->nmasses;
+
+    memset(im->rhs, 0, sizeof(vec3) * n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        glm_mat3_identity(im->blocks[im->rows[i]]);
+
+        if (m->inv_mass[i] > 0.f)
+        {
+            glm_mat3_scale(im->blocks[im->rows[i]], 1.f / m->inv_mass[i]);
+            im->rhs[i][1] = GRAVITY / m->inv_mass[i] * dt;
+        }
+    }
+
+    // Springs of one color write disjoint rows
+    for (size_t c = 0; c < m->ncolors; ++c)
+    {
+        struct AssembleJob j = { m, m->colors[c], dt };
+        pool_for(pool_global(), m->colors[c + 1] - m->colors[c], SPRING_GRAIN, assemble_job, &j);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        glm_mat3_inv(im->blocks[im->rows[i]], im->precond[i]);
+
+    solve(im, n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        glm_vec3_add(m->vel[i], im->dv[i], m->vel[i]);
+        glm_vec3_muladds(m->vel[i], dt, m->pos[i]);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef IMPLICIT_H
+#define IMPLICIT_H
+
+#include <cglm/cglm.h>
+
+struct Mesh;
+
+// Backward Euler in the style of Baraff and Witkin, solving
+// (M - dt^2 df/dx) dv = dt (f + dt df/dx v) with block Jacobi
+// preconditioned conjugate gradients
+struct Implicit
+{
+    // Block sparse rows built once from the springs, the diagonal block of
+    // row i is blocks[rows[i]]. Tearing appends the rows of new masses and
+    // leaves zero blocks where springs moved away.
+    size_t *rows;
+    unsigned int *cols;
+    mat3 *blocks;
+    size_t nblocks, blocks_cap;
+
+    // Off-diagonal blocks (a, b) and (b, a) of each spring
+    size_t *spring_blocks;
+
+    vec3 *rhs, *dv, *r, *z, *d, *q;
+    mat3 *precond;
+
+    // Relative residual to stop at
+    float tol;
+    int max_iters;
+
+    // Iterations used by the last solve
+    int iters;
+};
+
+struct Implicit *implicit_alloc(struct Mesh *m);
+void implicit_free(struct Implicit *im);
+
+// Rows for the masses from first on that the last tear_step added
+void implicit_tear(struct Mesh *m, size_t first);
+
+void implicit_step(struct Mesh *m, float dt);
+
+#endif
@@ -0,0 +1,377 @@
+#include "integrator.h"
+#include "mesh.h"
+#include "util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void alloc_work(struct Mesh *m, size_t narrays)
+{
+    free(m->work);
+    m->work = util_alloc_aligned(sizeof(vec3) * m->mass_cap * narrays);
+    m->nwork = narrays;
+}
+
+
+static float cost_one(struct Mesh *m)
+{
+    return 1.f;
+}
+
+
+static float max_dt_explicit(struct Mesh *m)
+{
+    // Symplectic schemes are stable for dt w < 2
+    return 2.f / integrator_max_omega(m);
+}
+
+
+static float max_dt_unconditional(struct Mesh *m)
+{
+    return INFINITY;
+}
+
+
+static void euler_step(struct Mesh *m, float dt)
+{
+    bool accumulate = m->spring_mode == SPRING_ACCUMULATE;
+
+    if (accumulate)
+    {
+        memset(m->force, 0, sizeof(vec3) * m->nmasses);
+        mesh_spring_pass(m, m->pos, m->force, 0, 1.f);
+    }
+    else
+    {
+        mesh_spring_pass(m, m->pos, m->vel, m->inv_mass, dt);
+    }
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+    {
+        // Zero for pinned masses, which then never move
+        float unpinned = m->inv_mass[i] > 0.f;
+
+        if (accumulate)
+            mesh_apply_force(m, i, m->force[i], dt);
+
+        {
+            // gravity
+            m->vel[i][1] += GRAVITY * dt * unpinned;
+        }
+
+        glm_vec3_muladds(m->vel[i], dt, m->pos[i]);
+    }
+}
+
+
+// Work rows are the acceleration, the previous positions, and pos and vel
+// as the last step left them
+static void position_verlet_init(struct Mesh *m)
+{
+    alloc_work(m, 4);
+}
+
+
+static void position_verlet_step(struct Mesh *m, float dt)
+{
+    size_t n = m->nmasses;
+    size_t cap = m->mass_cap;
+
+    vec3 *accel = m->work;
+    vec3 *prev = m->work + cap;
+    vec3 *pos_out = m->work + cap * 2;
+    vec3 *vel_out = m->work + cap * 3;
+
+    float h = m->last_dt;
+
+    // First step since init, the history comes from vel
+    if (!(h > 0.f))
+    {
+        h = dt;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            glm_vec3_copy(m->pos[i], prev[i]);
+            glm_vec3_muladds(m->vel[i], -dt, prev[i]);
+        }
+
+        memcpy(pos_out, m->pos, sizeof(vec3) * n);
+        memcpy(vel_out, m->vel, sizeof(vec3) * n);
+    }
+
+    mesh_accel(m, m->pos, accel);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        float unpinned = m->inv_mass[i] > 0.f;
+
+        // Collisions, pins and tearing moved the mass without giving it
+        // velocity, drag and contacts changed its velocity in place
+        vec3 moved, kicked;
+        glm_vec3_sub(m->pos[i], pos_out[i], moved);
+        glm_vec3_sub(m->vel[i], vel_out[i], kicked);
+
+        glm_vec3_add(prev[i], moved, prev[i]);
+        glm_vec3_muladds(kicked, -h, prev[i]);
+
+        // x' = x + (x - x_prev) dt / h + a dt^2, the last displacement
+        // rescaled when the step size changes
+        vec3 step;
+        glm_vec3_sub(m->pos[i], prev[i], step);
+        glm_vec3_scale(step, dt / h * unpinned, step);
+        glm_vec3_muladds(accel[i], dt * dt, step);
+
+        glm_vec3_copy(m->pos[i], prev[i]);
+        glm_vec3_add(m->pos[i], step, m->pos[i]);
+
+        // Only written for the rest of the mesh, never read back as state
+        glm_vec3_divs(step, dt, m->vel[i]);
+
+        glm_vec3_copy(m->pos[i], pos_out[i]);
+        glm_vec3_copy(m->vel[i], vel_out[i]);
+    }
+}
+
+
+static void velocity_verlet_init(struct Mesh *m)
+{
+    alloc_work(m, 2);
+    mesh_accel(m, m->pos, m->work);
+}
+
+
+static void velocity_verlet_step(struct Mesh *m, float dt)
+{
+    vec3 *accel = m->work;
+    vec3 *next = m->work + m->mass_cap;
+
+    // Pins, springs or masses changed under the acceleration of the last step
+    if (m->forces_changed)
+    {
+        mesh_accel(m, m->pos, accel);
+        m->forces_changed = false;
+    }
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+    {
+        float unpinned = m->inv_mass[i] > 0.f;
+
+        // x' = x + v dt + a dt^2 / 2
+        glm_vec3_muladds(m->vel[i], dt * unpinned, m->pos[i]);
+        glm_vec3_muladds(accel[i], .5f * dt * dt, m->pos[i]);
+    }
+
+    mesh_accel(m, m->pos, next);
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+    {
+        // v' = v + (a + a') dt / 2
+        glm_vec3_add(accel[i], next[i], accel[i]);
+        glm_vec3_muladds(accel[i], .5f * dt, m->vel[i]);
+
+        glm_vec3_copy(next[i], accel[i]);
+    }
+}
+
+
+static void rk4_init(struct Mesh *m)
+{
+    alloc_work(m, 5);
+}
+
+
+static float rk4_cost(struct Mesh *m)
+{
+    return 4.f;
+}
+
+
+static float rk4_max_dt(struct Mesh *m)
+{
+    // RK4 reaches 2 sqrt(2) along the imaginary axis
+    return 2.f * sqrtf(2.f) / integrator_max_omega(m);
+}
+
+
+static void rk4_step(struct Mesh *m, float dt)
+{
+    size_t n = m->nmasses;
+    size_t cap = m->mass_cap;
+
+    vec3 *xs = m->work;
+    vec3 *vs = m->work + cap;
+    vec3 *accel = m->work + cap * 2;
+    vec3 *sx = m->work + cap * 3;
+    vec3 *sv = m->work + cap * 4;
+
+    // k1
+    mesh_accel(m, m->pos, accel);
+
+    memcpy(sx, m->vel, sizeof(vec3) * n);
+    memcpy(sv, accel, sizeof(vec3) * n);
+    memcpy(vs, m->vel, sizeof(vec3) * n);
+
+    // k2 and k3 sample the midpoint, k4 the end of the step
+    static const float at[] = { .5f, .5f, 1.f };
+    static const float weight[] = { 2.f, 2.f, 1.f };
+
+    for (int k = 0; k < 3; ++k)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            glm_vec3_copy(m->pos[i], xs[i]);
+            glm_vec3_muladds(vs[i], dt * at[k], xs[i]);
+
+            glm_vec3_copy(m->vel[i], vs[i]);
+            glm_vec3_muladds(accel[i], dt * at[k], vs[i]);
+        }
+
+        mesh_accel(m, xs, accel);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            glm_vec3_muladds(vs[i], weight[k], sx[i]);
+            glm_vec3_muladds(accel[i], weight[k], sv[i]);
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        float unpinned = m->inv_mass[i] > 0.f;
+
+        glm_vec3_muladds(sx[i], dt / 6.f * unpinned, m->pos[i]);
+        glm_vec3_muladds(sv[i], dt / 6.f, m->vel[i]);
+    }
+}
+
+
+static void implicit_init(struct Mesh *m)
+{
+    if (!m->implicit)
+        m->implicit = implicit_alloc(m);
+}
+
+
+static float implicit_cost(struct Mesh *m)
+{
+    // Assembly plus one matrix product per CG iteration
+    return 2.f + (m->implicit && m->implicit->iters ? m->implicit->iters : 30);
+}
+
+
+static void xpbd_init(struct Mesh *m)
+{
+    if (!m->xpbd)
+        m->xpbd = xpbd_alloc(m);
+}
+
+
+static float xpbd_cost(struct Mesh *m)
+{
+    return m->xpbd ? m->xpbd->substeps * m->xpbd->iters : 10.f;
+}
+
+
+static void pd_init(struct Mesh *m)
+{
+    if (!m->pd)
+        m->pd = pd_alloc(m);
+}
+
+
+static float pd_cost(struct Mesh *m)
+{
+    // A local step and a back-substitution per iteration
+    return (m->pd ? m->pd->iters : 10) * 2.f;
+}
+
+
+const struct Integrator integrator_symplectic_euler = {
+    "symplectic euler", 0, euler_step, cost_one, max_dt_explicit
+};
+
+const struct Integrator integrator_position_verlet = {
+    "position verlet", position_verlet_init, position_verlet_step, cost_one, max_dt_explicit
+};
+
+const struct Integrator integrator_velocity_verlet = {
+    "velocity verlet", velocity_verlet_init, velocity_verlet_step, cost_one, max_dt_explicit
+};
+
+const struct Integrator integrator_rk4 = {
+    "rk4", rk4_init, rk4_step, rk4_cost, rk4_max_dt
+};
+
+const struct Integrator integrator_implicit = {
+    "implicit", implicit_init, implicit_step, implicit_cost, max_dt_unconditional
+};
+
+const struct Integrator integrator_xpbd = {
+    "xpbd", xpbd_init, xpbd_step, xpbd_cost, max_dt_unconditional
+};
+
+const struct Integrator integrator_pd = {
+    "pd", pd_init, pd_step, pd_cost, max_dt_unconditional
+};
+
+const struct Integrator *integrators[] = {
+    &integrator_symplectic_euler,
+    &integrator_position_verlet,
+    &integrator_velocity_verlet,
+    &integrator_rk4,
+    &integrator_implicit,
+    &integrator_xpbd,
+    &integrator_pd
+};
+
+const size_t nintegrators = sizeof(integrators) / sizeof(integrators[0]);
+
+
+const struct Integrator *integrator_cheapest(struct Mesh *m, float dt, int *substeps)
+{
+    const struct Integrator *best = 0;
+    float best_cost = INFINITY;
+
+    for (size_t i = 0; i < nintegrators; ++i)
+    {
+        float steps = ceilf(dt / integrators[i]->max_dt(m));
+        if (steps < 1.f) steps = 1.f;
+
+        float cost = integrators[i]->cost(m) * steps;
+
+        if (cost < best_cost)
+        {
+            best = integrators[i];
+            best_cost = cost;
+
+            if (substeps)
+                *substeps = (int)steps;
+        }
+    }
+
+    return best;
+}
+
+
+float integrator_max_omega(struct Mesh *m)
+{
+    float *ksum = m->ksum;
+    memset(ksum, 0, sizeof(float) * m->nmasses);
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        ksum[m->springs[i].a] += m->springs[i].k;
+        ksum[m->springs[i].b] += m->springs[i].k;
+    }
+
+    float max = 0.f;
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+    {
+        float w2 = 2.f * ksum[i] * m->inv_mass[i];
+        if (w2 > max) max = w2;
+    }
+
+    return sqrtf(max);
+}
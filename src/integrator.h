@@ -0,0 +1,46 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <stddef.h>
+
+struct Mesh;
+
+struct Integrator
+{
+    const char *name;
+
+    // Allocates integrator state on the mesh, may be null
+    void (*init)(struct Mesh *m);
+    void (*step)(struct Mesh *m, float dt);
+
+    // Cost of one step in spring passes
+    float (*cost)(struct Mesh *m);
+    // Largest stable dt for the mesh's current stiffness and masses,
+    // INFINITY for unconditionally stable schemes
+    float (*max_dt)(struct Mesh *m);
+};
+
+// Semi-implicit Euler honoring Mesh::spring_mode
+extern const struct Integrator integrator_symplectic_euler;
+// Stormer-Verlet on the previous positions. vel is written for the rest
+// of the mesh, and what other code does to pos and vel between steps is
+// folded back into the previous positions.
+extern const struct Integrator integrator_position_verlet;
+extern const struct Integrator integrator_velocity_verlet;
+extern const struct Integrator integrator_rk4;
+extern const struct Integrator integrator_implicit;
+extern const struct Integrator integrator_xpbd;
+extern const struct Integrator integrator_pd;
+
+extern const struct Integrator *integrators[];
+extern const size_t nintegrators;
+
+// Integrator with the lowest cost for advancing dt, counting the substeps
+// each one would need to stay stable
+const struct Integrator *integrator_cheapest(struct Mesh *m, float dt, int *substeps);
+
+// Upper bound on the highest spring frequency, from the Gershgorin bound
+// on M^-1 K
+float integrator_max_omega(struct Mesh *m);
+
+#endif
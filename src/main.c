@@ -1,4 +1,5 @@
 #include "prog.h"
+#include "simd.h"
 
 
 int main()
@@ -16,6 +17,8 @@ int main()
 
     glViewport(0, 0, 800, 600);
 
+    simd_init();
+
     struct Prog *p = prog_alloc(win);
     prog_mainloop(p);
     prog_free(p);
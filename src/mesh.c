@@ -1,52 +1,142 @@
 #include "mesh.h"
+#include "integrator.h"
+#include "model.h"
+#include "normals.h"
+#include "pool.h"
 #include "shader.h"
+#include "simd.h"
+#include "tear.h"
+#include "topology.h"
+#include "util.h"
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <glad/glad.h>
+#include <stb/stb_image.h>
 
-void mass_apply_force(struct Mass *m, vec3 f, float dt)
+#define SPRING_GRAIN 4096
+// Stiffness of structural and shear springs
+#define SPRING_K 1500.f
+
+struct SpringJob
 {
-    // dp = Ft
-    vec3 dp;
-    glm_vec3_scale(f, dt, dp);
+    struct Spring *springs;
+    vec3 *pos;
 
-    // v += dp / m
-    vec3 dv;
-    glm_vec3_divs(dp, m->mass, dv);
-    glm_vec3_add(m->vel, dv, m->vel);
-}
+    vec3 *out;
+    float *inv_mass;
+    float scale;
+};
 
-void spring_force(struct Spring *s, struct Mass *m, vec3 out)
+static void spring_job(void *arg, size_t begin, size_t end)
 {
-    struct Mass *m2 = (m == s->ma ? s->mb : s->ma);
+    struct SpringJob *j = arg;
+    simd.springs(j->springs + begin, end - begin, j->pos, j->inv_mass, j->out, j->scale);
+}
 
-    float dist = glm_vec3_distance(m->vert->pos, m2->vert->pos);
-    float left = s->k * (s->eq_len - dist);
+void mesh_apply_force(struct Mesh *m, size_t i, vec3 f, float dt)
+{
+    // dv = Ft / m
+    glm_vec3_muladds(f, dt * m->inv_mass[i], m->vel[i]);
+}
 
+void spring_force(struct Mesh *m, struct Spring *s, vec3 out)
+{
     vec3 diff;
-    glm_vec3_sub(m->vert->pos, m2->vert->pos, diff);
-    glm_vec3_divs(diff, dist, diff);
+    glm_vec3_sub(m->pos[s->a], m->pos[s->b], diff);
+
+    float dist = glm_vec3_norm(diff);
+    float left = s->k * (s->eq_len - dist);
 
-    glm_vec3_scale(diff, left, out);
+    glm_vec3_scale(diff, left / dist, out);
 }
 
-struct Mesh *mesh_alloc(int size, float res)
+// Defaults shared by every way of making a mesh, without any state
+static struct Mesh *mesh_new(int size, float res)
 {
     struct Mesh *m = malloc(sizeof(struct Mesh));
     m->size = size;
     m->res = res;
-
+    m->grid = true;
+    m->mask_remap = 0;
+
+    m->pos = 0;
+    m->vel = 0;
+    m->inv_mass = 0;
+    m->force = 0;
+    m->ksum = 0;
+    m->nmasses = 0;
+    m->mass = .5f;
+    m->pins = 0;
+    m->npins = 0;
+    m->time = 0.f;
+    m->fnorm_time = -1.f;
+    m->norm = 0;
+    m->fnorm = 0;
+    m->vtri_start = 0;
+    m->vtri_end = 0;
+    m->vtri = 0;
+    m->prev_pos = 0;
+    m->draw_pos = 0;
     m->verts = 0;
     m->nverts = 0;
     m->indices = 0;
     m->nindices = 0;
-    m->masses = 0;
-    m->nmasses = 0;
     m->springs = 0;
     m->nsprings = 0;
+    m->colors = 0;
+    m->ncolors = 0;
+    m->spring_mode = SPRING_IMMEDIATE;
+    m->implicit = 0;
+    m->xpbd = 0;
+    m->pd = 0;
+    m->work = 0;
+    m->nwork = 0;
+    m->self_collide = 0;
+    m->colliders = 0;
+    m->ncolliders = 0;
+    m->skin = .05f * res;
+    m->cfl = .9f;
+    m->max_strain_step = .05f;
+    m->max_substeps = 64;
+    m->substeps = 0;
+    m->wanted_substeps = 0;
+    m->normal_mode = NORMALS_CPU;
+    m->pos_buf = 0;
+    m->pos_tex = 0;
+    m->tear = 0;
+    m->torn_from = 0;
+    aero_init(&m->aero);
 
-    mesh_construct(m);
-    mesh_gen_springs(m);
+    return m;
+}
+
+
+// Per mass arrays for n masses
+static void mesh_alloc_state(struct Mesh *m, size_t n)
+{
+    m->pos = util_alloc_aligned(sizeof(vec3) * n);
+    m->vel = util_alloc_aligned(sizeof(vec3) * n);
+    m->inv_mass = util_alloc_aligned(sizeof(float) * n);
+    m->force = util_alloc_aligned(sizeof(vec3) * n);
+    m->ksum = util_alloc_aligned(sizeof(float) * n);
+    m->norm = util_alloc_aligned(sizeof(vec3) * n);
+    m->prev_pos = util_alloc_aligned(sizeof(vec3) * n);
+    m->draw_pos = util_alloc_aligned(sizeof(vec3) * n);
+    m->verts = malloc(sizeof(Vertex) * n);
+    m->mass_cap = n;
+}
+
+
+// Integrator and GL buffers, once masses, springs and indices exist
+static void mesh_finish(struct Mesh *m)
+{
+    mesh_set_integrator(m, &integrator_symplectic_euler);
+    mesh_calculate_normals(m, m->pos);
+    mesh_pack_verts(m, m->pos, m->verts);
 
     glGenVertexArrays(1, &m->vao);
     glBindVertexArray(m->vao);
@@ -70,6 +160,177 @@ struct Mesh *mesh_alloc(int size, float res)
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+
+struct Mesh *mesh_alloc(int size, float res)
+{
+    struct Mesh *m = mesh_new(size, res);
+
+    mesh_construct(m);
+    mesh_gen_springs(m);
+    mesh_finish(m);
+
+    return m;
+}
+
+
+// Whether triangle t (0 or 1, see normals.h) of quad (y, z) exists
+static bool grid_tri(struct Mesh *m, int t, int y, int z)
+{
+    if (y < 0 || z < 0 || y >= m->size - 1 || z >= m->size - 1)
+        return false;
+
+    if (!m->mask_remap)
+        return true;
+
+    size_t c = t == 0 ? mesh_grid_mass(m, y + 1, z) : mesh_grid_mass(m, y, z + 1);
+
+    return mesh_grid_mass(m, y, z) != MESH_NO_MASS &&
+           mesh_grid_mass(m, y + 1, z + 1) != MESH_NO_MASS && c != MESH_NO_MASS;
+}
+
+
+struct Mesh *mesh_alloc_mask(const char *path, float res)
+{
+    int w, h, nchannels;
+    unsigned char *data = stbi_load(path, &w, &h, &nchannels, 0);
+
+    if (!data)
+    {
+        fprintf(stderr, "[mesh_alloc_mask] Failed to load file '%s'.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    // Alpha if the image has it, otherwise brightness
+    int channel = nchannels == 2 || nchannels == 4 ? nchannels - 1 : 0;
+
+    // Padded to a square, the padding is simply left out
+    int size = w > h ? w : h;
+    struct Mesh *m = mesh_new(size, res);
+    m->grid = false;
+
+    size_t n = (size_t)size * size;
+    m->mask_remap = malloc(sizeof(unsigned int) * n);
+
+    for (int y = 0; y < size; ++y)
+    {
+        for (int z = 0; z < size; ++z)
+        {
+            bool set = y < h && z < w && data[((size_t)y * w + z) * nchannels + channel] >= 128;
+            m->mask_remap[(size_t)y * size + z] = set ? 0 : MESH_NO_MASS;
+        }
+    }
+
+    stbi_image_free(data);
+
+    // Only pixels that are the corner of some triangle get a mass, in grid
+    // order so that rows stay contiguous
+    unsigned int *keep = calloc(n, sizeof(unsigned int));
+
+    for (int y = 0; y < size - 1; ++y)
+    {
+        for (int z = 0; z < size - 1; ++z)
+        {
+            for (int t = 0; t < 2; ++t)
+            {
+                if (!grid_tri(m, t, y, z))
+                    continue;
+
+                size_t i = (size_t)y * size + z;
+                keep[i] = keep[i + size + 1] = 1;
+                keep[t == 0 ? i + size : i + 1] = 1;
+            }
+        }
+    }
+
+    unsigned int count = 0;
+
+    for (size_t i = 0; i < n; ++i)
+        m->mask_remap[i] = keep[i] ? count++ : MESH_NO_MASS;
+
+    free(keep);
+
+    if (!count)
+    {
+        fprintf(stderr, "[mesh_alloc_mask] Mask '%s' has no cloth in it.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    mesh_construct(m);
+    mesh_gen_springs(m);
+    mesh_finish(m);
+
+    return m;
+}
+
+
+struct Mesh *mesh_load(const char *path)
+{
+    struct Model *model = model_load(path);
+
+    unsigned int *remap = malloc(sizeof(unsigned int) * (model->nverts + 1));
+    size_t n = topology_weld(model->verts, model->nverts, remap);
+
+    struct Mesh *m = mesh_new(0, 1.f);
+    m->grid = false;
+
+    mesh_alloc_state(m, n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        glm_vec3_copy(model->verts[i], m->pos[i]);
+        glm_vec3_zero(m->vel[i]);
+        glm_vec3_copy((vec3){ 0.f, 1.f, 0.f }, m->norm[i]);
+        m->inv_mass[i] = 1.f / m->mass;
+    }
+
+    m->nmasses = n;
+    m->nverts = n;
+
+    // Triangles that welding collapsed are dropped
+    m->indices = malloc(sizeof(unsigned int) * (model->nindices + 1));
+
+    for (size_t i = 0; i < model->nindices; i += 3)
+    {
+        unsigned int a = remap[model->indices[i]];
+        unsigned int b = remap[model->indices[i + 1]];
+        unsigned int c = remap[model->indices[i + 2]];
+
+        if (a == b || b == c || c == a)
+            continue;
+
+        m->indices[m->nindices++] = a;
+        m->indices[m->nindices++] = b;
+        m->indices[m->nindices++] = c;
+    }
+
+    free(remap);
+    model_free(model);
+
+    mesh_snapshot(m);
+
+    topology_springs(m, SPRING_K);
+    topology_color(m);
+
+    // Stands in for the grid spacing wherever it sets a scale
+    float total = 0.f;
+    size_t nedges = 0;
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        if (m->springs[i].k == SPRING_K)
+        {
+            total += m->springs[i].eq_len;
+            ++nedges;
+        }
+    }
+
+    m->res = nedges ? total / nedges : 1.f;
+    m->skin = .05f * m->res;
+
+    normals_alloc(m);
+    mesh_finish(m);
 
     return m;
 }
@@ -77,91 +338,486 @@ struct Mesh *mesh_alloc(int size, float res)
 
 void mesh_free(struct Mesh *m)
 {
+    free(m->pos);
+    free(m->vel);
+    free(m->inv_mass);
+    free(m->force);
+    free(m->ksum);
+    free(m->norm);
+    free(m->fnorm);
+    free(m->vtri_start);
+    free(m->vtri_end);
+    free(m->vtri);
+    free(m->mask_remap);
+    free(m->prev_pos);
+    free(m->draw_pos);
     free(m->verts);
     free(m->indices);
-    free(m->masses);
     free(m->springs);
+    free(m->colors);
+    free(m->pins);
+
+    if (m->implicit)
+        implicit_free(m->implicit);
+
+    if (m->xpbd)
+        xpbd_free(m->xpbd);
+
+    if (m->pd)
+        pd_free(m->pd);
+
+    free(m->work);
+
+    if (m->self_collide)
+        selfcollide_free(m->self_collide);
+
+    if (m->tear)
+        tear_free(m->tear);
+
+    free(m->torn_from);
+    aero_free(&m->aero);
+
+    for (size_t i = 0; i < m->ncolliders; ++i)
+        collider_free(&m->colliders[i]);
+
+    free(m->colliders);
 
     glDeleteVertexArrays(1, &m->vao);
     glDeleteBuffers(1, &m->vb);
 
+    if (m->pos_tex)
+    {
+        glDeleteTextures(1, &m->pos_tex);
+        glDeleteBuffers(1, &m->pos_buf);
+    }
+
     free(m);
 }
 
 
-void mesh_update(struct Mesh *m, float dt, size_t *held, size_t nheld)
+void mesh_set_integrator(struct Mesh *m, const struct Integrator *integrator)
+{
+    m->integrator = integrator;
+    m->last_dt = 0.f;
+    m->forces_changed = false;
+
+    if (integrator->init)
+        integrator->init(m);
+}
+
+
+void mesh_add_collider(struct Mesh *m, struct Collider c)
+{
+    m->colliders = realloc(m->colliders, sizeof(struct Collider) * ++m->ncolliders);
+    m->colliders[m->ncolliders - 1] = c;
+}
+
+
+void mesh_set_self_collision(struct Mesh *m, float thickness)
+{
+    if (m->self_collide)
+    {
+        selfcollide_free(m->self_collide);
+        m->self_collide = 0;
+    }
+
+    if (thickness > 0.f)
+        m->self_collide = selfcollide_alloc(m, thickness);
+}
+
+
+// Moves n entries of size bytes to an aligned array of cap entries
+static void *grow_aligned(void *p, size_t n, size_t cap, size_t size)
+{
+    void *out = util_alloc_aligned(size * cap);
+    memcpy(out, p, size * n);
+    free(p);
+
+    return out;
+}
+
+
+void mesh_set_tearing(struct Mesh *m, float strain, size_t max_masses)
 {
+    if (m->tear)
+    {
+        m->tear->strain = strain;
+        return;
+    }
+
+    if (max_masses < m->nmasses)
+        max_masses = m->nmasses;
+
+    size_t n = m->nmasses;
+
+    m->pos = grow_aligned(m->pos, n, max_masses, sizeof(vec3));
+    m->vel = grow_aligned(m->vel, n, max_masses, sizeof(vec3));
+    m->inv_mass = grow_aligned(m->inv_mass, n, max_masses, sizeof(float));
+    m->force = grow_aligned(m->force, n, max_masses, sizeof(vec3));
+    m->ksum = grow_aligned(m->ksum, n, max_masses, sizeof(float));
+    m->norm = grow_aligned(m->norm, n, max_masses, sizeof(vec3));
+    m->prev_pos = grow_aligned(m->prev_pos, n, max_masses, sizeof(vec3));
+    m->draw_pos = grow_aligned(m->draw_pos, n, max_masses, sizeof(vec3));
+    m->verts = realloc(m->verts, sizeof(Vertex) * max_masses);
+    m->mass_cap = max_masses;
+
+    // Torn grids are no longer grids, and the GPU shader only knows grids
+    if (m->grid)
+    {
+        m->grid = false;
+        free(m->fnorm);
+        normals_alloc(m);
+    }
+
+    m->normal_mode = NORMALS_CPU;
+    m->fnorm_time = -1.f;
+
+    m->torn_from = malloc(sizeof(unsigned int) * m->mass_cap);
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+        m->torn_from[i] = i;
+
+    m->tear = tear_alloc(m, strain);
+
+    // Built once more with room for every mass, tearing then patches them
+    if (m->implicit)
+    {
+        implicit_free(m->implicit);
+        m->implicit = 0;
+    }
+
+    if (m->xpbd)
+    {
+        xpbd_free(m->xpbd);
+        m->xpbd = 0;
+    }
+
+    if (m->pd)
+    {
+        pd_free(m->pd);
+        m->pd = 0;
+    }
+
+    free(m->work);
+    m->work = 0;
+    m->nwork = 0;
+
+    mesh_set_integrator(m, m->integrator);
+
+    if (m->self_collide)
+        mesh_set_self_collision(m, m->self_collide->thickness);
+
+    // Room for every vertex there may ever be
+    glBindBuffer(GL_ARRAY_BUFFER, m->vb);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * m->mass_cap, 0, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Vertex) * m->nverts, m->verts);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+// Integrators and self collision keep state built from the topology, the
+// masses from first on are new. Colors hold as they are, springs only ever
+// move to a mass no other spring of their color touches. PD picks up moved
+// and broken springs by itself.
+static void mesh_topology_changed(struct Mesh *m, size_t first)
+{
+    m->forces_changed = true;
+
+    if (m->implicit)
+        implicit_tear(m, first);
+
+    if (m->self_collide)
+        selfcollide_tear(m);
+}
+
+
+void mesh_set_normal_mode(struct Mesh *m, enum NormalMode mode)
+{
+    // The shader rebuilds normals from grid neighbours
+    if (!m->grid)
+        return;
+
+    m->normal_mode = mode;
+
+    if (mode != NORMALS_GPU || m->pos_tex)
+        return;
+
+    glGenBuffers(1, &m->pos_buf);
+    glBindBuffer(GL_TEXTURE_BUFFER, m->pos_buf);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(vec3) * m->nmasses, m->pos, GL_STREAM_DRAW);
+
+    glGenTextures(1, &m->pos_tex);
+    glBindTexture(GL_TEXTURE_BUFFER, m->pos_tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, m->pos_buf);
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+
+void mesh_spring_pass(struct Mesh *m, vec3 *pos, vec3 *out, float *inv_mass, float scale)
+{
+    // Springs within a color touch disjoint masses, so each color can be
+    // split across threads without synchronizing the writes
+    for (size_t c = 0; c < m->ncolors; ++c)
+    {
+        struct SpringJob j = { m->springs + m->colors[c], pos, out, inv_mass, scale };
+        pool_for(pool_global(), m->colors[c + 1] - m->colors[c], SPRING_GRAIN, spring_job, &j);
+    }
+}
+
+
+void mesh_accel(struct Mesh *m, vec3 *pos, vec3 *out)
+{
+    memset(out, 0, sizeof(vec3) * m->nmasses);
+    mesh_spring_pass(m, pos, out, m->inv_mass, 1.f);
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+        out[i][1] += GRAVITY * (m->inv_mass[i] > 0.f);
+}
+
+
+void mesh_update(struct Mesh *m, float dt)
+{
+    m->integrator->step(m, dt);
+    m->last_dt = dt;
+    aero_step(m, dt);
+
+    size_t first = m->nmasses;
+
+    if (m->tear && tear_step(m))
+        mesh_topology_changed(m, first);
+
+    if (m->self_collide)
+        selfcollide_step(m, dt);
+
+    mesh_collide(m);
+
+    m->time += dt;
+    mesh_update_pins(m, dt);
+
+    // One face pass per step, shared by aero in the next step and by
+    // frames packed in between
+    if (aero_active(&m->aero))
+    {
+        normals_faces(m, m->pos);
+        m->fnorm_time = m->time;
+    }
+}
+
+
+float mesh_max_strain_rate(struct Mesh *m)
+{
+    float max = 0.f;
+
     for (size_t i = 0; i < m->nsprings; ++i)
     {
         struct Spring *s = &m->springs[i];
 
-        vec3 fa, fb;
-        spring_force(s, s->ma, fa);
-        spring_force(s, s->mb, fb);
+        // Broken by tearing, its ends fly apart freely
+        if (s->k == 0.f)
+            continue;
+
+        vec3 diff, dvel;
+        glm_vec3_sub(m->pos[s->a], m->pos[s->b], diff);
+        glm_vec3_sub(m->vel[s->a], m->vel[s->b], dvel);
 
-        mass_apply_force(s->ma, fa, dt);
-        mass_apply_force(s->mb, fb, dt);
+        // d|x_a - x_b| / dt relative to the rest length
+        float rate = fabsf(glm_vec3_dot(diff, dvel)) / (glm_vec3_norm(diff) * s->eq_len);
+        if (rate > max) max = rate;
     }
 
+    return max;
+}
+
+
+void mesh_bounds(struct Mesh *m, vec3 lo, vec3 hi)
+{
+    float lx = FLT_MAX, ly = FLT_MAX, lz = FLT_MAX;
+    float hx = -FLT_MAX, hy = -FLT_MAX, hz = -FLT_MAX;
+
+    #pragma omp simd reduction(min:lx, ly, lz) reduction(max:hx, hy, hz)
     for (size_t i = 0; i < m->nmasses; ++i)
     {
-        /* if (i == m->size * m->size - 1 || i == m->size * m->size - m->size) */
-        bool cont = false;
-        for (size_t j = 0; j < nheld; ++j)
-        {
-            if (i == held[j])
-                cont = true;
-        }
+        float x = m->pos[i][0], y = m->pos[i][1], z = m->pos[i][2];
+
+        lx = x < lx ? x : lx;
+        ly = y < ly ? y : ly;
+        lz = z < lz ? z : lz;
+        hx = x > hx ? x : hx;
+        hy = y > hy ? y : hy;
+        hz = z > hz ? z : hz;
+    }
 
-        if (cont) continue;
-        /* if (i == 35 || i == 1022) */
-        /*     continue; */
+    glm_vec3_copy((vec3){ lx, ly, lz }, lo);
+    glm_vec3_copy((vec3){ hx, hy, hz }, hi);
+}
 
-        {
-            // gravity
-            vec3 fg = { 0.f, 10.f * -9.8f * m->masses[i].mass, 0.f };
-            mass_apply_force(&m->masses[i], fg, dt);
-        }
 
-        {
-            // air resistance
-            vec3 drag;
+void mesh_transform(struct Mesh *m, mat4 t)
+{
+    mat3 rot;
+    glm_mat4_pick3(t, rot);
 
-            vec3 vsq;
+    for (size_t i = 0; i < m->nmasses; ++i)
+    {
+        glm_mat4_mulv3(t, m->pos[i], 1.f, m->pos[i]);
+        glm_mat3_mulv(rot, m->vel[i], m->vel[i]);
+    }
 
-            // Preserve sign in vsq
-            vec3 sign;
-            glm_vec3_sign(m->masses[i].vel, sign);
+    m->forces_changed = true;
+    m->fnorm_time = -1.f;
 
-            glm_vec3_mul(m->masses[i].vel, m->masses[i].vel, vsq);
-            glm_vec3_mul(vsq, sign, vsq);
+    for (size_t i = 0; i < m->npins; ++i)
+        glm_mat4_mulv3(t, m->pins[i].origin, 1.f, m->pins[i].origin);
 
-            glm_vec3_copy(m->masses[i].vel, vsq);
+    mesh_snapshot(m);
+}
 
-            glm_vec3_scale(vsq, .01f, drag);
-            glm_vec3_sub(m->masses[i].vel, drag, m->masses[i].vel);
-        }
 
-        vec3 move;
-        glm_vec3_scale(m->masses[i].vel, dt, move);
-        glm_vec3_add(m->masses[i].vert->pos, move, m->masses[i].vert->pos);
+void mesh_step(struct Mesh *m, float dt)
+{
+    // Stiffness bound from k / mass, and a CFL-style bound that keeps every
+    // spring's strain from changing by more than max_strain_step per substep
+    float limit = m->integrator->max_dt(m) * m->cfl;
+
+    float rate = mesh_max_strain_rate(m);
+    if (rate > 0.f && m->max_strain_step / rate < limit)
+        limit = m->max_strain_step / rate;
+
+    // Kept as a float until clamped, limit can be tiny enough to overflow
+    float want = ceilf(dt / limit);
+    if (!(want >= 1.f)) want = 1.f;
+    m->wanted_substeps = want < INT_MAX ? (int)want : INT_MAX;
+
+    int n = m->wanted_substeps;
+    if (n > m->max_substeps) n = m->max_substeps;
+
+    m->substeps = n;
+
+    for (int i = 0; i < n; ++i)
+        mesh_update(m, dt / n);
+}
+
+
+void mesh_snapshot(struct Mesh *m)
+{
+    memcpy(m->prev_pos, m->pos, sizeof(vec3) * m->nmasses);
+}
+
+
+// Start of every frame, followed by the vertices
+struct FrameHeader
+{
+    uint64_t serial;
+    uint64_t nverts;
+};
+
+
+size_t mesh_frame_size(struct Mesh *m)
+{
+    size_t size = sizeof(Vertex) * m->mass_cap;
+
+    if (m->normal_mode == NORMALS_GPU)
+        size = sizeof(vec3) * m->mass_cap;
+
+    // Frames of a scene are packed back to back, keep the next header aligned
+    size = (size + 15) & ~(size_t)15;
+
+    return sizeof(struct FrameHeader) + size;
+}
+
+
+void mesh_pack(struct Mesh *m, float alpha, void *out)
+{
+    struct FrameHeader *hdr = out;
+    hdr->serial = m->tear ? tear_flush(m->tear) : 0;
+    hdr->nverts = m->nverts;
+
+    out = hdr + 1;
+
+    vec3 *pos = m->pos;
+
+    if (alpha < 1.f)
+    {
+        for (size_t i = 0; i < m->nmasses; ++i)
+            glm_vec3_lerp(m->prev_pos[i], m->pos[i], alpha, m->draw_pos[i]);
+
+        pos = m->draw_pos;
+    }
+
+    if (m->normal_mode == NORMALS_GPU)
+    {
+        memcpy(out, pos, sizeof(vec3) * m->nverts);
+        return;
     }
 
-    mesh_calculate_normals(m);
+    // Faces of the last step are reused while aero keeps them current. The
+    // drawn positions are blended towards the step before, so normals then
+    // lag them by less than a step.
+    if (m->fnorm_time != m->time)
+        normals_faces(m, pos);
 
-    glBindBuffer(GL_ARRAY_BUFFER, m->vb);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, m->nverts * sizeof(Vertex), m->verts);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    normals_verts(m);
+    mesh_pack_verts(m, pos, out);
+}
+
+
+void mesh_upload_frame(struct Mesh *m, const void *frame)
+{
+    const struct FrameHeader *hdr = frame;
+
+    // Index patches from tearing that this frame has the vertices for
+    if (m->tear)
+    {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ib);
+        tear_apply(m->tear, hdr->serial);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    unsigned int target = GL_ARRAY_BUFFER, buf = m->vb;
+    size_t size = sizeof(Vertex) * hdr->nverts;
+
+    if (m->normal_mode == NORMALS_GPU)
+    {
+        target = GL_TEXTURE_BUFFER;
+        buf = m->pos_buf;
+        size = sizeof(vec3) * hdr->nverts;
+    }
+
+    glBindBuffer(target, buf);
+    glBufferSubData(target, 0, size, hdr + 1);
+    glBindBuffer(target, 0);
+}
+
+
+void mesh_upload(struct Mesh *m, float alpha)
+{
+    void *frame = malloc(mesh_frame_size(m));
+    mesh_pack(m, alpha, frame);
+    mesh_upload_frame(m, frame);
+    free(frame);
 }
 
 
 void mesh_render(struct Mesh *m, RenderInfo *ri)
 {
+    ri_use_shader(ri, m->normal_mode == NORMALS_GPU ? SHADER_GPU_NORM : SHADER_BASIC);
+
     mat4 model;
     glm_mat4_identity(model);
 
     shader_mat4(ri->shader, "model", model);
 
+    if (m->normal_mode == NORMALS_GPU)
+    {
+        // Vertices are fetched by gl_VertexID, the attributes go unused
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, m->pos_tex);
+        shader_int(ri->shader, "positions", 0);
+        shader_int(ri->shader, "size", m->size);
+    }
+
     glBindVertexArray(m->vao);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ib);
     glDrawElements(GL_TRIANGLES, m->nindices, GL_UNSIGNED_INT, 0);
@@ -169,101 +825,91 @@ void mesh_render(struct Mesh *m, RenderInfo *ri)
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-static bool in_range(struct Mesh *m, size_t a, size_t b)
+void mesh_calculate_normals(struct Mesh *m, vec3 *pos)
 {
-    return a >= 0 && a < m->nverts &&
-           b >= 0 && b < m->nverts;
+    normals_faces(m, pos);
+    normals_verts(m);
 }
 
-static bool compute_face_norm(struct Mesh *m, size_t a, size_t b, vec3 out)
+
+void mesh_pack_verts(struct Mesh *m, vec3 *pos, Vertex *out)
 {
-    if (in_range(m, a, b))
+    for (size_t i = 0; i < m->nverts; ++i)
     {
-        glm_vec3_cross(m->verts[a].pos, m->verts[b].pos, out);
-        return true;
+        glm_vec3_copy(pos[i], out[i].pos);
+        glm_vec3_copy(m->norm[i], out[i].norm);
     }
-
-    glm_vec3_zero(out);
-    return false;
 }
 
-void mesh_calculate_normals(struct Mesh *m)
-{
-    for (size_t i = 0; i < m->nindices; ++i)
-    {
-        size_t index = m->indices[i];
-        int s = m->size;
-
-        vec3 norms[6];
-        bool included[6];
 
-        included[0] = compute_face_norm(m, index - s - 1,  index - 1,      norms[0]);
-        included[1] = compute_face_norm(m, index - s,      index - s - 1,  norms[1]);
-        included[2] = compute_face_norm(m, index + 1,      index - s,      norms[2]);
-        included[3] = compute_face_norm(m, index + s + 1,  index + 1,      norms[3]);
-        included[4] = compute_face_norm(m, index + s,      index + s + 1,  norms[4]);
-        included[5] = compute_face_norm(m, index - 1,      index + s,      norms[5]);
+size_t mesh_grid_mass(struct Mesh *m, int y, int z)
+{
+    size_t i = (size_t)y * m->size + z;
+    return m->mask_remap ? m->mask_remap[i] : i;
+}
 
-        vec3 avg = { 0.f, 0.f, 0.f };
 
-        int count = 0;
+void mesh_construct(struct Mesh *m)
+{
+    size_t n = m->size * m->size;
 
-        for (int j = 0; j < 6; ++j)
-        {
-            if (included[j])
-            {
-                glm_vec3_add(avg, norms[j], avg);
-                ++count;
-            }
-        }
+    if (m->mask_remap)
+    {
+        n = 0;
 
-        glm_vec3_divs(avg, (float)count, m->verts[index].norm);
+        for (size_t i = 0; i < (size_t)m->size * m->size; ++i)
+            n += m->mask_remap[i] != MESH_NO_MASS;
     }
-}
 
+    mesh_alloc_state(m, n);
 
-void mesh_construct(struct Mesh *m)
-{
-    m->verts = malloc(sizeof(Vertex) * (m->size * m->size));
+    m->indices = malloc(sizeof(unsigned int) * (m->size - 1) * (m->size - 1) * 6);
 
     for (int y = 0; y < m->size; ++y)
     {
         for (int z = 0; z < m->size; ++z)
         {
-            Vertex v = {
-                { (float)y * m->res, -.4f, (float)z * m->res },
-                { 0.f, 1.f, 0.f }
-            };
+            size_t i = mesh_grid_mass(m, y, z);
 
-            m->verts[m->nverts++] = v;
+            if (i == MESH_NO_MASS)
+                continue;
 
-            m->masses = realloc(m->masses, sizeof(struct Mass) * ++m->nmasses);
-            m->masses[m->nmasses - 1] = (struct Mass){ .5f, { 0.f, 0.f, 0.f }, &m->verts[m->nverts - 1] };
+            ++m->nmasses;
+            glm_vec3_copy((vec3){ (float)y * m->res, -.4f, (float)z * m->res }, m->pos[i]);
+            glm_vec3_zero(m->vel[i]);
+            glm_vec3_copy((vec3){ 0.f, 1.f, 0.f }, m->norm[i]);
+            m->inv_mass[i] = 1.f / m->mass;
 
-            if (y != m->size - 1 && z != m->size - 1)
+            if (grid_tri(m, 0, y, z))
             {
-                unsigned int i = y * m->size + z;
-                unsigned int ta[3], tb[3];
+                unsigned int ta[3];
 
                 ta[0] = i;
-                ta[1] = i + m->size + 1;
-                ta[2] = i + m->size;
+                ta[1] = mesh_grid_mass(m, y + 1, z + 1);
+                ta[2] = mesh_grid_mass(m, y + 1, z);
 
-                tb[0] = i;
-                tb[1] = i + 1;
-                tb[2] = i + m->size + 1;
+                memcpy(m->indices + m->nindices, ta, sizeof(unsigned int) * 3);
+                m->nindices += 3;
+            }
 
-                size_t ia = m->nindices;
-                size_t ib = m->nindices + 3;
+            if (grid_tri(m, 1, y, z))
+            {
+                unsigned int tb[3];
 
-                m->nindices += 6;
-                m->indices = realloc(m->indices, sizeof(unsigned int) * m->nindices);
+                tb[0] = i;
+                tb[1] = mesh_grid_mass(m, y, z + 1);
+                tb[2] = mesh_grid_mass(m, y + 1, z + 1);
 
-                memcpy(m->indices + ia, ta, sizeof(unsigned int) * 3);
-                memcpy(m->indices + ib, tb, sizeof(unsigned int) * 3);
+                memcpy(m->indices + m->nindices, tb, sizeof(unsigned int) * 3);
+                m->nindices += 3;
             }
         }
     }
+
+    m->nverts = m->nmasses;
+    mesh_snapshot(m);
+
+    normals_alloc(m);
 }
 
 
@@ -274,40 +920,73 @@ void mesh_gen_springs(struct Mesh *m)
     m->nsprings = (area * 2 + (m->size - 1) * 2) + (area * 2);
     m->springs = malloc(sizeof(struct Spring) * m->nsprings);
 
+    // Every spring family is split by parity into two colors, adjacent
+    // springs of a family always differ in parity. Dropping springs a mask
+    // left out keeps that true.
+    m->ncolors = 8;
+    m->colors = malloc(sizeof(size_t) * (m->ncolors + 1));
+
     size_t index = 0;
+    size_t color = 0;
 
-    float k = 1500.f;
+    float k = SPRING_K;
     float eq_len = m->res;
     float eq_len_diag = sqrtf(m->res * m->res * 2.f);
 
-    // horizontal and vertical
-    for (size_t y = 0; y < m->size; ++y)
+    // Springs only run along sides of existing triangles, or across the
+    // middle of a whole quad
+    // horizontal, split by column parity
+    for (size_t parity = 0; parity < 2; ++parity)
     {
-        for (size_t z = 0; z < m->size - 1; ++z)
+        m->colors[color++] = index;
+
+        for (int y = 0; y < m->size; ++y)
         {
-            size_t mi = y * m->size + z;
-            m->springs[index++] = (struct Spring){ &m->masses[mi], &m->masses[mi + 1], k, eq_len };
+            for (int z = parity; z < m->size - 1; z += 2)
+            {
+                if (grid_tri(m, 1, y, z) || grid_tri(m, 0, y - 1, z))
+                    m->springs[index++] = (struct Spring){ mesh_grid_mass(m, y, z), mesh_grid_mass(m, y, z + 1), k, eq_len };
+            }
         }
     }
 
-    for (size_t y = 0; y < m->size - 1; ++y)
+    // vertical, split by row parity
+    for (size_t parity = 0; parity < 2; ++parity)
     {
-        for (size_t z = 0; z < m->size; ++z)
+        m->colors[color++] = index;
+
+        for (int y = parity; y < m->size - 1; y += 2)
         {
-            size_t mi = y * m->size + z;
-            m->springs[index++] = (struct Spring){ &m->masses[mi], &m->masses[mi + m->size], k, eq_len };
+            for (int z = 0; z < m->size; ++z)
+            {
+                if (grid_tri(m, 0, y, z) || grid_tri(m, 1, y, z - 1))
+                    m->springs[index++] = (struct Spring){ mesh_grid_mass(m, y, z), mesh_grid_mass(m, y + 1, z), k, eq_len };
+            }
         }
     }
 
-    // diagonal
-    for (size_t y = 0; y < m->size - 1; ++y)
+    // diagonal, each direction split by row parity
+    for (size_t dir = 0; dir < 2; ++dir)
     {
-        for (size_t z = 0; z < m->size - 1; ++z)
+        for (size_t parity = 0; parity < 2; ++parity)
         {
-            size_t mi = y * m->size + z;
-            m->springs[index++] = (struct Spring){ &m->masses[mi], &m->masses[mi + m->size + 1], k, eq_len_diag };
-            m->springs[index++] = (struct Spring){ &m->masses[mi + m->size], &m->masses[mi + 1], k, eq_len_diag };
+            m->colors[color++] = index;
+
+            for (int y = parity; y < m->size - 1; y += 2)
+            {
+                for (int z = 0; z < m->size - 1; ++z)
+                {
+                    bool a = grid_tri(m, 0, y, z), b = grid_tri(m, 1, y, z);
+
+                    if (dir == 0 && (a || b))
+                        m->springs[index++] = (struct Spring){ mesh_grid_mass(m, y, z), mesh_grid_mass(m, y + 1, z + 1), k, eq_len_diag };
+                    else if (dir == 1 && a && b)
+                        m->springs[index++] = (struct Spring){ mesh_grid_mass(m, y + 1, z), mesh_grid_mass(m, y, z + 1), k, eq_len_diag };
+                }
+            }
         }
     }
-}
 
+    m->colors[color] = index;
+    m->nsprings = index;
+}
@@ -1,60 +1,223 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include "aero.h"
+#include "collider.h"
+#include "implicit.h"
+#include "integrator.h"
+#include "pd.h"
+#include "pin.h"
 #include "render.h"
+#include "selfcollide.h"
+#include "xpbd.h"
 #include <cglm/cglm.h>
+#include <limits.h>
+
+#define GRAVITY (10.f * -9.8f)
+// Grid positions a mask left without a mass
+#define MESH_NO_MASS ((size_t)UINT_MAX)
 
 typedef struct
 {
     vec3 pos, norm;
 } Vertex;
 
-struct Mass
+struct Spring
 {
-    float mass;
-    vec3 vel;
-
-    Vertex *vert;
+    unsigned int a, b;
+    float k, eq_len;
 };
 
-void mass_apply_force(struct Mass *m, vec3 f, float dt);
-
-struct Spring
+enum NormalMode
 {
-    struct Mass *ma, *mb;
-    float k, eq_len;
+    // Normals are computed by mesh_pack and uploaded with the positions
+    NORMALS_CPU,
+    // Only positions are uploaded, to a buffer texture that
+    // shaders/gpu_norm_v.glsl derives normals from
+    NORMALS_GPU
 };
 
-void spring_force(struct Spring *s, struct Mass *m, vec3 out);
+enum SpringMode
+{
+    // Springs add to vel as they are evaluated
+    SPRING_IMMEDIATE,
+    // Springs add to force, which is applied along with gravity and drag in
+    // a single sweep over the masses
+    SPRING_ACCUMULATE
+};
 
 struct Mesh
 {
+    // Only grids have a size, res is the mean edge length of anything else.
+    // Masked grids are not full grids, their masses are the set pixels
+    // compacted in grid order, see mesh_grid_mass.
     int size;
     float res;
+    bool grid;
+    unsigned int *mask_remap;
+
+    // Simulation state, indexed by mass id
+    vec3 *pos, *vel;
+    float *inv_mass;
+    size_t nmasses;
+    // Room in every per mass array, only more than nmasses with tearing
+    size_t mass_cap;
 
+    // Only used with SPRING_ACCUMULATE
+    vec3 *force;
+    // Spring stiffness summed at every mass, scratch of integrator_max_omega
+    float *ksum;
+
+    // Mass of an unpinned particle
+    float mass;
+
+    struct Pin *pins;
+    size_t npins;
+
+    float time;
+
+    vec3 *norm;
+
+    // Per triangle normals, see normals.h
+    float *fnorm;
+    size_t fnorm_stride;
+    // Mesh::time at which fnorm was last taken from pos, -1 if never
+    float fnorm_time;
+    // Triangles around vertex i are vtri[vtri_start[i], vtri_end[i]), only
+    // for meshes that are not grids
+    unsigned int *vtri_start, *vtri_end, *vtri;
+
+    // Positions before the last step, and the blend of both that is drawn
+    vec3 *prev_pos, *draw_pos;
+
+    // Interleaved copy of pos + norm, written by mesh_upload
     Vertex *verts;
     size_t nverts;
 
-    struct Mass *masses;
-    size_t nmasses;
-
     struct Spring *springs;
     size_t nsprings;
 
+    // Springs are sorted so that [colors[c], colors[c + 1]) never share a mass
+    size_t *colors;
+    size_t ncolors;
+
+    enum SpringMode spring_mode;
+
+    const struct Integrator *integrator;
+    // Size of the last step the integrator took, 0 until its first
+    float last_dt;
+    // Pins, stiffnesses or the topology changed since the last step, so
+    // accelerations kept from it are stale
+    bool forces_changed;
+
+    // Integrator state, allocated by Integrator::init
+    struct Implicit *implicit;
+    struct Xpbd *xpbd;
+    struct Pd *pd;
+    // nwork arrays of mass_cap entries each
+    vec3 *work;
+    size_t nwork;
+
+    // Null unless self collision is on
+    struct SelfCollide *self_collide;
+    // Null unless tearing is on
+    struct Tear *tear;
+    // Mass every mass was torn off from, itself if never split. Null unless
+    // tearing is on.
+    unsigned int *torn_from;
+
+    // Drag and lift on every triangle, see aero.h
+    struct Aero aero;
+
+    struct Collider *colliders;
+    size_t ncolliders;
+    // Masses are kept this far outside colliders
+    float skin;
+
+    // mesh_step substeps at no more than cfl * Integrator::max_dt, and so
+    // that strain changes by at most max_strain_step per substep
+    float cfl;
+    float max_strain_step;
+    int max_substeps;
+
+    // Substeps taken by the last mesh_step, and the count the bounds above
+    // asked for. More wanted than taken means max_substeps cut it short and
+    // the step was not known to be stable.
+    int substeps;
+    int wanted_substeps;
+
     unsigned int *indices;
     size_t nindices;
 
+    enum NormalMode normal_mode;
+
     unsigned int vao, vb, ib;
+    // Buffer texture of positions, only created for NORMALS_GPU
+    unsigned int pos_buf, pos_tex;
 };
 
 struct Mesh *mesh_alloc(int size, float res);
+// Grid of the size of the image at path, only where its alpha, or its
+// brightness without alpha, is at least half
+struct Mesh *mesh_alloc_mask(const char *path, float res);
+// Cloth shaped like any triangle mesh assimp reads, see topology.h
+struct Mesh *mesh_load(const char *path);
 void mesh_free(struct Mesh *m);
 
-void mesh_update(struct Mesh *m, float dt, size_t *held, size_t nheld);
+void mesh_apply_force(struct Mesh *m, size_t i, vec3 f, float dt);
+// Force exerted on s->a, s->b receives the negation
+void spring_force(struct Mesh *m, struct Spring *s, vec3 out);
+
+void mesh_set_integrator(struct Mesh *m, const struct Integrator *integrator);
+// The mesh takes ownership of c
+void mesh_add_collider(struct Mesh *m, struct Collider c);
+// Thickness <= 0 turns self collision off
+void mesh_set_self_collision(struct Mesh *m, float thickness);
+// Springs break past 1 + strain times their rest length and the cloth
+// splits along broken triangle sides, adding masses up to max_masses. Call
+// before any frame is packed, the frame layout depends on it. Torn meshes
+// use NORMALS_CPU.
+void mesh_set_tearing(struct Mesh *m, float strain, size_t max_masses);
+// Call before any frame is packed, the frame layout depends on it. Meshes
+// that are not grids stay on NORMALS_CPU.
+void mesh_set_normal_mode(struct Mesh *m, enum NormalMode mode);
+
+// Runs every spring over pos, see SpringKernel
+void mesh_spring_pass(struct Mesh *m, vec3 *pos, vec3 *out, float *inv_mass, float scale);
+// Acceleration of every mass from springs and gravity at pos
+void mesh_accel(struct Mesh *m, vec3 *pos, vec3 *out);
+
+// Advances the simulation by exactly dt
+void mesh_update(struct Mesh *m, float dt);
+// Advances by dt in as few stable substeps as possible
+void mesh_step(struct Mesh *m, float dt);
+float mesh_max_strain_rate(struct Mesh *m);
+// Axis aligned box around every mass
+void mesh_bounds(struct Mesh *m, vec3 lo, vec3 hi);
+// Moves every mass and pin origin by t, which should be rigid since spring
+// rest lengths are kept
+void mesh_transform(struct Mesh *m, mat4 t);
+
+// Saves pos for mesh_upload to interpolate from, call before the last
+// step of a frame
+void mesh_snapshot(struct Mesh *m);
+// Bytes written by mesh_pack
+size_t mesh_frame_size(struct Mesh *m);
+// Writes positions alpha of the way from the snapshot to pos to out, as
+// Vertex with their normals for NORMALS_CPU or as bare vec3 for NORMALS_GPU,
+// after a header with the vertex count
+void mesh_pack(struct Mesh *m, float alpha, void *out);
+// Only call from the thread owning the GL context
+void mesh_upload_frame(struct Mesh *m, const void *frame);
+// mesh_pack into a temporary frame followed by mesh_upload_frame
+void mesh_upload(struct Mesh *m, float alpha);
 void mesh_render(struct Mesh *m, RenderInfo *ri);
 
-void mesh_calculate_normals(struct Mesh *m);
+void mesh_calculate_normals(struct Mesh *m, vec3 *pos);
+void mesh_pack_verts(struct Mesh *m, vec3 *pos, Vertex *out);
 
+// Mass at row y and column z of a grid, MESH_NO_MASS if masked out
+size_t mesh_grid_mass(struct Mesh *m, int y, int z);
 void mesh_construct(struct Mesh *m);
 void mesh_gen_springs(struct Mesh *m);
 
@@ -0,0 +1,74 @@
+#include "model.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assimp/cimport.h>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+
+struct Model *model_load(const char *path)
+{
+    const struct aiScene *sc = aiImportFile(path, aiProcess_Triangulate |
+                                                  aiProcess_JoinIdenticalVertices |
+                                                  aiProcess_PreTransformVertices |
+                                                  aiProcess_SortByPType);
+
+    if (!sc || (sc->mFlags & AI_SCENE_FLAGS_INCOMPLETE))
+    {
+        fprintf(stderr, "[model_load] Failed to load '%s': %s\n", path, aiGetErrorString());
+        exit(EXIT_FAILURE);
+    }
+
+    struct Model *m = malloc(sizeof(struct Model));
+    m->nverts = 0;
+    m->nindices = 0;
+
+    for (unsigned int i = 0; i < sc->mNumMeshes; ++i)
+    {
+        m->nverts += sc->mMeshes[i]->mNumVertices;
+        m->nindices += sc->mMeshes[i]->mNumFaces * 3;
+    }
+
+    m->verts = malloc(sizeof(vec3) * (m->nverts ? m->nverts : 1));
+    m->indices = malloc(sizeof(unsigned int) * (m->nindices ? m->nindices : 1));
+
+    size_t base = 0;
+    m->nindices = 0;
+
+    for (unsigned int i = 0; i < sc->mNumMeshes; ++i)
+    {
+        struct aiMesh *mesh = sc->mMeshes[i];
+
+        for (unsigned int v = 0; v < mesh->mNumVertices; ++v)
+        {
+            struct aiVector3D p = mesh->mVertices[v];
+            glm_vec3_copy((vec3){ p.x, p.y, p.z }, m->verts[base + v]);
+        }
+
+        // Points and lines are left over after triangulation, skip them
+        for (unsigned int f = 0; f < mesh->mNumFaces; ++f)
+        {
+            struct aiFace *face = &mesh->mFaces[f];
+
+            if (face->mNumIndices != 3)
+                continue;
+
+            for (int k = 0; k < 3; ++k)
+                m->indices[m->nindices++] = base + face->mIndices[k];
+        }
+
+        base += mesh->mNumVertices;
+    }
+
+    aiReleaseImport(sc);
+
+    return m;
+}
+
+
+void model_free(struct Model *m)
+{
+    free(m->verts);
+    free(m->indices);
+    free(m);
+}
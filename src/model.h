@@ -0,0 +1,20 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <cglm/cglm.h>
+
+// Triangle soup of every mesh in a file, in the file's world space
+struct Model
+{
+    vec3 *verts;
+    size_t nverts;
+
+    unsigned int *indices;
+    size_t nindices;
+};
+
+// Anything assimp reads, exits on failure
+struct Model *model_load(const char *path);
+void model_free(struct Model *m);
+
+#endif
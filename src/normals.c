@@ -0,0 +1,231 @@
+#include "normals.h"
+#include "mesh.h"
+#include "pool.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ROW_GRAIN 16
+
+struct FaceJob
+{
+    struct Mesh *m;
+    vec3 *pos;
+};
+
+struct SumJob
+{
+    struct Mesh *m;
+    float *faces;
+    vec3 *out;
+};
+
+// FNORM over any array in the layout of Mesh::fnorm
+#define FACES(j, t, c) ((j)->faces + ((t) * 3 + (c)) * (j)->m->fnorm_stride)
+
+
+// Inverts Mesh::indices so that every vertex can sum its own triangles
+static void build_vtri(struct Mesh *m)
+{
+    size_t ntris = m->nindices / 3;
+    m->vtri_start = calloc(m->nmasses + 1, sizeof(unsigned int));
+    m->vtri = malloc(sizeof(unsigned int) * (m->nindices + 1));
+
+    for (size_t i = 0; i < m->nindices; ++i)
+        ++m->vtri_start[m->indices[i] + 1];
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+        m->vtri_start[i + 1] += m->vtri_start[i];
+
+    unsigned int *next = malloc(sizeof(unsigned int) * (m->nmasses + 1));
+    memcpy(next, m->vtri_start, sizeof(unsigned int) * (m->nmasses + 1));
+
+    for (size_t t = 0; t < ntris; ++t)
+    {
+        for (int k = 0; k < 3; ++k)
+            m->vtri[next[m->indices[t * 3 + k]]++] = t;
+    }
+
+    free(next);
+
+    m->vtri_end = malloc(sizeof(unsigned int) * (m->nmasses + 1));
+    memcpy(m->vtri_end, m->vtri_start + 1, sizeof(unsigned int) * m->nmasses);
+}
+
+
+void normals_alloc(struct Mesh *m)
+{
+    size_t w = m->size + 1;
+    m->fnorm_stride = w * w;
+
+    if (!m->grid)
+    {
+        m->fnorm_stride = m->nindices / 3 + 1;
+        build_vtri(m);
+    }
+
+    size_t bytes = sizeof(float) * 6 * m->fnorm_stride;
+    m->fnorm = util_alloc_aligned(bytes);
+    memset(m->fnorm, 0, bytes);
+}
+
+
+static void face_job(void *arg, size_t begin, size_t end)
+{
+    struct FaceJob *j = arg;
+    struct Mesh *m = j->m;
+    vec3 *pos = j->pos;
+
+    int s = m->size;
+
+    float *ax = FNORM(m, 0, 0), *ay = FNORM(m, 0, 1), *az = FNORM(m, 0, 2);
+    float *bx = FNORM(m, 1, 0), *by = FNORM(m, 1, 1), *bz = FNORM(m, 1, 2);
+
+    for (size_t y = begin; y < end; ++y)
+    {
+        vec3 *row = pos + y * s;
+        vec3 *next = row + s;
+        size_t q = (y + 1) * (s + 1) + 1;
+
+        #pragma omp simd
+        for (int z = 0; z < s - 1; ++z)
+        {
+            // Diagonal shared by both triangles, i to i + size + 1
+            float dx = next[z + 1][0] - row[z][0];
+            float dy = next[z + 1][1] - row[z][1];
+            float dz = next[z + 1][2] - row[z][2];
+
+            // i to i + size
+            float ex = next[z][0] - row[z][0];
+            float ey = next[z][1] - row[z][1];
+            float ez = next[z][2] - row[z][2];
+
+            // i to i + 1
+            float fx = row[z + 1][0] - row[z][0];
+            float fy = row[z + 1][1] - row[z][1];
+            float fz = row[z + 1][2] - row[z][2];
+
+            ax[q + z] = dy * ez - dz * ey;
+            ay[q + z] = dz * ex - dx * ez;
+            az[q + z] = dx * ey - dy * ex;
+
+            bx[q + z] = fy * dz - fz * dy;
+            by[q + z] = fz * dx - fx * dz;
+            bz[q + z] = fx * dy - fy * dx;
+        }
+    }
+}
+
+
+static void vert_job(void *arg, size_t begin, size_t end)
+{
+    struct SumJob *j = arg;
+    struct Mesh *m = j->m;
+    int s = m->size;
+    size_t w = s + 1;
+
+    for (size_t y = begin; y < end; ++y)
+    {
+        vec3 *out = j->out + y * s;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            // Quads (y, z) and (y - 1, z - 1) touch the vertex with both
+            // triangles, (y - 1, z) only with the first, (y, z - 1) only
+            // with the second
+            float *a = FACES(j, 0, c);
+            float *b = FACES(j, 1, c);
+
+            float *cur_a = a + (y + 1) * w + 1, *cur_b = b + (y + 1) * w + 1;
+            float *up_a = a + y * w + 1, *up_b = b + y * w + 1;
+
+            #pragma omp simd
+            for (int z = 0; z < s; ++z)
+            {
+                out[z][c] = cur_a[z] + cur_b[z] +
+                            up_a[z - 1] + up_b[z - 1] +
+                            up_a[z] + cur_b[z - 1];
+            }
+        }
+    }
+}
+
+
+static void tri_face_job(void *arg, size_t begin, size_t end)
+{
+    struct FaceJob *j = arg;
+    struct Mesh *m = j->m;
+
+    float *nx = FNORM(m, 0, 0), *ny = FNORM(m, 0, 1), *nz = FNORM(m, 0, 2);
+
+    for (size_t t = begin; t < end; ++t)
+    {
+        unsigned int *tri = m->indices + t * 3;
+
+        vec3 ab, ac, n;
+        glm_vec3_sub(j->pos[tri[1]], j->pos[tri[0]], ab);
+        glm_vec3_sub(j->pos[tri[2]], j->pos[tri[0]], ac);
+        glm_vec3_cross(ab, ac, n);
+
+        nx[t] = n[0];
+        ny[t] = n[1];
+        nz[t] = n[2];
+    }
+}
+
+
+static void tri_vert_job(void *arg, size_t begin, size_t end)
+{
+    struct SumJob *j = arg;
+    struct Mesh *m = j->m;
+    float *nx = FACES(j, 0, 0), *ny = FACES(j, 0, 1), *nz = FACES(j, 0, 2);
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        float x = 0.f, y = 0.f, z = 0.f;
+
+        for (unsigned int k = m->vtri_start[i]; k < m->vtri_end[i]; ++k)
+        {
+            unsigned int t = m->vtri[k];
+            x += nx[t];
+            y += ny[t];
+            z += nz[t];
+        }
+
+        glm_vec3_copy((vec3){ x, y, z }, j->out[i]);
+    }
+}
+
+
+void normals_faces(struct Mesh *m, vec3 *pos)
+{
+    struct FaceJob j = { m, pos };
+
+    if (!m->grid)
+    {
+        pool_for(pool_global(), m->nindices / 3, ROW_GRAIN * 256, tri_face_job, &j);
+        return;
+    }
+
+    pool_for(pool_global(), m->size - 1, ROW_GRAIN, face_job, &j);
+}
+
+
+void normals_verts(struct Mesh *m)
+{
+    normals_sum(m, m->fnorm, m->norm);
+}
+
+
+void normals_sum(struct Mesh *m, float *faces, vec3 *out)
+{
+    struct SumJob j = { m, faces, out };
+
+    if (!m->grid)
+    {
+        pool_for(pool_global(), m->nmasses, ROW_GRAIN * 256, tri_vert_job, &j);
+        return;
+    }
+
+    pool_for(pool_global(), m->size, ROW_GRAIN, vert_job, &j);
+}
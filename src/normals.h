@@ -0,0 +1,25 @@
+#ifndef NORMALS_H
+#define NORMALS_H
+
+#include <cglm/cglm.h>
+
+struct Mesh;
+
+// Face normals of grid quads, component c of triangle t (0 is
+// i, i + size + 1, i + size and 1 is i, i + 1, i + size + 1) as a row of
+// (size + 1)^2 floats. Quad (y, z) lives at (y + 1) * (size + 1) + z + 1, the
+// border is zero so vertex sums never need bounds checks. Meshes that are
+// not grids only use t = 0, indexed by triangle.
+#define FNORM(m, t, c) ((m)->fnorm + ((t) * 3 + (c)) * (m)->fnorm_stride)
+
+void normals_alloc(struct Mesh *m);
+
+// Cross products of edge vectors, once per triangle
+void normals_faces(struct Mesh *m, vec3 *pos);
+// Sums the triangles around every vertex into Mesh::norm, six per vertex on
+// grids
+void normals_verts(struct Mesh *m);
+// normals_verts over any per triangle vectors laid out like Mesh::fnorm
+void normals_sum(struct Mesh *m, float *faces, vec3 *out);
+
+#endif
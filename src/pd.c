@@ -0,0 +1,1081 @@
+#include "pd.h"
+#include "mesh.h"
+#include "pool.h"
+#include "util.h"
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SPRING_GRAIN 4096
+
+// Step size of level 0, level k factors M / h_k^2 + L with h_k = PD_H_MAX / 2^k
+#define PD_H_MAX (1.f / 60.f)
+#define PD_LEVELS 16
+// A cached level keeps serving steps up to this many times its own size
+#define PD_SLACK 3.f
+// Columns before the system is reordered and refactored
+#define PD_MAX_RANK 64
+// b of a column with a single end
+#define PD_NONE UINT_MAX
+
+#define CACHE_DIR "cache"
+#define CACHE_MAGIC 0x48435044 // "PDCH"
+#define CACHE_VERSION 3
+// Factors kept in CACHE_DIR, the oldest are removed past this
+#define CACHE_FILES 16
+
+struct LocalJob
+{
+    struct Mesh *m;
+    size_t first;
+};
+
+struct CacheHeader
+{
+    uint32_t magic, version;
+    uint64_t key;
+    uint64_t n, nenv;
+};
+
+struct CacheEntry
+{
+    char name[64];
+    time_t mtime;
+};
+
+
+static void factor_init(struct PdFactor *f)
+{
+    f->level = -1;
+    f->env = 0;
+    f->springs = 0;
+    f->cols = 0;
+    f->ncols = 0;
+    f->cols_cap = 0;
+    f->nspring_cols = 0;
+    f->cap = 0;
+    f->piv = 0;
+    f->cap_valid = false;
+    f->used = 0;
+}
+
+
+static void factor_clear(struct PdFactor *f)
+{
+    for (size_t i = 0; i < f->ncols; ++i)
+        free(f->cols[i].z);
+
+    f->ncols = 0;
+    f->nspring_cols = 0;
+    f->cap_valid = false;
+    f->level = -1;
+}
+
+
+struct Pd *pd_alloc(struct Mesh *m)
+{
+    struct Pd *pd = malloc(sizeof(struct Pd));
+    size_t n = m->mass_cap;
+    pd->n = n;
+
+    pd->perm = malloc(sizeof(unsigned int) * n);
+    pd->iperm = malloc(sizeof(unsigned int) * n);
+    pd->first = malloc(sizeof(unsigned int) * n);
+    pd->start = malloc(sizeof(size_t) * (n + 1));
+    pd->nenv = 0;
+    pd->ordered = false;
+    pd->base = malloc(sizeof(struct Spring) * m->nsprings);
+    pd->pinned = calloc(n, sizeof(bool));
+
+    for (int i = 0; i < PD_FACTORS; ++i)
+        factor_init(&pd->factors[i]);
+
+    pd->steps = 0;
+
+    pd->prev = util_alloc_aligned(sizeof(vec3) * n);
+    pd->inertia = util_alloc_aligned(sizeof(vec3) * n);
+    pd->last = util_alloc_aligned(sizeof(vec3) * n);
+    pd->rhs = util_alloc_aligned(sizeof(double) * 3 * n);
+    pd->t = 0;
+    pd->mark = calloc(n, 1);
+
+    pd->iters = 10;
+    pd->rho = .9f;
+
+    return pd;
+}
+
+
+void pd_free(struct Pd *pd)
+{
+    for (int i = 0; i < PD_FACTORS; ++i)
+    {
+        struct PdFactor *f = &pd->factors[i];
+        factor_clear(f);
+
+        free(f->env);
+        free(f->springs);
+        free(f->cols);
+        free(f->cap);
+        free(f->piv);
+    }
+
+    free(pd->perm);
+    free(pd->iperm);
+    free(pd->first);
+    free(pd->start);
+    free(pd->base);
+    free(pd->pinned);
+
+    free(pd->prev);
+    free(pd->inertia);
+    free(pd->last);
+    free(pd->rhs);
+    free(pd->t);
+    free(pd->mark);
+
+    free(pd);
+}
+
+
+static float level_h(int level)
+{
+    return PD_H_MAX / (float)(1u << level);
+}
+
+
+// Largest level no longer than h, the mismatch then only ever takes mass
+// off the diagonal which keeps the splitting convergent
+static int level_for(float h)
+{
+    int k = 0;
+
+    while (k < PD_LEVELS - 1 && level_h(k) > h)
+        ++k;
+
+    return k;
+}
+
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+
+// Everything a factor depends on: topology, stiffness, masses, the pins of
+// the ordering and the level
+static uint64_t factor_key(struct Mesh *m, struct Pd *pd, int level)
+{
+    uint64_t key = 0xcbf29ce484222325ull;
+    key = fnv(key, &pd->n, sizeof(pd->n));
+    key = fnv(key, &m->nmasses, sizeof(m->nmasses));
+    key = fnv(key, &m->mass, sizeof(m->mass));
+    key = fnv(key, &level, sizeof(level));
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        key = fnv(key, &pd->base[i].a, sizeof(unsigned int) * 2);
+        key = fnv(key, &pd->base[i].k, sizeof(float));
+    }
+
+    key = fnv(key, pd->pinned, sizeof(bool) * m->nmasses);
+
+    return key ? key : 1;
+}
+
+
+// Masses past Mesh::nmasses are unused rows at the end, tearing fills them
+static void order_rcm(struct Mesh *m, struct Pd *pd)
+{
+    size_t n = m->nmasses;
+
+    size_t *adj_start = calloc(n + 1, sizeof(size_t));
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        ++adj_start[m->springs[i].a + 1];
+        ++adj_start[m->springs[i].b + 1];
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        adj_start[i + 1] += adj_start[i];
+
+    unsigned int *adj = malloc(sizeof(unsigned int) * (adj_start[n] + 1));
+    size_t *fill = malloc(sizeof(size_t) * (n + 1));
+    memcpy(fill, adj_start, sizeof(size_t) * n);
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        adj[fill[m->springs[i].a]++] = m->springs[i].b;
+        adj[fill[m->springs[i].b]++] = m->springs[i].a;
+    }
+
+    free(fill);
+
+    bool *visited = calloc(n + 1, sizeof(bool));
+    size_t head = 0, tail = 0;
+
+    while (tail < n)
+    {
+        // Start each component from its lowest degree mass
+        size_t root = n;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!visited[i] && (root == n || adj_start[i + 1] - adj_start[i] < adj_start[root + 1] - adj_start[root]))
+                root = i;
+        }
+
+        visited[root] = true;
+        pd->perm[tail++] = root;
+
+        while (head < tail)
+        {
+            unsigned int v = pd->perm[head++];
+            size_t begin = tail;
+
+            for (size_t j = adj_start[v]; j < adj_start[v + 1]; ++j)
+            {
+                if (!visited[adj[j]])
+                {
+                    visited[adj[j]] = true;
+                    pd->perm[tail++] = adj[j];
+                }
+            }
+
+            // Insertion sort the new level by degree, at most a handful
+            for (size_t j = begin + 1; j < tail; ++j)
+            {
+                unsigned int u = pd->perm[j];
+                size_t du = adj_start[u + 1] - adj_start[u];
+                size_t k = j;
+
+                while (k > begin && adj_start[pd->perm[k - 1] + 1] - adj_start[pd->perm[k - 1]] > du)
+                {
+                    pd->perm[k] = pd->perm[k - 1];
+                    --k;
+                }
+
+                pd->perm[k] = u;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n / 2; ++i)
+    {
+        unsigned int t = pd->perm[i];
+        pd->perm[i] = pd->perm[n - 1 - i];
+        pd->perm[n - 1 - i] = t;
+    }
+
+    for (size_t i = n; i < pd->n; ++i)
+        pd->perm[i] = i;
+
+    for (size_t i = 0; i < pd->n; ++i)
+        pd->iperm[pd->perm[i]] = i;
+
+    free(visited);
+    free(adj);
+    free(adj_start);
+}
+
+
+static void envelope(struct Mesh *m, struct Pd *pd)
+{
+    size_t n = pd->n;
+
+    for (size_t i = 0; i < n; ++i)
+        pd->first[i] = i;
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        unsigned int a = pd->iperm[m->springs[i].a];
+        unsigned int b = pd->iperm[m->springs[i].b];
+        unsigned int lo = a < b ? a : b;
+        unsigned int hi = a < b ? b : a;
+
+        if (lo < pd->first[hi])
+            pd->first[hi] = lo;
+    }
+
+    pd->start[0] = 0;
+
+    for (size_t i = 0; i < n; ++i)
+        pd->start[i + 1] = pd->start[i] + (i - pd->first[i] + 1);
+
+    pd->nenv = pd->start[n];
+}
+
+
+// New ordering and envelope from the current springs, which every factor
+// is based on from now on together with the current pins
+static void order(struct Mesh *m, struct Pd *pd)
+{
+    order_rcm(m, pd);
+    envelope(m, pd);
+    memcpy(pd->base, m->springs, sizeof(struct Spring) * m->nsprings);
+
+    for (size_t i = 0; i < pd->n; ++i)
+        pd->pinned[i] = i < m->nmasses && m->inv_mass[i] == 0.f;
+
+    for (int i = 0; i < PD_FACTORS; ++i)
+        factor_clear(&pd->factors[i]);
+
+    pd->ordered = true;
+}
+
+
+#define ENV(pd, env, i, j) ((env)[(pd)->start[i] + (j) - (pd)->first[i]])
+
+static void factor(struct Mesh *m, struct Pd *pd, double *env, float h)
+{
+    size_t n = pd->n;
+    memset(env, 0, sizeof(double) * pd->nenv);
+
+    for (size_t i = 0; i < n; ++i)
+        ENV(pd, env, i, i) = m->mass / ((double)h * h);
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        struct Spring *s = &pd->base[i];
+
+        unsigned int a = pd->iperm[s->a];
+        unsigned int b = pd->iperm[s->b];
+        bool pa = pd->pinned[s->a], pb = pd->pinned[s->b];
+
+        if (!pa) ENV(pd, env, a, a) += s->k;
+        if (!pb) ENV(pd, env, b, b) += s->k;
+
+        // The pinned end is known, its coupling is on the right hand side
+        if (pa || pb) continue;
+
+        if (a > b) ENV(pd, env, a, b) -= s->k;
+        else ENV(pd, env, b, a) -= s->k;
+    }
+
+    // Envelope Cholesky, fill-in never leaves the envelope
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t j = pd->first[i]; j <= i; ++j)
+        {
+            size_t k0 = pd->first[i] > pd->first[j] ? pd->first[i] : pd->first[j];
+
+            double sum = ENV(pd, env, i, j);
+
+            for (size_t k = k0; k < j; ++k)
+                sum -= ENV(pd, env, i, k) * ENV(pd, env, j, k);
+
+            if (j == i)
+                ENV(pd, env, i, i) = sqrt(sum);
+            else
+                ENV(pd, env, i, j) = sum / ENV(pd, env, j, j);
+        }
+    }
+}
+
+
+// Solves the factored system for 3 interleaved right hand sides in place
+static void solve(struct Pd *pd, double *env, double *x)
+{
+    size_t n = pd->n;
+
+    // L y = b
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t k = pd->first[i]; k < i; ++k)
+        {
+            double l = ENV(pd, env, i, k);
+            x[i * 3] -= l * x[k * 3];
+            x[i * 3 + 1] -= l * x[k * 3 + 1];
+            x[i * 3 + 2] -= l * x[k * 3 + 2];
+        }
+
+        double d = ENV(pd, env, i, i);
+        x[i * 3] /= d;
+        x[i * 3 + 1] /= d;
+        x[i * 3 + 2] /= d;
+    }
+
+    // L^T x = y
+    for (size_t i = n; i-- > 0;)
+    {
+        double d = ENV(pd, env, i, i);
+        x[i * 3] /= d;
+        x[i * 3 + 1] /= d;
+        x[i * 3 + 2] /= d;
+
+        for (size_t k = pd->first[i]; k < i; ++k)
+        {
+            double l = ENV(pd, env, i, k);
+            x[k * 3] -= l * x[i * 3];
+            x[k * 3 + 1] -= l * x[i * 3 + 1];
+            x[k * 3 + 2] -= l * x[i * 3 + 2];
+        }
+    }
+}
+
+
+// solve for a single right hand side, only columns need it
+static void solve_column(struct Pd *pd, double *env, double *x)
+{
+    size_t n = pd->n;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t k = pd->first[i]; k < i; ++k)
+            x[i] -= ENV(pd, env, i, k) * x[k];
+
+        x[i] /= ENV(pd, env, i, i);
+    }
+
+    for (size_t i = n; i-- > 0;)
+    {
+        x[i] /= ENV(pd, env, i, i);
+
+        for (size_t k = pd->first[i]; k < i; ++k)
+            x[k] -= ENV(pd, env, i, k) * x[i];
+    }
+}
+
+
+static void cache_path(uint64_t key, char *out, size_t size)
+{
+    snprintf(out, size, CACHE_DIR "/pd_%016llx.bin", (unsigned long long)key);
+}
+
+
+static bool cache_load(struct Pd *pd, double *env, uint64_t key)
+{
+    char path[64];
+    cache_path(key, path, sizeof(path));
+
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+        return false;
+
+    struct CacheHeader hdr;
+    bool ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              hdr.magic == CACHE_MAGIC && hdr.version == CACHE_VERSION &&
+              hdr.key == key && hdr.n == pd->n && hdr.nenv == pd->nenv &&
+              fread(env, sizeof(double), pd->nenv, fp) == pd->nenv;
+
+    fclose(fp);
+    return ok;
+}
+
+
+static int entry_cmp(const void *a, const void *b)
+{
+    time_t ta = ((const struct CacheEntry*)a)->mtime;
+    time_t tb = ((const struct CacheEntry*)b)->mtime;
+
+    return (ta > tb) - (ta < tb);
+}
+
+
+// Removes the oldest factors past CACHE_FILES
+static void cache_evict(void)
+{
+    DIR *dir = opendir(CACHE_DIR);
+
+    if (!dir)
+        return;
+
+    struct CacheEntry *entries = 0;
+    size_t n = 0, cap = 0;
+    struct dirent *e;
+
+    while ((e = readdir(dir)))
+    {
+        size_t len = strlen(e->d_name);
+
+        if (strncmp(e->d_name, "pd_", 3) != 0 || len < 4 || len >= sizeof(entries->name) ||
+            strcmp(e->d_name + len - 4, ".bin") != 0)
+            continue;
+
+        char path[sizeof(CACHE_DIR) + sizeof(entries->name)];
+        snprintf(path, sizeof(path), CACHE_DIR "/%s", e->d_name);
+
+        struct stat st;
+
+        if (stat(path, &st) != 0)
+            continue;
+
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 32;
+            entries = realloc(entries, sizeof(struct CacheEntry) * cap);
+        }
+
+        strcpy(entries[n].name, e->d_name);
+        entries[n].mtime = st.st_mtime;
+        ++n;
+    }
+
+    closedir(dir);
+
+    if (n > CACHE_FILES)
+    {
+        qsort(entries, n, sizeof(struct CacheEntry), entry_cmp);
+
+        for (size_t i = 0; i < n - CACHE_FILES; ++i)
+        {
+            char path[sizeof(CACHE_DIR) + sizeof(entries->name)];
+            snprintf(path, sizeof(path), CACHE_DIR "/%s", entries[i].name);
+
+            // Another mesh may have removed it first
+            remove(path);
+        }
+    }
+
+    free(entries);
+}
+
+
+static void cache_save(struct Pd *pd, double *env, uint64_t key)
+{
+    mkdir(CACHE_DIR, 0755);
+
+    char path[64], tmp[96];
+    cache_path(key, path, sizeof(path));
+
+    // Meshes stepping in parallel may save the same factor, each writes its
+    // own file and the last rename wins
+    snprintf(tmp, sizeof(tmp), "%s.%llx.tmp", path, (unsigned long long)(uintptr_t)pd);
+
+    FILE *fp = fopen(tmp, "wb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "[cache_save] Couldn't write %s\n", tmp);
+        return;
+    }
+
+    struct CacheHeader hdr = { CACHE_MAGIC, CACHE_VERSION, key, pd->n, pd->nenv };
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(env, sizeof(double), pd->nenv, fp) == pd->nenv;
+
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "[cache_save] Couldn't write %s\n", path);
+        remove(tmp);
+        return;
+    }
+
+    cache_evict();
+}
+
+
+// Factors level into f from the springs the ordering was made for
+static void build(struct Mesh *m, struct Pd *pd, struct PdFactor *f, int level)
+{
+    factor_clear(f);
+
+    f->env = realloc(f->env, sizeof(double) * pd->nenv);
+    f->springs = realloc(f->springs, sizeof(struct Spring) * m->nsprings);
+    memcpy(f->springs, pd->base, sizeof(struct Spring) * m->nsprings);
+
+    // Torn meshes change too often for their factors to be worth keeping
+    uint64_t key = factor_key(m, pd, level);
+
+    if (m->tear || !cache_load(pd, f->env, key))
+    {
+        factor(m, pd, f->env, level_h(level));
+
+        if (!m->tear)
+            cache_save(pd, f->env, key);
+    }
+
+    f->level = level;
+}
+
+
+static void add_column(struct Pd *pd, struct PdFactor *f, unsigned int a, unsigned int b, double c_inv, bool pin)
+{
+    if (f->ncols == f->cols_cap)
+    {
+        f->cols_cap = f->cols_cap ? f->cols_cap * 2 : 16;
+        f->cols = realloc(f->cols, sizeof(struct PdColumn) * f->cols_cap);
+    }
+
+    struct PdColumn *col = &f->cols[f->ncols++];
+    col->a = a;
+    col->b = b;
+    col->c_inv = c_inv;
+    col->pin = pin;
+
+    col->z = util_alloc_aligned(sizeof(double) * pd->n);
+    memset(col->z, 0, sizeof(double) * pd->n);
+
+    col->z[pd->iperm[a]] = 1.;
+    if (b != PD_NONE)
+        col->z[pd->iperm[b]] = -1.;
+
+    solve_column(pd, f->env, col->z);
+
+    f->cap_valid = false;
+}
+
+
+// Spring column on the ends the factor leaves free
+static void add_spring(struct Pd *pd, struct PdFactor *f, const struct Spring *s, double c_inv)
+{
+    unsigned int a = s->a, b = s->b;
+
+    if (pd->pinned[a])
+    {
+        a = b;
+        b = PD_NONE;
+    }
+    else if (pd->pinned[b])
+        b = PD_NONE;
+
+    if (pd->pinned[a])
+        return;
+
+    add_column(pd, f, a, b, c_inv, false);
+    ++f->nspring_cols;
+}
+
+
+// u^T x for w interleaved vectors x in factor order
+static void column_dot(struct Pd *pd, struct PdColumn *col, const double *x, int w, double *out)
+{
+    for (int c = 0; c < w; ++c)
+    {
+        out[c] = x[pd->iperm[col->a] * w + c];
+
+        if (col->b != PD_NONE)
+            out[c] -= x[pd->iperm[col->b] * w + c];
+    }
+}
+
+
+// Brings the columns of f up to date with the springs and pins of the mesh,
+// false if that takes more than PD_MAX_RANK columns or a mass the factor
+// pins was released
+static bool sync(struct Mesh *m, struct Pd *pd, struct PdFactor *f)
+{
+    size_t changed = 0;
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        struct Spring *s = &m->springs[i], *r = &f->springs[i];
+        changed += s->a != r->a || s->b != r->b || s->k != r->k;
+    }
+
+    // Pin columns of masses that are no longer pinned go, marks left at 1
+    // are pinned masses without a column
+    for (size_t i = 0; i < m->nmasses; ++i)
+    {
+        bool pinned = m->inv_mass[i] == 0.f;
+
+        if (pd->pinned[i] && !pinned)
+            return false;
+
+        pd->mark[i] = pinned && !pd->pinned[i];
+    }
+
+    for (size_t i = 0; i < f->ncols;)
+    {
+        struct PdColumn *col = &f->cols[i];
+
+        if (!col->pin || pd->mark[col->a])
+        {
+            if (col->pin)
+                pd->mark[col->a] = 2;
+
+            ++i;
+            continue;
+        }
+
+        free(col->z);
+        *col = f->cols[--f->ncols];
+        f->cap_valid = false;
+    }
+
+    size_t pins = 0;
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+        pins += pd->mark[i] == 1;
+
+    if (f->ncols + changed * 2 + pins > PD_MAX_RANK)
+        return false;
+
+    for (size_t i = 0; changed && i < m->nsprings; ++i)
+    {
+        struct Spring *s = &m->springs[i], *r = &f->springs[i];
+
+        if (s->a == r->a && s->b == r->b && s->k == r->k)
+            continue;
+
+        // The spring as factored comes off, the spring as it is goes on
+        if (r->k > 0.f)
+            add_spring(pd, f, r, -1. / r->k);
+
+        if (s->k > 0.f)
+            add_spring(pd, f, s, 1. / s->k);
+
+        *r = *s;
+    }
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+    {
+        if (pd->mark[i] == 1)
+            add_column(pd, f, i, PD_NONE, 0., true);
+    }
+
+    return true;
+}
+
+
+// LU with partial pivoting of diag(c_inv) + U^T Z
+static void capacitance(struct Pd *pd, struct PdFactor *f)
+{
+    size_t r = f->ncols;
+
+    f->cap = realloc(f->cap, sizeof(double) * (r * r + 1));
+    f->piv = realloc(f->piv, sizeof(int) * (r + 1));
+    pd->t = realloc(pd->t, sizeof(double) * 3 * (r + 1));
+
+    double *a = f->cap;
+
+    for (size_t i = 0; i < r; ++i)
+    {
+        for (size_t j = 0; j < r; ++j)
+            column_dot(pd, &f->cols[i], f->cols[j].z, 1, &a[i * r + j]);
+
+        a[i * r + i] += f->cols[i].c_inv;
+    }
+
+    for (size_t k = 0; k < r; ++k)
+    {
+        size_t p = k;
+
+        for (size_t i = k + 1; i < r; ++i)
+        {
+            if (fabs(a[i * r + k]) > fabs(a[p * r + k]))
+                p = i;
+        }
+
+        f->piv[k] = p;
+
+        if (p != k)
+        {
+            for (size_t j = 0; j < r; ++j)
+            {
+                double t = a[k * r + j];
+                a[k * r + j] = a[p * r + j];
+                a[p * r + j] = t;
+            }
+        }
+
+        for (size_t i = k + 1; i < r; ++i)
+        {
+            a[i * r + k] /= a[k * r + k];
+
+            for (size_t j = k + 1; j < r; ++j)
+                a[i * r + j] -= a[i * r + k] * a[k * r + j];
+        }
+    }
+
+    f->cap_valid = true;
+}
+
+
+// Factor to step h with, one whose level serves h if there is one,
+// otherwise the least recently used slot and the level to build in it
+static struct PdFactor *pick(struct Pd *pd, float h, int *level)
+{
+    struct PdFactor *best = 0;
+
+    for (int i = 0; i < PD_FACTORS; ++i)
+    {
+        struct PdFactor *f = &pd->factors[i];
+
+        if (f->level < 0)
+            continue;
+
+        float hl = level_h(f->level);
+
+        if (hl <= h && h < PD_SLACK * hl && (!best || f->level < best->level))
+            best = f;
+    }
+
+    if (best)
+    {
+        *level = best->level;
+        return best;
+    }
+
+    *level = level_for(h);
+
+    struct PdFactor *lru = &pd->factors[0];
+
+    for (int i = 0; i < PD_FACTORS; ++i)
+    {
+        struct PdFactor *f = &pd->factors[i];
+
+        if (f->level == *level)
+            return f;
+
+        if (lru->level >= 0 && (f->level < 0 || f->used < lru->used))
+            lru = f;
+    }
+
+    return lru;
+}
+
+
+static struct PdFactor *prepare(struct Mesh *m, struct Pd *pd, float h)
+{
+    int level;
+    struct PdFactor *f = pick(pd, h, &level);
+
+    if (!pd->ordered)
+        order(m, pd);
+
+    if (f->level != level)
+        build(m, pd, f, level);
+
+    // Too much has torn since the ordering was made
+    if (!sync(m, pd, f))
+    {
+        order(m, pd);
+        build(m, pd, f, level);
+        sync(m, pd, f);
+    }
+
+    if (!f->cap_valid)
+        capacitance(pd, f);
+
+    f->used = ++pd->steps;
+
+    return f;
+}
+
+
+// x = z - Z S^-1 (U^T z - p) with z the factored solve, p the pinned
+// positions for pin columns and 0 for springs
+static void global_solve(struct Mesh *m, struct Pd *pd, struct PdFactor *f)
+{
+    double *x = pd->rhs;
+    size_t r = f->ncols;
+
+    solve(pd, f->env, x);
+
+    if (!r)
+        return;
+
+    double *t = pd->t;
+
+    for (size_t i = 0; i < r; ++i)
+    {
+        struct PdColumn *col = &f->cols[i];
+        column_dot(pd, col, x, 3, &t[i * 3]);
+
+        if (col->pin)
+        {
+            for (int c = 0; c < 3; ++c)
+                t[i * 3 + c] -= pd->inertia[col->a][c];
+        }
+    }
+
+    // S y = t, forward with the row swaps then back
+    for (size_t k = 0; k < r; ++k)
+    {
+        size_t p = f->piv[k];
+
+        if (p != k)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                double tmp = t[k * 3 + c];
+                t[k * 3 + c] = t[p * 3 + c];
+                t[p * 3 + c] = tmp;
+            }
+        }
+
+        for (size_t i = k + 1; i < r; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+                t[i * 3 + c] -= f->cap[i * r + k] * t[k * 3 + c];
+        }
+    }
+
+    for (size_t k = r; k-- > 0;)
+    {
+        for (size_t j = k + 1; j < r; ++j)
+        {
+            for (int c = 0; c < 3; ++c)
+                t[k * 3 + c] -= f->cap[k * r + j] * t[j * 3 + c];
+        }
+
+        for (int c = 0; c < 3; ++c)
+            t[k * 3 + c] /= f->cap[k * r + k];
+    }
+
+    for (size_t j = 0; j < r; ++j)
+    {
+        const double *z = f->cols[j].z;
+
+        for (size_t i = 0; i < pd->n; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+                x[i * 3 + c] -= z[i] * t[j * 3 + c];
+        }
+    }
+}
+
+
+static void local_job(void *arg, size_t begin, size_t end)
+{
+    struct LocalJob *j = arg;
+    struct Mesh *m = j->m;
+    struct Pd *pd = m->pd;
+
+    for (size_t i = j->first + begin; i < j->first + end; ++i)
+    {
+        struct Spring *s = &m->springs[i];
+
+        // Broken, and its ends may sit on top of each other
+        if (s->k == 0.f)
+            continue;
+
+        vec3 p;
+        glm_vec3_sub(m->pos[s->a], m->pos[s->b], p);
+        glm_vec3_scale(p, s->k * s->eq_len / glm_vec3_norm(p), p);
+
+        double *ra = &pd->rhs[pd->iperm[s->a] * 3];
+        double *rb = &pd->rhs[pd->iperm[s->b] * 3];
+
+        // A mass the factor pins adds L_ab x_b to the other end, its own
+        // row is set afterwards
+        float ka = pd->pinned[s->a] ? s->k : 0.f;
+        float kb = pd->pinned[s->b] ? s->k : 0.f;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            ra[c] += p[c] + kb * pd->inertia[s->b][c];
+            rb[c] -= p[c] - ka * pd->inertia[s->a][c];
+        }
+    }
+}
+
+
+void pd_step(struct Mesh *m, float dt)
+{
+    struct Pd *pd = m->pd;
+    size_t n = m->nmasses;
+    float h = dt;
+
+    struct PdFactor *f = prepare(m, pd, h);
+
+    // Inertia weight of the factor, its pinned rows hold exactly this
+    float hl = level_h(f->level);
+    float wl = m->mass / (hl * hl);
+    double wp = m->mass / ((double)hl * hl);
+
+    memcpy(pd->prev, m->pos, sizeof(vec3) * n);
+
+    // y = x + h v + h^2 g
+    for (size_t i = 0; i < n; ++i)
+    {
+        float unpinned = m->inv_mass[i] > 0.f;
+
+        glm_vec3_muladds(m->vel[i], h * unpinned, m->pos[i]);
+        m->pos[i][1] += GRAVITY * h * h * unpinned;
+    }
+
+    memcpy(pd->inertia, m->pos, sizeof(vec3) * n);
+    memcpy(pd->last, m->pos, sizeof(vec3) * n);
+
+    float omega = 1.f;
+
+    for (int it = 0; it < pd->iters; ++it)
+    {
+        memset(pd->rhs, 0, sizeof(double) * 3 * pd->n);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            double *r = &pd->rhs[pd->iperm[i] * 3];
+
+            // Pinned rows are held by the factor or their columns, any
+            // weight does
+            float w = m->inv_mass[i] > 0.f ? 1.f / (m->inv_mass[i] * h * h) : m->mass / (h * h);
+
+            // M / h^2 y, less what the factor's M / h_l^2 x gets wrong
+            for (int c = 0; c < 3; ++c)
+                r[c] = w * pd->inertia[i][c] - (w - wl) * m->pos[i][c];
+        }
+
+        // Springs of one color write disjoint rows
+        for (size_t c = 0; c < m->ncolors; ++c)
+        {
+            struct LocalJob j = { m, m->colors[c] };
+            pool_for(pool_global(), m->colors[c + 1] - m->colors[c], SPRING_GRAIN, local_job, &j);
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!pd->pinned[i])
+                continue;
+
+            double *r = &pd->rhs[pd->iperm[i] * 3];
+
+            for (int c = 0; c < 3; ++c)
+                r[c] = wp * pd->inertia[i][c];
+        }
+
+        global_solve(m, pd, f);
+
+        if (pd->rho > 0.f)
+        {
+            if (it == 1)
+                omega = 2.f / (2.f - pd->rho * pd->rho);
+            else if (it > 1)
+                omega = 4.f / (4.f - pd->rho * pd->rho * omega);
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            double *r = &pd->rhs[pd->iperm[i] * 3];
+
+            // x_k+1 = w (x^ - x_k-1) + x_k-1
+            for (int c = 0; c < 3; ++c)
+            {
+                float x = omega * ((float)r[c] - pd->last[i][c]) + pd->last[i][c];
+                pd->last[i][c] = m->pos[i][c];
+                m->pos[i][c] = x;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        float unpinned = m->inv_mass[i] > 0.f;
+
+        vec3 v;
+        glm_vec3_sub(m->pos[i], pd->prev[i], v);
+        glm_vec3_scale(v, unpinned / h, v);
+
+        // Pinned masses keep the velocity their target gave them
+        glm_vec3_scale(m->vel[i], 1.f - unpinned, m->vel[i]);
+        glm_vec3_add(m->vel[i], v, m->vel[i]);
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef PD_H
+#define PD_H
+
+#include <cglm/cglm.h>
+#include <stdint.h>
+
+// Factors kept at once, substep counts tend to alternate between two levels
+#define PD_FACTORS 2
+
+struct Mesh;
+struct Spring;
+
+// Column of a low-rank update to a factored system, u = e_a - e_b with
+// stiffness 1 / c_inv, or u = e_a alone with b = PD_NONE. That is a spring
+// to a mass the factor pins, or a pin with c_inv = 0, which holds its mass
+// in place exactly.
+struct PdColumn
+{
+    unsigned int a, b;
+    double c_inv;
+    bool pin;
+
+    // The factored system solved for u, in factor order
+    double *z;
+};
+
+// M / h^2 + L for one step size with the pins and springs as of the
+// ordering. Pinned masses are decoupled rows of M / h^2 alone. Pins and
+// springs that changed since are low-rank columns on top, see struct Pd.
+struct PdFactor
+{
+    // Index of the step size, -1 for an empty slot
+    int level;
+    double *env;
+
+    // Endpoints and stiffness of every spring as the factor and its
+    // columns see them
+    struct Spring *springs;
+
+    struct PdColumn *cols;
+    size_t ncols, cols_cap;
+    // Columns that are springs, the rest are pins
+    size_t nspring_cols;
+
+    // LU of diag(c_inv) + U^T Z with row pivots, rebuilt when the columns
+    // change
+    double *cap;
+    int *piv;
+    bool cap_valid;
+
+    // Step of the last use, the oldest slot is refactored first
+    uint64_t used;
+};
+
+// Projective dynamics. The local step projects every spring to its rest
+// length in parallel, the global step solves
+// (M / h^2 + L) x = M / h^2 y + J p through a prefactored Cholesky factor.
+//
+// Factors only depend on topology, stiffness and pins. Step sizes snap down
+// to a level h_k = PD_H_MAX / 2^k, and the difference (M / h^2 - M / h_k^2) x
+// moves to the right hand side using the previous iterate. New pins and
+// torn or broken springs are added to the factor with the Woodbury identity
+// instead of refactoring, until there are more than PD_MAX_RANK columns or
+// a mass pinned in the factor is released.
+struct Pd
+{
+    // Rows of every factor, Mesh::mass_cap so that tearing never adds any
+    size_t n;
+
+    // Reverse Cuthill-McKee order, perm[new] = old and iperm[old] = new
+    unsigned int *perm, *iperm;
+
+    // Lower envelope shared by every factor, row i holds columns
+    // first[i]..i starting at env[start[i]]
+    unsigned int *first;
+    size_t *start;
+    size_t nenv;
+    bool ordered;
+    // Springs and pins as of the ordering, every factor starts from these.
+    // Springs to a pinned mass pull on the other end through the right
+    // hand side.
+    struct Spring *base;
+    bool *pinned;
+
+    struct PdFactor factors[PD_FACTORS];
+    uint64_t steps;
+
+    vec3 *prev, *inertia, *last;
+    double *rhs;
+    // Right hand sides of the capacitance system, 3 per column
+    double *t;
+    // Per mass scratch of sync
+    unsigned char *mark;
+
+    int iters;
+
+    // Chebyshev spectral radius estimate, 0 disables the acceleration
+    float rho;
+};
+
+struct Pd *pd_alloc(struct Mesh *m);
+void pd_free(struct Pd *pd);
+
+void pd_step(struct Mesh *m, float dt);
+
+#endif
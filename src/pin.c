@@ -0,0 +1,112 @@
+#include "pin.h"
+#include "mesh.h"
+#include <stdlib.h>
+
+
+static void remove_target(struct Mesh *m, size_t i)
+{
+    for (size_t j = 0; j < m->npins; ++j)
+    {
+        if (m->pins[j].i == i)
+        {
+            m->pins[j] = m->pins[--m->npins];
+            return;
+        }
+    }
+}
+
+
+void mesh_pin(struct Mesh *m, size_t i, bool pin)
+{
+    m->forces_changed = true;
+
+    if (pin)
+    {
+        m->inv_mass[i] = 0.f;
+        glm_vec3_zero(m->vel[i]);
+    }
+    else
+    {
+        if (m->npins)
+            remove_target(m, i);
+
+        m->inv_mass[i] = 1.f / m->mass;
+    }
+}
+
+
+bool mesh_pinned(struct Mesh *m, size_t i)
+{
+    return m->inv_mass[i] == 0.f;
+}
+
+
+void mesh_pin_range(struct Mesh *m, size_t begin, size_t end, bool pin)
+{
+    for (size_t i = begin; i < end; ++i)
+        mesh_pin(m, i, pin);
+}
+
+
+void mesh_pin_set(struct Mesh *m, size_t *idx, size_t n, bool pin)
+{
+    for (size_t i = 0; i < n; ++i)
+        mesh_pin(m, idx[i], pin);
+}
+
+
+void mesh_pin_row(struct Mesh *m, int row, bool pin)
+{
+    for (int z = 0; z < m->size; ++z)
+    {
+        size_t i = mesh_grid_mass(m, row, z);
+
+        if (i != MESH_NO_MASS)
+            mesh_pin(m, i, pin);
+    }
+}
+
+
+void mesh_pin_col(struct Mesh *m, int col, bool pin)
+{
+    for (int y = 0; y < m->size; ++y)
+    {
+        size_t i = mesh_grid_mass(m, y, col);
+
+        if (i != MESH_NO_MASS)
+            mesh_pin(m, i, pin);
+    }
+}
+
+
+void mesh_pin_target(struct Mesh *m, size_t i, PinTarget target, void *user)
+{
+    remove_target(m, i);
+    mesh_pin(m, i, true);
+
+    m->pins = realloc(m->pins, sizeof(struct Pin) * ++m->npins);
+
+    struct Pin *p = &m->pins[m->npins - 1];
+    p->i = i;
+    glm_vec3_copy(m->pos[i], p->origin);
+    p->target = target;
+    p->user = user;
+}
+
+
+void mesh_update_pins(struct Mesh *m, float dt)
+{
+    for (size_t j = 0; j < m->npins; ++j)
+    {
+        struct Pin *p = &m->pins[j];
+
+        vec3 target;
+        p->target(p->i, m->time, p->origin, target, p->user);
+
+        // Springs and colliders see the pin moving at this velocity
+        glm_vec3_sub(target, m->pos[p->i], m->vel[p->i]);
+        glm_vec3_divs(m->vel[p->i], dt, m->vel[p->i]);
+
+        glm_vec3_copy(target, m->pos[p->i]);
+    }
+}
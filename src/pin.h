@@ -0,0 +1,40 @@
+#ifndef PIN_H
+#define PIN_H
+
+#include <cglm/cglm.h>
+
+struct Mesh;
+
+// Writes the position of pinned mass i at time t, origin is where the mass
+// was when the target was attached
+typedef void (*PinTarget)(size_t i, float t, vec3 origin, vec3 out, void *user);
+
+// Kinematic pin, the mass follows target instead of staying in place
+struct Pin
+{
+    size_t i;
+    vec3 origin;
+
+    PinTarget target;
+    void *user;
+};
+
+// Pinned masses have inv_mass 0, so the integrator leaves them where they
+// are without having to look them up
+void mesh_pin(struct Mesh *m, size_t i, bool pin);
+bool mesh_pinned(struct Mesh *m, size_t i);
+
+void mesh_pin_range(struct Mesh *m, size_t begin, size_t end, bool pin);
+void mesh_pin_set(struct Mesh *m, size_t *idx, size_t n, bool pin);
+
+// Grid meshes only
+void mesh_pin_row(struct Mesh *m, int row, bool pin);
+void mesh_pin_col(struct Mesh *m, int col, bool pin);
+
+// Pins i and drives it along target, replacing any previous target
+void mesh_pin_target(struct Mesh *m, size_t i, PinTarget target, void *user);
+
+// Moves kinematic pins to their targets at m->time
+void mesh_update_pins(struct Mesh *m, float dt);
+
+#endif
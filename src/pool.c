@@ -0,0 +1,174 @@
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static _Thread_local bool g_in_pool = false;
+
+static struct Pool *g_pool = 0;
+static pthread_once_t g_pool_once = PTHREAD_ONCE_INIT;
+
+
+static void run_chunks(struct Pool *p)
+{
+    size_t nchunks = (p->n + p->grain - 1) / p->grain;
+
+    for (;;)
+    {
+        size_t c = atomic_fetch_add(&p->next, 1);
+
+        if (c >= nchunks)
+            break;
+
+        size_t begin = c * p->grain;
+        size_t end = begin + p->grain < p->n ? begin + p->grain : p->n;
+        p->fn(p->arg, begin, end);
+    }
+}
+
+
+static void *worker(void *arg)
+{
+    struct Pool *p = arg;
+    g_in_pool = true;
+
+    size_t seen = 0;
+
+    pthread_mutex_lock(&p->mtx);
+
+    for (;;)
+    {
+        while (p->generation == seen && !p->quit)
+            pthread_cond_wait(&p->work, &p->mtx);
+
+        if (p->quit)
+            break;
+
+        seen = p->generation;
+        pthread_mutex_unlock(&p->mtx);
+
+        run_chunks(p);
+
+        pthread_mutex_lock(&p->mtx);
+
+        if (--p->active == 0)
+            pthread_cond_signal(&p->done);
+    }
+
+    pthread_mutex_unlock(&p->mtx);
+    return 0;
+}
+
+
+struct Pool *pool_alloc(size_t nthreads)
+{
+    struct Pool *p = malloc(sizeof(struct Pool));
+    p->threads = malloc(sizeof(pthread_t) * (nthreads ? nthreads : 1));
+    p->nthreads = nthreads;
+
+    pthread_mutex_init(&p->job, 0);
+    pthread_mutex_init(&p->mtx, 0);
+    pthread_cond_init(&p->work, 0);
+    pthread_cond_init(&p->done, 0);
+
+    p->fn = 0;
+    p->arg = 0;
+    p->n = 0;
+    p->grain = 1;
+    atomic_init(&p->next, 0);
+    p->generation = 0;
+    p->active = 0;
+    p->quit = false;
+
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        if (pthread_create(&p->threads[i], 0, worker, p) != 0)
+        {
+            fprintf(stderr, "[pool_alloc] Failed to create worker thread %zu.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return p;
+}
+
+
+void pool_free(struct Pool *p)
+{
+    pthread_mutex_lock(&p->mtx);
+    p->quit = true;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->mtx);
+
+    for (size_t i = 0; i < p->nthreads; ++i)
+        pthread_join(p->threads[i], 0);
+
+    pthread_mutex_destroy(&p->job);
+    pthread_mutex_destroy(&p->mtx);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->done);
+
+    free(p->threads);
+    free(p);
+}
+
+
+void pool_for(struct Pool *p, size_t n, size_t grain, PoolFn fn, void *arg)
+{
+    if (n == 0)
+        return;
+
+    if (grain == 0)
+        grain = 1;
+
+    if (g_in_pool || p->nthreads == 0 || n <= grain)
+    {
+        fn(arg, 0, n);
+        return;
+    }
+
+    pthread_mutex_lock(&p->job);
+
+    pthread_mutex_lock(&p->mtx);
+    p->fn = fn;
+    p->arg = arg;
+    p->n = n;
+    p->grain = grain;
+    atomic_store(&p->next, 0);
+    p->active = p->nthreads;
+    ++p->generation;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->mtx);
+
+    g_in_pool = true;
+    run_chunks(p);
+    g_in_pool = false;
+
+    pthread_mutex_lock(&p->mtx);
+
+    while (p->active)
+        pthread_cond_wait(&p->done, &p->mtx);
+
+    pthread_mutex_unlock(&p->mtx);
+
+    pthread_mutex_unlock(&p->job);
+}
+
+
+static void global_init(void)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *env = getenv("CLOTH_THREADS");
+
+    if (env)
+        ncpus = atol(env);
+
+    g_pool = pool_alloc(ncpus > 1 ? ncpus - 1 : 0);
+}
+
+
+struct Pool *pool_global(void)
+{
+    pthread_once(&g_pool_once, global_init);
+    return g_pool;
+}
@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Processes the index range [begin, end)
+typedef void (*PoolFn)(void *arg, size_t begin, size_t end);
+
+struct Pool
+{
+    pthread_t *threads;
+    size_t nthreads;
+
+    // Serializes pool_for calls made from different threads
+    pthread_mutex_t job;
+
+    pthread_mutex_t mtx;
+    pthread_cond_t work, done;
+
+    PoolFn fn;
+    void *arg;
+    size_t n, grain;
+
+    atomic_size_t next;
+    size_t generation;
+    size_t active;
+    bool quit;
+};
+
+// nthreads workers in addition to the calling thread
+struct Pool *pool_alloc(size_t nthreads);
+void pool_free(struct Pool *p);
+
+// Runs fn over [0, n) in chunks of grain and returns once all of them are
+// done. Calls made from inside a pool job run inline on the calling thread.
+void pool_for(struct Pool *p, size_t n, size_t grain, PoolFn fn, void *arg);
+
+// Shared pool sized to the online cpus, or to CLOTH_THREADS if set
+struct Pool *pool_global(void);
+
+#endif
@@ -1,8 +1,14 @@
 #include "prog.h"
 #include "mesh.h"
+#include "sim.h"
 #include "util.h"
 #include <stb/stb_image.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define PROG_CLOTHS 2
+
+static size_t held[] = { 35, 1022 };
 
 
 struct Prog *prog_alloc(GLFWwindow *win)
@@ -14,9 +20,20 @@ struct Prog *prog_alloc(GLFWwindow *win)
 
     p->ri = ri_alloc();
     ri_add_shader(p->ri, "shaders/basic_v.glsl", "shaders/basic_f.glsl");
+    ri_add_shader(p->ri, "shaders/gpu_norm_v.glsl", "shaders/basic_f.glsl");
 
     p->ri->cam = p->cam;
 
+    p->sim = 0;
+    p->released = false;
+    p->self_collision = false;
+
+    p->pending = 0;
+    p->npending = p->pending_cap = 0;
+
+    glfwSetWindowUserPointer(win, p);
+    glfwSetKeyCallback(win, prog_key);
+
     return p;
 }
 
@@ -24,10 +41,43 @@ struct Prog *prog_alloc(GLFWwindow *win)
 void prog_free(struct Prog *p)
 {
     cam_free(p->cam);
+    free(p->pending);
     free(p);
 }
 
 
+// Hands pending commands to the sim until its queue fills up, keeping the
+// rest for the next frame
+static void flush_cmds(struct Prog *p)
+{
+    if (!p->npending)
+        return;
+
+    size_t sent = 0;
+
+    while (sent < p->npending && sim_send(p->sim, p->pending[sent]))
+        ++sent;
+
+    memmove(p->pending, p->pending + sent, sizeof(struct SimCmd) * (p->npending - sent));
+    p->npending -= sent;
+}
+
+
+// Queues cmd behind any pending commands, so they reach the sim in the
+// order the keys were pressed
+static void send_cmd(struct Prog *p, struct SimCmd cmd)
+{
+    if (p->npending == p->pending_cap)
+    {
+        p->pending_cap = p->pending_cap ? p->pending_cap * 2 : 16;
+        p->pending = realloc(p->pending, sizeof(struct SimCmd) * p->pending_cap);
+    }
+
+    p->pending[p->npending++] = cmd;
+    flush_cmds(p);
+}
+
+
 void prog_mainloop(struct Prog *p)
 {
     glEnable(GL_DEPTH_TEST);
@@ -39,14 +89,52 @@ void prog_mainloop(struct Prog *p)
     double prev_mx, prev_my;
     glfwGetCursorPos(p->win, &prev_mx, &prev_my);
 
-    struct Mesh *mesh = mesh_alloc(50, 1.f);
+    // CLOTH_NORMALS=gpu uploads positions only and shades from a buffer
+    // texture
+    const char *normals = getenv("CLOTH_NORMALS");
+    bool gpu_normals = normals && strcmp(normals, "gpu") == 0;
 
-    size_t held[] = { 35, 1022 };
+    // CLOTH_TEAR=<strain> lets springs break once stretched that far past
+    // their rest length
+    const char *tear = getenv("CLOTH_TEAR");
 
-    while (!glfwWindowShouldClose(p->win))
+    // Two cloths hung one behind the other, they pile onto each other when
+    // released
+    struct Scene *scene = scene_alloc(.2f);
+
+    for (size_t i = 0; i < PROG_CLOTHS; ++i)
     {
-        float dt = .01f;
+        struct Mesh *mesh = mesh_alloc(50, 1.f);
+        mesh_pin_set(mesh, held, sizeof(held) / sizeof(size_t), true);
 
+        // Floor for the cloth to land on once released
+        mesh_add_collider(mesh, collider_plane((vec3){ 0.f, -60.f, 0.f }, (vec3){ 0.f, 1.f, 0.f }));
+
+        if (tear)
+            mesh_set_tearing(mesh, atof(tear), mesh->nmasses * 2);
+        else if (gpu_normals)
+            mesh_set_normal_mode(mesh, NORMALS_GPU);
+
+        mat4 t;
+        glm_translate_make(t, (vec3){ 0.f, -10.f * i, 5.f * i });
+        scene_add(scene, mesh, t);
+    }
+
+    // CLOTH_WIND=<path> blows a field saved by wind_save through the scene,
+    // CLOTH_WIND=gusts a tiled curl noise breeze along x
+    const char *wind = getenv("CLOTH_WIND");
+
+    if (wind && strcmp(wind, "gusts") == 0)
+        scene_set_wind(scene, wind_curl_noise((int[]){ 16, 16, 16 }, 8.f, 4, (vec3){ 30.f, 0.f, 0.f }, 30.f, 1));
+    else if (wind)
+        scene_set_wind(scene, wind_load(wind));
+
+    // The simulation steps on its own thread from here on, frames are
+    // picked up as they finish
+    p->sim = sim_alloc(scene);
+
+    while (!glfwWindowShouldClose(p->win))
+    {
         double mx, my;
         glfwGetCursorPos(p->win, &mx, &my);
 
@@ -55,22 +143,31 @@ void prog_mainloop(struct Prog *p)
         prev_my = my;
 
         prog_events(p);
+        flush_cmds(p);
 
-        mesh_update(mesh, dt, held, sizeof(held) / sizeof(size_t));
+        void *frame = sim_acquire(p->sim);
+
+        if (frame)
+            scene_upload_frame(scene, frame);
 
         glClearColor(0.f, 0.f, 0.f, 1.f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        ri_use_shader(p->ri, SHADER_BASIC);
-
-        cam_set_props(p->cam, p->ri->shader);
         cam_view_mat(p->cam, p->ri->view);
 
-        shader_mat4(p->ri->shader, "view", p->ri->view);
-        shader_mat4(p->ri->shader, "projection", p->ri->proj);
+        // Every mesh draws with the shader of its own normal mode, torn
+        // cloths fall back to CPU normals
+        for (size_t i = 0; i < p->ri->nshaders; ++i)
+        {
+            ri_use_shader(p->ri, i);
+            cam_set_props(p->cam, p->ri->shader);
+
+            shader_mat4(p->ri->shader, "view", p->ri->view);
+            shader_mat4(p->ri->shader, "projection", p->ri->proj);
+        }
 
         /* glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); */
-        mesh_render(mesh, p->ri);
+        scene_render(scene, p->ri);
         /* glBindVertexArray(vao); */
         /* glDrawArrays(GL_TRIANGLES, 0, 3); */
         /* glBindVertexArray(0); */
@@ -79,7 +176,11 @@ void prog_mainloop(struct Prog *p)
         glfwPollEvents();
     }
 
-    mesh_free(mesh);
+    sim_free(p->sim);
+    p->sim = 0;
+    p->npending = 0;
+
+    scene_free(scene);
 }
 
 
@@ -119,3 +220,44 @@ void prog_events(struct Prog *p)
     if (glfwGetKey(p->win, GLFW_KEY_SPACE) == GLFW_PRESS) p->cam->pos[1] += move;
 }
 
+
+
+void prog_key(GLFWwindow *win, int key, int scancode, int action, int mods)
+{
+    struct Prog *p = glfwGetWindowUserPointer(win);
+
+    if (!p->sim || action != GLFW_PRESS)
+        return;
+
+    switch (key)
+    {
+    case GLFW_KEY_R:
+        // Drop the cloth, or pick it back up
+        p->released = !p->released;
+
+        for (size_t m = 0; m < PROG_CLOTHS; ++m)
+        {
+            for (size_t i = 0; i < sizeof(held) / sizeof(size_t); ++i)
+                send_cmd(p, (struct SimCmd){ .type = p->released ? SIM_UNPIN : SIM_PIN, .i = held[i], .mesh = m });
+        }
+        break;
+    case GLFW_KEY_LEFT_BRACKET:
+        for (size_t m = 0; m < PROG_CLOTHS; ++m)
+            send_cmd(p, (struct SimCmd){ .type = SIM_SCALE_STIFFNESS, .value = .8f, .mesh = m });
+        break;
+    case GLFW_KEY_RIGHT_BRACKET:
+        for (size_t m = 0; m < PROG_CLOTHS; ++m)
+            send_cmd(p, (struct SimCmd){ .type = SIM_SCALE_STIFFNESS, .value = 1.25f, .mesh = m });
+        break;
+    case GLFW_KEY_P:
+        send_cmd(p, (struct SimCmd){ .type = SIM_TOGGLE_PAUSE });
+        break;
+    case GLFW_KEY_C:
+        // A fifth of the rest length of the cloth made in prog_mainloop
+        p->self_collision = !p->self_collision;
+
+        for (size_t m = 0; m < PROG_CLOTHS; ++m)
+            send_cmd(p, (struct SimCmd){ .type = SIM_SELF_COLLISION, .value = p->self_collision ? .2f : 0.f, .mesh = m });
+        break;
+    }
+}
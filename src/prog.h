@@ -12,6 +12,16 @@ struct Prog
     RenderInfo *ri;
 
     struct Camera *cam;
+
+    // Only set while prog_mainloop runs
+    struct Sim *sim;
+    bool released;
+    bool self_collision;
+
+    // Commands turned away by a full sim queue, resent in order every frame
+    // so that released and self_collision always end up matching the sim
+    struct SimCmd *pending;
+    size_t npending, pending_cap;
 };
 
 struct Prog *prog_alloc(GLFWwindow *win);
@@ -20,6 +30,7 @@ void prog_free(struct Prog *p);
 void prog_mainloop(struct Prog *p);
 
 void prog_events(struct Prog *p);
+void prog_key(GLFWwindow *win, int key, int scancode, int action, int mods);
 
 #endif
 
@@ -0,0 +1,54 @@
+#include "queue.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+struct Queue *queue_alloc(size_t size, size_t cap)
+{
+    struct Queue *q = malloc(sizeof(struct Queue));
+    q->items = malloc(size * cap);
+    q->size = size;
+    q->cap = cap;
+
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+
+    return q;
+}
+
+
+void queue_free(struct Queue *q)
+{
+    free(q->items);
+    free(q);
+}
+
+
+bool queue_push(struct Queue *q, const void *item)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (tail - head == q->cap)
+        return false;
+
+    memcpy(q->items + (tail & (q->cap - 1)) * q->size, item, q->size);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+
+bool queue_pop(struct Queue *q, void *item)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+
+    memcpy(item, q->items + (head & (q->cap - 1)) * q->size, q->size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return true;
+}
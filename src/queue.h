@@ -0,0 +1,25 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lock-free ring of fixed size items for one producer and one consumer
+struct Queue
+{
+    unsigned char *items;
+    size_t size, cap;
+
+    atomic_size_t head, tail;
+};
+
+// cap must be a power of two
+struct Queue *queue_alloc(size_t size, size_t cap);
+void queue_free(struct Queue *q);
+
+// Both return false instead of blocking
+bool queue_push(struct Queue *q, const void *item);
+bool queue_pop(struct Queue *q, void *item);
+
+#endif
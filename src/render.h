@@ -6,7 +6,9 @@
 
 enum
 {
-    SHADER_BASIC
+    SHADER_BASIC,
+    // Derives normals from a position buffer texture, see NORMALS_GPU
+    SHADER_GPU_NORM
 };
 
 typedef struct
@@ -0,0 +1,519 @@
+#include "scene.h"
+#include "geom.h"
+#include "pool.h"
+#include <stdlib.h>
+
+// Triangles of a pair are split into this many contact lists, resolving
+// them in list order keeps the result independent of the thread count
+#define SCENE_CHUNKS 64
+// Fraction of the missing distance recovered per step
+#define SCENE_PUSH .5f
+#define MAX_CELLS 27
+
+struct StepJob
+{
+    struct Scene *s;
+    float dt;
+};
+
+// Vertices of p against triangles of q inside [lo, hi]
+struct PairJob
+{
+    struct Scene *s;
+    struct SceneBody *p, *q;
+    vec3 lo, hi;
+};
+
+
+struct Scene *scene_alloc(float thickness)
+{
+    struct Scene *s = malloc(sizeof(struct Scene));
+    s->bodies = 0;
+    s->nbodies = 0;
+    s->cap = 0;
+    s->order = 0;
+
+    s->pairs = 0;
+    s->npairs = 0;
+    s->pairs_cap = 0;
+
+    s->thickness = thickness;
+    s->wind = 0;
+
+    s->lists = malloc(sizeof(struct ContactList) * SCENE_CHUNKS);
+
+    for (size_t i = 0; i < SCENE_CHUNKS; ++i)
+    {
+        s->lists[i].contacts = 0;
+        s->lists[i].n = 0;
+        s->lists[i].cap = 0;
+    }
+
+    s->ncontacts = 0;
+
+    return s;
+}
+
+
+void scene_free(struct Scene *s)
+{
+    for (size_t i = 0; i < s->nbodies; ++i)
+    {
+        mesh_free(s->bodies[i].mesh);
+
+        if (s->bodies[i].grid)
+            hashgrid_free(s->bodies[i].grid);
+    }
+
+    for (size_t i = 0; i < SCENE_CHUNKS; ++i)
+        free(s->lists[i].contacts);
+
+    if (s->wind)
+        wind_free(s->wind);
+
+    free(s->lists);
+    free(s->pairs);
+    free(s->order);
+    free(s->bodies);
+    free(s);
+}
+
+
+size_t scene_add(struct Scene *s, struct Mesh *m, mat4 t)
+{
+    if (s->nbodies == s->cap)
+    {
+        s->cap = s->cap ? s->cap * 2 : 8;
+        s->bodies = realloc(s->bodies, sizeof(struct SceneBody) * s->cap);
+        s->order = realloc(s->order, sizeof(size_t) * s->cap);
+    }
+
+    mesh_transform(m, t);
+
+    struct SceneBody *b = &s->bodies[s->nbodies];
+    b->mesh = m;
+    b->paired = false;
+    b->grid = 0;
+    b->max_edge = 0.f;
+    mesh_bounds(m, b->lo, b->hi);
+
+    m->aero.field = s->wind;
+
+    s->order[s->nbodies] = s->nbodies;
+
+    return s->nbodies++;
+}
+
+
+void scene_set_wind(struct Scene *s, struct Wind *w)
+{
+    if (s->wind)
+        wind_free(s->wind);
+
+    s->wind = w;
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+        s->bodies[i].mesh->aero.field = w;
+}
+
+
+static void step_job(void *arg, size_t begin, size_t end)
+{
+    struct StepJob *j = arg;
+
+    for (size_t i = begin; i < end; ++i)
+        mesh_step(j->s->bodies[i].mesh, j->dt);
+}
+
+
+static void push_pair(struct Scene *s, size_t a, size_t b)
+{
+    if (s->npairs == s->pairs_cap)
+    {
+        s->pairs_cap = s->pairs_cap ? s->pairs_cap * 2 : 16;
+        s->pairs = realloc(s->pairs, sizeof(size_t) * 2 * s->pairs_cap);
+    }
+
+    s->pairs[s->npairs * 2] = a < b ? a : b;
+    s->pairs[s->npairs * 2 + 1] = a < b ? b : a;
+    ++s->npairs;
+}
+
+
+static void broadphase(struct Scene *s)
+{
+    float pad = s->thickness * .5f;
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+    {
+        struct SceneBody *b = &s->bodies[i];
+        mesh_bounds(b->mesh, b->lo, b->hi);
+        glm_vec3_subs(b->lo, pad, b->lo);
+        glm_vec3_adds(b->hi, pad, b->hi);
+    }
+
+    // Bodies move little between steps, so the order is almost sorted
+    for (size_t i = 1; i < s->nbodies; ++i)
+    {
+        size_t k = s->order[i];
+        size_t j = i;
+
+        for (; j > 0 && s->bodies[s->order[j - 1]].lo[0] > s->bodies[k].lo[0]; --j)
+            s->order[j] = s->order[j - 1];
+
+        s->order[j] = k;
+    }
+
+    s->npairs = 0;
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+    {
+        struct SceneBody *a = &s->bodies[s->order[i]];
+
+        for (size_t j = i + 1; j < s->nbodies; ++j)
+        {
+            struct SceneBody *b = &s->bodies[s->order[j]];
+
+            // Everything further along starts past a
+            if (b->lo[0] > a->hi[0])
+                break;
+
+            if (b->lo[1] > a->hi[1] || b->lo[2] > a->hi[2] ||
+                b->hi[1] < a->lo[1] || b->hi[2] < a->lo[2])
+                continue;
+
+            push_pair(s, s->order[i], s->order[j]);
+        }
+    }
+}
+
+
+static float max_edge(struct Mesh *m)
+{
+    float max_sq = 0.f;
+
+    for (size_t t = 0; t < m->nindices; t += 3)
+    {
+        unsigned int *tri = m->indices + t;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            float d = glm_vec3_distance2(m->pos[tri[k]], m->pos[tri[(k + 1) % 3]]);
+            max_sq = d > max_sq ? d : max_sq;
+        }
+    }
+
+    return sqrtf(max_sq);
+}
+
+
+static void edge_job(void *arg, size_t begin, size_t end)
+{
+    struct SceneBody *bodies = arg;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        if (bodies[i].paired)
+            bodies[i].max_edge = max_edge(bodies[i].mesh);
+    }
+}
+
+
+static void push_contact(struct ContactList *l, struct Contact *ct)
+{
+    if (l->n == l->cap)
+    {
+        l->cap = l->cap ? l->cap * 2 : 64;
+        l->contacts = realloc(l->contacts, sizeof(struct Contact) * l->cap);
+    }
+
+    l->contacts[l->n++] = *ct;
+}
+
+
+static bool inside(vec3 p, vec3 lo, vec3 hi)
+{
+    return p[0] >= lo[0] && p[1] >= lo[1] && p[2] >= lo[2] &&
+           p[0] <= hi[0] && p[1] <= hi[1] && p[2] <= hi[2];
+}
+
+
+// Contacts have v[0] in p and v[1..3] in q
+static void pair_job(void *arg, size_t begin, size_t end)
+{
+    struct PairJob *j = arg;
+    struct Mesh *pm = j->p->mesh, *qm = j->q->mesh;
+    struct HashGrid *g = j->p->grid;
+    float h = j->s->thickness;
+
+    size_t ntris = qm->nindices / 3;
+    unsigned int cells[MAX_CELLS];
+
+    for (size_t ch = begin; ch < end; ++ch)
+    {
+        struct ContactList *l = &j->s->lists[ch];
+        l->n = 0;
+
+        for (size_t t = ntris * ch / SCENE_CHUNKS; t < ntris * (ch + 1) / SCENE_CHUNKS; ++t)
+        {
+            unsigned int *tri = qm->indices + t * 3;
+            vec3 corners[3], lo, hi;
+
+            for (int k = 0; k < 3; ++k)
+                glm_vec3_copy(qm->pos[tri[k]], corners[k]);
+
+            glm_vec3_minv(corners[0], corners[1], lo);
+            glm_vec3_minv(lo, corners[2], lo);
+            glm_vec3_maxv(corners[0], corners[1], hi);
+            glm_vec3_maxv(hi, corners[2], hi);
+            glm_vec3_subs(lo, h, lo);
+            glm_vec3_adds(hi, h, hi);
+
+            // Only the overlap of the two bodies can hold contacts
+            if (lo[0] > j->hi[0] || lo[1] > j->hi[1] || lo[2] > j->hi[2] ||
+                hi[0] < j->lo[0] || hi[1] < j->lo[1] || hi[2] < j->lo[2])
+                continue;
+
+            size_t ncells = hashgrid_query(g, lo, hi, cells, MAX_CELLS);
+
+            for (size_t ci = 0; ci < ncells; ++ci)
+            {
+                unsigned int b = cells[ci] & (g->nbuckets - 1);
+
+                for (unsigned int k = g->start[b]; k < g->start[b + 1]; ++k)
+                {
+                    unsigned int v = g->items[k];
+
+                    if (g->hashes[k] != cells[ci] || !inside(pm->pos[v], lo, hi))
+                        continue;
+
+                    float bary[3];
+                    geom_closest_tri(pm->pos[v], corners[0], corners[1], corners[2], bary);
+
+                    vec3 q = { 0.f, 0.f, 0.f };
+
+                    for (int i = 0; i < 3; ++i)
+                        glm_vec3_muladds(corners[i], bary[i], q);
+
+                    struct Contact ct;
+                    glm_vec3_sub(pm->pos[v], q, ct.n);
+                    ct.dist = glm_vec3_norm(ct.n);
+
+                    if (ct.dist >= h)
+                        continue;
+
+                    if (ct.dist > 1e-6f)
+                    {
+                        glm_vec3_divs(ct.n, ct.dist, ct.n);
+                    }
+                    else
+                    {
+                        // Exactly on the triangle, pick a side
+                        vec3 ab, ac;
+                        glm_vec3_sub(corners[1], corners[0], ab);
+                        glm_vec3_sub(corners[2], corners[0], ac);
+                        glm_vec3_crossn(ab, ac, ct.n);
+                    }
+
+                    ct.v[0] = v;
+                    ct.w[0] = 1.f;
+
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        ct.v[i + 1] = tri[i];
+                        ct.w[i + 1] = -bary[i];
+                    }
+
+                    push_contact(l, &ct);
+                }
+            }
+        }
+    }
+}
+
+
+// Same impulse as selfcollide, with the vertex and the triangle in
+// different meshes
+static void resolve(struct Mesh *p, struct Mesh *q, struct Contact *ct, float h, float dt)
+{
+    struct Mesh *owner[4] = { p, q, q, q };
+    float vn = 0.f, denom = 0.f;
+
+    for (int k = 0; k < 4; ++k)
+    {
+        vn += ct->w[k] * glm_vec3_dot(owner[k]->vel[ct->v[k]], ct->n);
+        denom += ct->w[k] * ct->w[k] * owner[k]->inv_mass[ct->v[k]];
+    }
+
+    float target = (h - ct->dist) * SCENE_PUSH / dt;
+
+    if (denom <= 0.f || vn >= target)
+        return;
+
+    float impulse = (target - vn) / denom;
+
+    for (int k = 0; k < 4; ++k)
+    {
+        struct Mesh *m = owner[k];
+        unsigned int i = ct->v[k];
+        float dv = impulse * ct->w[k] * m->inv_mass[i];
+
+        glm_vec3_muladds(ct->n, dv, m->vel[i]);
+        glm_vec3_muladds(ct->n, dv * dt, m->pos[i]);
+    }
+}
+
+
+static void collide_pair(struct Scene *s, struct SceneBody *p, struct SceneBody *q, float dt)
+{
+    struct PairJob j;
+    j.s = s;
+    j.p = p;
+    j.q = q;
+    glm_vec3_maxv(p->lo, q->lo, j.lo);
+    glm_vec3_minv(p->hi, q->hi, j.hi);
+
+    pool_for(pool_global(), SCENE_CHUNKS, 1, pair_job, &j);
+
+    for (size_t i = 0; i < SCENE_CHUNKS; ++i)
+    {
+        struct ContactList *l = &s->lists[i];
+
+        for (size_t k = 0; k < l->n; ++k)
+            resolve(p->mesh, q->mesh, &l->contacts[k], s->thickness, dt);
+
+        s->ncontacts += l->n;
+    }
+}
+
+
+static void scene_collide(struct Scene *s, float dt)
+{
+    s->ncontacts = 0;
+    broadphase(s);
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+        s->bodies[i].paired = false;
+
+    for (size_t k = 0; k < s->npairs * 2; ++k)
+        s->bodies[s->pairs[k]].paired = true;
+
+    // Grids are only kept for bodies that touch something
+    for (size_t i = 0; i < s->nbodies; ++i)
+    {
+        struct SceneBody *b = &s->bodies[i];
+
+        if (b->paired && !b->grid)
+            b->grid = hashgrid_alloc(b->mesh->mass_cap);
+
+        if (!b->paired && b->grid)
+        {
+            hashgrid_free(b->grid);
+            b->grid = 0;
+        }
+    }
+
+    // Only once the grids of bodies that drifted apart are gone
+    if (!s->npairs)
+        return;
+
+    pool_for(pool_global(), s->nbodies, 1, edge_job, s->bodies);
+
+    // A padded triangle of any paired body spans at most two cells per axis
+    float edge = 0.f;
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+    {
+        if (s->bodies[i].paired && s->bodies[i].max_edge > edge)
+            edge = s->bodies[i].max_edge;
+    }
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+    {
+        struct SceneBody *b = &s->bodies[i];
+
+        if (b->grid)
+            hashgrid_build(b->grid, b->mesh->pos, b->mesh->nmasses, edge + 2.f * s->thickness);
+    }
+
+    for (size_t i = 0; i < s->npairs; ++i)
+    {
+        struct SceneBody *a = &s->bodies[s->pairs[i * 2]];
+        struct SceneBody *b = &s->bodies[s->pairs[i * 2 + 1]];
+
+        collide_pair(s, a, b, dt);
+        collide_pair(s, b, a, dt);
+    }
+}
+
+
+void scene_step(struct Scene *s, float dt)
+{
+    // Meshes only read the field, it moves on before any of them steps
+    if (s->wind)
+        wind_advect(s->wind, dt);
+
+    // A lone mesh keeps the whole pool for its own loops, pool jobs only run
+    // nested calls inline
+    if (s->nbodies == 1)
+    {
+        mesh_step(s->bodies[0].mesh, dt);
+    }
+    else
+    {
+        struct StepJob j = { s, dt };
+        pool_for(pool_global(), s->nbodies, 1, step_job, &j);
+    }
+
+    if (s->thickness > 0.f)
+        scene_collide(s, dt);
+}
+
+
+void scene_snapshot(struct Scene *s)
+{
+    for (size_t i = 0; i < s->nbodies; ++i)
+        mesh_snapshot(s->bodies[i].mesh);
+}
+
+
+size_t scene_frame_size(struct Scene *s)
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+        size += mesh_frame_size(s->bodies[i].mesh);
+
+    return size;
+}
+
+
+void scene_pack(struct Scene *s, float alpha, void *out)
+{
+    char *frame = out;
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+    {
+        mesh_pack(s->bodies[i].mesh, alpha, frame);
+        frame += mesh_frame_size(s->bodies[i].mesh);
+    }
+}
+
+
+void scene_upload_frame(struct Scene *s, const void *frame)
+{
+    const char *p = frame;
+
+    for (size_t i = 0; i < s->nbodies; ++i)
+    {
+        mesh_upload_frame(s->bodies[i].mesh, p);
+        p += mesh_frame_size(s->bodies[i].mesh);
+    }
+}
+
+
+void scene_render(struct Scene *s, RenderInfo *ri)
+{
+    for (size_t i = 0; i < s->nbodies; ++i)
+        mesh_render(s->bodies[i].mesh, ri);
+}
@@ -0,0 +1,73 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "hashgrid.h"
+#include "mesh.h"
+#include "selfcollide.h"
+#include "wind.h"
+
+struct SceneBody
+{
+    struct Mesh *mesh;
+
+    // Bounds padded by half the thickness, as of the last broadphase
+    vec3 lo, hi;
+
+    // Part of a pair in the last broadphase, the grid only exists while it is
+    bool paired;
+    struct HashGrid *grid;
+    float max_edge;
+};
+
+// Independent meshes stepped side by side. Cloth-cloth contacts are only
+// looked for between meshes whose bounds come within thickness, found by
+// sweep and prune along x.
+struct Scene
+{
+    struct SceneBody *bodies;
+    size_t nbodies, cap;
+
+    // Bodies sorted by lo[0], kept between steps so that the insertion sort
+    // only has to fix what moved
+    size_t *order;
+
+    // Overlapping bodies, two per entry, lower index first
+    size_t *pairs;
+    size_t npairs, pairs_cap;
+
+    // Cloth-cloth collision is off if this is 0
+    float thickness;
+
+    // Air every mesh moves through, advected once per step. Null for still
+    // air.
+    struct Wind *wind;
+
+    // Contacts of one pair direction, filled in parallel and resolved in
+    // list order
+    struct ContactList *lists;
+    size_t ncontacts;
+};
+
+struct Scene *scene_alloc(float thickness);
+// Frees every mesh added
+void scene_free(struct Scene *s);
+
+// The scene takes ownership of m and moves it by t, see mesh_transform.
+// Returns the index of the mesh.
+size_t scene_add(struct Scene *s, struct Mesh *m, mat4 t);
+
+// The scene takes ownership of w, every mesh samples it in aero_step
+void scene_set_wind(struct Scene *s, struct Wind *w);
+
+// mesh_step on every mesh in parallel, then cloth-cloth collision
+void scene_step(struct Scene *s, float dt);
+
+void scene_snapshot(struct Scene *s);
+// Frames of every mesh back to back, see mesh_pack
+size_t scene_frame_size(struct Scene *s);
+void scene_pack(struct Scene *s, float alpha, void *out);
+// Only call from the thread owning the GL context
+void scene_upload_frame(struct Scene *s, const void *frame);
+void scene_render(struct Scene *s, RenderInfo *ri);
+
+#endif
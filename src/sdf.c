@@ -0,0 +1,406 @@
+#include "sdf.h"
+#include "pool.h"
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC 0x48434453 // "SDCH"
+#define CACHE_VERSION 2
+
+#define S1 (SDF_BRICK + 1)
+#define SAMPLE(s, brick, x, y, z) ((s)->data[(size_t)(brick) * SDF_SAMPLES + ((z) * S1 + (y)) * S1 + (x)])
+
+struct BuildJob
+{
+    struct Sdf *s;
+    struct Bvh *b;
+};
+
+struct CacheHeader
+{
+    uint32_t magic, version;
+    int64_t mtime, size;
+    float voxel;
+
+    float origin[3], band;
+    int32_t dims[3];
+    uint64_t ndata;
+};
+
+
+static void brick_coords(struct Sdf *s, size_t i, int out[3])
+{
+    out[0] = i % s->dims[0];
+    out[1] = i / s->dims[0] % s->dims[1];
+    out[2] = i / ((size_t)s->dims[0] * s->dims[1]);
+}
+
+
+// Signed distance to the mesh up to max_dist, the sign from the closest
+// feature's pseudonormal, q the closest point
+static float signed_dist(struct Bvh *b, vec3 p, float max_dist, bool *found, vec3 q)
+{
+    vec3 pn, d;
+    unsigned int tri;
+    float bary[3];
+
+    float dist = bvh_closest(b, p, max_dist, q, &tri, bary);
+    *found = dist < max_dist;
+
+    if (!*found)
+        return dist;
+
+    bvh_pseudonormal(b, tri, bary, pn);
+    glm_vec3_sub(p, q, d);
+
+    return glm_vec3_dot(d, pn) < 0.f ? -dist : dist;
+}
+
+
+// Marks bricks that the surface passes within band of, the rest are
+// classified as inside or outside from their centre
+static void classify_job(void *arg, size_t begin, size_t end)
+{
+    struct BuildJob *j = arg;
+    struct Sdf *s = j->s;
+
+    float size = s->voxel * SDF_BRICK;
+    float reach = size * .5f * sqrtf(3.f) + s->band;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        int c[3];
+        brick_coords(s, i, c);
+
+        vec3 center;
+        for (int k = 0; k < 3; ++k)
+            center[k] = s->origin[k] + (c[k] + .5f) * size;
+
+        bool found;
+        vec3 q;
+        float d = signed_dist(j->b, center, FLT_MAX, &found, q);
+
+        // Away from the surface on the outside, toward it on the inside
+        float *coarse = s->coarse + i * 4;
+        glm_vec3_sub(center, q, coarse);
+
+        if (fabsf(d) > 1e-12f)
+            glm_vec3_divs(coarse, d, coarse);
+        else
+            glm_vec3_copy((vec3){ 0.f, 1.f, 0.f }, coarse);
+
+        coarse[3] = d;
+
+        if (fabsf(d) < reach)
+            s->bricks[i] = 0;
+        else
+            s->bricks[i] = d < 0.f ? SDF_INSIDE : SDF_OUTSIDE;
+    }
+}
+
+
+static void fill_job(void *arg, size_t begin, size_t end)
+{
+    struct BuildJob *j = arg;
+    struct Sdf *s = j->s;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        if (s->bricks[i] < 0)
+            continue;
+
+        int c[3];
+        brick_coords(s, i, c);
+
+        for (int z = 0; z < S1; ++z)
+        {
+            for (int y = 0; y < S1; ++y)
+            {
+                for (int x = 0; x < S1; ++x)
+                {
+                    vec3 p = {
+                        s->origin[0] + (c[0] * SDF_BRICK + x) * s->voxel,
+                        s->origin[1] + (c[1] * SDF_BRICK + y) * s->voxel,
+                        s->origin[2] + (c[2] * SDF_BRICK + z) * s->voxel
+                    };
+
+                    bool found;
+                    vec3 q;
+                    float d = signed_dist(j->b, p, s->band, &found, q);
+
+                    if (!found)
+                    {
+                        // Beyond the band, still needs the right side
+                        d = signed_dist(j->b, p, FLT_MAX, &found, q);
+                        d = d < 0.f ? -s->band : s->band;
+                    }
+
+                    SAMPLE(s, s->bricks[i], x, y, z) = d;
+                }
+            }
+        }
+    }
+}
+
+
+struct Sdf *sdf_build(struct Bvh *b, float voxel)
+{
+    struct Sdf *s = malloc(sizeof(struct Sdf));
+    s->voxel = voxel;
+    s->band = voxel * 2.f;
+
+    // One brick of margin around the model so the outside is represented
+    struct BvhNode *root = &b->nodes[0];
+    float size = voxel * SDF_BRICK;
+
+    size_t nbricks = 1;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        float lo = b->ntris ? root->lo[k] : 0.f, hi = b->ntris ? root->hi[k] : 0.f;
+
+        s->origin[k] = lo - size;
+        s->dims[k] = (int)ceilf((hi - lo) / size) + 2;
+        nbricks *= s->dims[k];
+    }
+
+    s->bricks = malloc(sizeof(int) * nbricks);
+    s->coarse = malloc(sizeof(float) * 4 * nbricks);
+
+    struct BuildJob j = { s, b };
+    pool_for(pool_global(), nbricks, 16, classify_job, &j);
+
+    size_t n = 0;
+
+    for (size_t i = 0; i < nbricks; ++i)
+    {
+        if (s->bricks[i] >= 0)
+            s->bricks[i] = n++;
+    }
+
+    s->ndata = n * SDF_SAMPLES;
+    s->data = malloc(sizeof(float) * (s->ndata ? s->ndata : 1));
+
+    pool_for(pool_global(), nbricks, 4, fill_job, &j);
+
+    return s;
+}
+
+
+void sdf_free(struct Sdf *s)
+{
+    free(s->bricks);
+    free(s->coarse);
+    free(s->data);
+    free(s);
+}
+
+
+static char *cache_path(const char *path)
+{
+    char *out = malloc(strlen(path) + 5);
+    sprintf(out, "%s.sdf", path);
+    return out;
+}
+
+
+static struct Sdf *cache_load(const char *path, struct stat *st, float voxel)
+{
+    char *cpath = cache_path(path);
+    FILE *fp = fopen(cpath, "rb");
+    free(cpath);
+
+    if (!fp)
+        return 0;
+
+    struct CacheHeader hdr;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        hdr.magic != CACHE_MAGIC || hdr.version != CACHE_VERSION ||
+        hdr.mtime != (int64_t)st->st_mtime || hdr.size != (int64_t)st->st_size ||
+        hdr.voxel != voxel || hdr.ndata % SDF_SAMPLES != 0)
+    {
+        fclose(fp);
+        return 0;
+    }
+
+    struct Sdf *s = malloc(sizeof(struct Sdf));
+    s->voxel = voxel;
+    s->band = hdr.band;
+    glm_vec3_copy(hdr.origin, s->origin);
+    memcpy(s->dims, hdr.dims, sizeof(s->dims));
+    s->ndata = hdr.ndata;
+
+    size_t nbricks = (size_t)s->dims[0] * s->dims[1] * s->dims[2];
+    s->bricks = malloc(sizeof(int) * nbricks);
+    s->coarse = malloc(sizeof(float) * 4 * nbricks);
+    s->data = malloc(sizeof(float) * (s->ndata ? s->ndata : 1));
+
+    bool ok = fread(s->bricks, sizeof(int), nbricks, fp) == nbricks &&
+              fread(s->coarse, sizeof(float) * 4, nbricks, fp) == nbricks &&
+              fread(s->data, sizeof(float), s->ndata, fp) == s->ndata;
+
+    fclose(fp);
+
+    for (size_t i = 0; ok && i < nbricks; ++i)
+    {
+        int b = s->bricks[i];
+        ok = b == SDF_INSIDE || b == SDF_OUTSIDE || (b >= 0 && (size_t)(b + 1) * SDF_SAMPLES <= s->ndata);
+    }
+
+    if (!ok)
+    {
+        sdf_free(s);
+        return 0;
+    }
+
+    return s;
+}
+
+
+static void cache_save(struct Sdf *s, const char *path, struct stat *st)
+{
+    char *cpath = cache_path(path);
+    FILE *fp = fopen(cpath, "wb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "[cache_save] Couldn't write %s\n", cpath);
+        free(cpath);
+        return;
+    }
+
+    free(cpath);
+
+    struct CacheHeader hdr = {
+        CACHE_MAGIC, CACHE_VERSION,
+        st->st_mtime, st->st_size, s->voxel,
+        { s->origin[0], s->origin[1], s->origin[2] }, s->band,
+        { s->dims[0], s->dims[1], s->dims[2] }, s->ndata
+    };
+
+    size_t nbricks = (size_t)s->dims[0] * s->dims[1] * s->dims[2];
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(s->bricks, sizeof(int), nbricks, fp);
+    fwrite(s->coarse, sizeof(float) * 4, nbricks, fp);
+    fwrite(s->data, sizeof(float), s->ndata, fp);
+    fclose(fp);
+}
+
+
+struct Sdf *sdf_load(const char *path, float voxel)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        fprintf(stderr, "[sdf_load] Couldn't find '%s'.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct Sdf *s = cache_load(path, &st, voxel);
+
+    if (s)
+        return s;
+
+    struct Bvh *b = bvh_load(path);
+    s = sdf_build(b, voxel);
+    bvh_free(b);
+
+    cache_save(s, path, &st);
+
+    return s;
+}
+
+
+float sdf_sample(struct Sdf *s, vec3 p, vec3 grad)
+{
+    int c[3], v[3];
+    float t[3];
+
+    for (int k = 0; k < 3; ++k)
+    {
+        float g = (p[k] - s->origin[k]) / s->voxel;
+        float fc = floorf(g / SDF_BRICK);
+
+        // Off the grid counts as far outside
+        if (fc < 0.f || fc >= s->dims[k])
+        {
+            glm_vec3_copy((vec3){ 0.f, 1.f, 0.f }, grad);
+            return s->band;
+        }
+
+        c[k] = (int)fc;
+
+        float local = g - c[k] * SDF_BRICK;
+        v[k] = (int)local;
+        v[k] = v[k] < SDF_BRICK ? v[k] : SDF_BRICK - 1;
+        t[k] = local - v[k];
+    }
+
+    size_t i = ((size_t)c[2] * s->dims[1] + c[1]) * s->dims[0] + c[0];
+    int brick = s->bricks[i];
+    float *coarse = s->coarse + i * 4;
+
+    if (brick == SDF_OUTSIDE)
+    {
+        glm_vec3_copy(coarse, grad);
+        return s->band;
+    }
+
+    if (brick == SDF_INSIDE)
+    {
+        // Plane through the surface point closest to the centre, never
+        // shallower than the band it is known to be past
+        vec3 center;
+        for (int k = 0; k < 3; ++k)
+            center[k] = s->origin[k] + (c[k] + .5f) * s->voxel * SDF_BRICK;
+
+        vec3 off;
+        glm_vec3_sub(p, center, off);
+        glm_vec3_copy(coarse, grad);
+
+        float d = coarse[3] + glm_vec3_dot(off, coarse);
+        return d < -s->band ? d : -s->band;
+    }
+
+    float d[2][2][2];
+
+    for (int z = 0; z < 2; ++z)
+        for (int y = 0; y < 2; ++y)
+            for (int x = 0; x < 2; ++x)
+                d[z][y][x] = SAMPLE(s, brick, v[0] + x, v[1] + y, v[2] + z);
+
+    float tx = t[0], ty = t[1], tz = t[2];
+
+    // Interpolate along x, then y, then z, the gradient is the derivative
+    // of the same polynomial
+    float d00 = d[0][0][0] + (d[0][0][1] - d[0][0][0]) * tx;
+    float d01 = d[0][1][0] + (d[0][1][1] - d[0][1][0]) * tx;
+    float d10 = d[1][0][0] + (d[1][0][1] - d[1][0][0]) * tx;
+    float d11 = d[1][1][0] + (d[1][1][1] - d[1][1][0]) * tx;
+
+    float d0 = d00 + (d01 - d00) * ty;
+    float d1 = d10 + (d11 - d10) * ty;
+
+    float gx0 = (d[0][0][1] - d[0][0][0]) + ((d[0][1][1] - d[0][1][0]) - (d[0][0][1] - d[0][0][0])) * ty;
+    float gx1 = (d[1][0][1] - d[1][0][0]) + ((d[1][1][1] - d[1][1][0]) - (d[1][0][1] - d[1][0][0])) * ty;
+
+    grad[0] = gx0 + (gx1 - gx0) * tz;
+    grad[1] = (d01 - d00) + ((d11 - d10) - (d01 - d00)) * tz;
+    grad[2] = d1 - d0;
+
+    float len = glm_vec3_norm(grad);
+
+    // Flat where every corner is clamped to the band
+    if (len > 1e-12f)
+        glm_vec3_divs(grad, len, grad);
+    else
+        glm_vec3_copy(coarse, grad);
+
+    return d0 + (d1 - d0) * tz;
+}
@@ -0,0 +1,51 @@
+#ifndef SDF_H
+#define SDF_H
+
+#include "bvh.h"
+#include <cglm/cglm.h>
+
+// Cells per brick side, bricks store one more sample per axis so that
+// interpolation never reads across bricks
+#define SDF_BRICK 8
+#define SDF_SAMPLES ((SDF_BRICK + 1) * (SDF_BRICK + 1) * (SDF_BRICK + 1))
+
+enum
+{
+    // Values of Sdf::bricks for bricks with no surface nearby
+    SDF_OUTSIDE = -1,
+    SDF_INSIDE = -2
+};
+
+// Signed distance grid that only stores bricks within band of the surface.
+// Elsewhere outside the distance is band, inside it is estimated from the
+// plane through the closest surface point of the brick's centre, so that
+// deep masses are pushed out the short way.
+struct Sdf
+{
+    vec3 origin;
+    float voxel;
+    float band;
+
+    // Bricks per axis, index of each into data or SDF_OUTSIDE / SDF_INSIDE
+    int dims[3];
+    int *bricks;
+
+    // Per brick the outward unit direction at its centre and the signed
+    // distance there, 4 floats each
+    float *coarse;
+
+    float *data;
+    size_t ndata;
+};
+
+// Voxelizes the model at path with cells of size voxel, or reads it from
+// path.sdf if that was written for the same file and voxel size
+struct Sdf *sdf_load(const char *path, float voxel);
+struct Sdf *sdf_build(struct Bvh *b, float voxel);
+void sdf_free(struct Sdf *s);
+
+// Trilinear distance at p and its normalized gradient, where the samples
+// are flat the gradient is the brick's coarse direction
+float sdf_sample(struct Sdf *s, vec3 p, vec3 grad);
+
+#endif
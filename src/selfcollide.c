@@ -0,0 +1,587 @@
+#include "selfcollide.h"
+#include "geom.h"
+#include "mesh.h"
+#include "pool.h"
+#include "tear.h"
+#include "util.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Triangles and edges are split into this many contact lists, resolving
+// them in list order keeps the result independent of the thread count
+#define COLLIDE_CHUNKS 64
+// Fraction of the missing distance recovered per step
+#define COLLIDE_PUSH .5f
+#define MAX_CELLS 27
+
+struct DetectJob
+{
+    struct Mesh *m;
+    struct SelfCollide *c;
+    float h;
+
+    float max_edge[COLLIDE_CHUNKS];
+};
+
+
+static int cmp_edge(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+static uint64_t edge_key(unsigned int a, unsigned int b)
+{
+    return a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+}
+
+
+static size_t key_slot(uint64_t *keys, size_t cap, uint64_t key)
+{
+    // splitmix64 finalizer
+    uint64_t h = key;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+
+    size_t i = h & (cap - 1);
+
+    while (keys[i] && keys[i] != key)
+        i = (i + 1) & (cap - 1);
+
+    return i;
+}
+
+
+static void key_insert(struct SelfCollide *c, uint64_t key, unsigned int edge)
+{
+    // Kept at most half full
+    if ((c->nedges + 1) * 2 > c->keys_cap)
+    {
+        size_t cap = c->keys_cap ? c->keys_cap * 2 : 1024;
+        uint64_t *keys = calloc(cap, sizeof(uint64_t));
+        unsigned int *key_edge = malloc(sizeof(unsigned int) * cap);
+
+        for (size_t i = 0; i < c->keys_cap; ++i)
+        {
+            if (!c->keys[i])
+                continue;
+
+            size_t j = key_slot(keys, cap, c->keys[i]);
+            keys[j] = c->keys[i];
+            key_edge[j] = c->key_edge[i];
+        }
+
+        free(c->keys);
+        free(c->key_edge);
+        c->keys = keys;
+        c->key_edge = key_edge;
+        c->keys_cap = cap;
+    }
+
+    size_t i = key_slot(c->keys, c->keys_cap, key);
+    c->keys[i] = key;
+    c->key_edge[i] = edge;
+}
+
+
+struct SelfCollide *selfcollide_alloc(struct Mesh *m, float thickness)
+{
+    struct SelfCollide *c = malloc(sizeof(struct SelfCollide));
+    c->thickness = thickness;
+    c->max_edge = 0.f;
+    c->ncontacts = 0;
+
+    // Every triangle side as a sorted pair, shared sides are counted and
+    // dropped after sorting
+    size_t ntris = m->nindices / 3;
+    uint64_t *keys = malloc(sizeof(uint64_t) * (ntris * 3 + 1));
+
+    for (size_t t = 0; t < ntris; ++t)
+    {
+        unsigned int *tri = m->indices + t * 3;
+
+        for (int k = 0; k < 3; ++k)
+            keys[t * 3 + k] = edge_key(tri[k], tri[(k + 1) % 3]);
+    }
+
+    qsort(keys, ntris * 3, sizeof(uint64_t), cmp_edge);
+
+    // Torn meshes gain edges as they split
+    c->edges_cap = m->tear ? ntris * 6 + 64 : ntris * 3 + 1;
+    c->edges = malloc(sizeof(unsigned int) * 2 * c->edges_cap);
+    c->edge_tris = malloc(sizeof(unsigned int) * c->edges_cap);
+    c->nedges = 0;
+
+    c->keys = 0;
+    c->key_edge = 0;
+    c->keys_cap = 0;
+
+    for (size_t i = 0; i < ntris * 3; ++i)
+    {
+        // Triangles collapsed by tearing have sides of zero length
+        if (keys[i] >> 32 == (keys[i] & 0xffffffff))
+            continue;
+
+        if (i > 0 && keys[i] == keys[i - 1])
+        {
+            ++c->edge_tris[c->nedges - 1];
+            continue;
+        }
+
+        if (m->tear)
+            key_insert(c, keys[i], c->nedges);
+
+        c->edges[c->nedges * 2] = keys[i] >> 32;
+        c->edges[c->nedges * 2 + 1] = keys[i] & 0xffffffff;
+        c->edge_tris[c->nedges] = 1;
+        ++c->nedges;
+    }
+
+    free(keys);
+
+    c->mid = util_alloc_aligned(sizeof(vec3) * (c->edges_cap + 1));
+    c->verts = hashgrid_alloc(m->mass_cap);
+    c->mids = hashgrid_alloc(c->edges_cap);
+
+    c->lists = malloc(sizeof(struct ContactList) * COLLIDE_CHUNKS * 2);
+
+    for (size_t i = 0; i < COLLIDE_CHUNKS * 2; ++i)
+    {
+        c->lists[i].contacts = 0;
+        c->lists[i].n = 0;
+        c->lists[i].cap = 0;
+    }
+
+    return c;
+}
+
+
+void selfcollide_free(struct SelfCollide *c)
+{
+    for (size_t i = 0; i < COLLIDE_CHUNKS * 2; ++i)
+        free(c->lists[i].contacts);
+
+    free(c->lists);
+    hashgrid_free(c->verts);
+    hashgrid_free(c->mids);
+    free(c->mid);
+    free(c->edges);
+    free(c->edge_tris);
+    free(c->keys);
+    free(c->key_edge);
+    free(c);
+}
+
+
+// One more or one less triangle on side a-b
+static void count_side(struct SelfCollide *c, unsigned int a, unsigned int b, int d)
+{
+    if (a == b)
+        return;
+
+    uint64_t key = edge_key(a, b);
+    size_t i = key_slot(c->keys, c->keys_cap, key);
+
+    if (c->keys[i])
+    {
+        unsigned int e = c->key_edge[i];
+        c->edge_tris[e] += d;
+
+        // Dead edges keep their slot, both ends on the first mass
+        c->edges[e * 2] = key >> 32;
+        c->edges[e * 2 + 1] = c->edge_tris[e] ? (unsigned int)(key & 0xffffffff) : c->edges[e * 2];
+        return;
+    }
+
+    if (d < 0)
+        return;
+
+    if (c->nedges == c->edges_cap)
+    {
+        c->edges_cap *= 2;
+        c->edges = realloc(c->edges, sizeof(unsigned int) * 2 * c->edges_cap);
+        c->edge_tris = realloc(c->edge_tris, sizeof(unsigned int) * c->edges_cap);
+
+        // Both are rebuilt every step, only their size matters
+        free(c->mid);
+        c->mid = util_alloc_aligned(sizeof(vec3) * (c->edges_cap + 1));
+        hashgrid_free(c->mids);
+        c->mids = hashgrid_alloc(c->edges_cap);
+    }
+
+    key_insert(c, key, c->nedges);
+
+    c->edges[c->nedges * 2] = key >> 32;
+    c->edges[c->nedges * 2 + 1] = key & 0xffffffff;
+    c->edge_tris[c->nedges] = 1;
+    ++c->nedges;
+}
+
+
+void selfcollide_tear(struct Mesh *m)
+{
+    struct SelfCollide *c = m->self_collide;
+    struct Tear *t = m->tear;
+
+    for (size_t i = 0; i < t->nedits; ++i)
+    {
+        struct TriEdit *e = &t->edits[i];
+
+        for (int k = 0; k < 3; ++k)
+            count_side(c, e->from[k], e->from[(k + 1) % 3], -1);
+
+        for (int k = 0; k < 3; ++k)
+            count_side(c, e->to[k], e->to[(k + 1) % 3], 1);
+    }
+}
+
+
+static void push_contact(struct ContactList *l, struct Contact *ct)
+{
+    if (l->n == l->cap)
+    {
+        l->cap = l->cap ? l->cap * 2 : 64;
+        l->contacts = realloc(l->contacts, sizeof(struct Contact) * l->cap);
+    }
+
+    l->contacts[l->n++] = *ct;
+}
+
+
+// Copies split off by tearing start out on top of each other, they are
+// treated as the same mass
+static bool same_mass(struct Mesh *m, unsigned int a, unsigned int b)
+{
+    return a == b || (m->torn_from && m->torn_from[a] == m->torn_from[b]);
+}
+
+
+static void bounds(vec3 *pts, size_t n, float pad, vec3 lo, vec3 hi)
+{
+    glm_vec3_copy(pts[0], lo);
+    glm_vec3_copy(pts[0], hi);
+
+    for (size_t i = 1; i < n; ++i)
+    {
+        glm_vec3_minv(lo, pts[i], lo);
+        glm_vec3_maxv(hi, pts[i], hi);
+    }
+
+    glm_vec3_subs(lo, pad, lo);
+    glm_vec3_adds(hi, pad, hi);
+}
+
+
+static bool inside(vec3 p, vec3 lo, vec3 hi)
+{
+    return p[0] >= lo[0] && p[1] >= lo[1] && p[2] >= lo[2] &&
+           p[0] <= hi[0] && p[1] <= hi[1] && p[2] <= hi[2];
+}
+
+
+static void edge_job(void *arg, size_t begin, size_t end)
+{
+    struct DetectJob *j = arg;
+    struct SelfCollide *c = j->c;
+    vec3 *pos = j->m->pos;
+
+    for (size_t ch = begin; ch < end; ++ch)
+    {
+        float max_sq = 0.f;
+
+        for (size_t e = c->nedges * ch / COLLIDE_CHUNKS; e < c->nedges * (ch + 1) / COLLIDE_CHUNKS; ++e)
+        {
+            float *a = pos[c->edges[e * 2]], *b = pos[c->edges[e * 2 + 1]];
+
+            glm_vec3_add(a, b, c->mid[e]);
+            glm_vec3_scale(c->mid[e], .5f, c->mid[e]);
+
+            float d = glm_vec3_distance2(a, b);
+
+            if (d > max_sq)
+                max_sq = d;
+        }
+
+        j->max_edge[ch] = sqrtf(max_sq);
+    }
+}
+
+
+static void vert_tri_job(void *arg, size_t begin, size_t end)
+{
+    struct DetectJob *j = arg;
+    struct Mesh *m = j->m;
+    struct SelfCollide *c = j->c;
+    struct HashGrid *g = c->verts;
+    float h = j->h;
+
+    size_t ntris = m->nindices / 3;
+    unsigned int cells[MAX_CELLS];
+
+    for (size_t ch = begin; ch < end; ++ch)
+    {
+        struct ContactList *l = &c->lists[ch];
+        l->n = 0;
+
+        for (size_t t = ntris * ch / COLLIDE_CHUNKS; t < ntris * (ch + 1) / COLLIDE_CHUNKS; ++t)
+        {
+            unsigned int *tri = m->indices + t * 3;
+            vec3 corners[3];
+
+            if (tri[0] == tri[1])
+                continue;
+
+            for (int k = 0; k < 3; ++k)
+                glm_vec3_copy(m->pos[tri[k]], corners[k]);
+
+            vec3 lo, hi;
+            bounds(corners, 3, h, lo, hi);
+
+            size_t ncells = hashgrid_query(g, lo, hi, cells, MAX_CELLS);
+
+            for (size_t ci = 0; ci < ncells; ++ci)
+            {
+                unsigned int b = cells[ci] & (g->nbuckets - 1);
+
+                for (unsigned int k = g->start[b]; k < g->start[b + 1]; ++k)
+                {
+                    unsigned int v = g->items[k];
+
+                    if (g->hashes[k] != cells[ci] || same_mass(m, v, tri[0]) || same_mass(m, v, tri[1]) ||
+                        same_mass(m, v, tri[2]) || !inside(m->pos[v], lo, hi))
+                        continue;
+
+                    float bary[3];
+                    geom_closest_tri(m->pos[v], corners[0], corners[1], corners[2], bary);
+
+                    vec3 q = { 0.f, 0.f, 0.f };
+
+                    for (int i = 0; i < 3; ++i)
+                        glm_vec3_muladds(corners[i], bary[i], q);
+
+                    struct Contact ct;
+                    glm_vec3_sub(m->pos[v], q, ct.n);
+                    ct.dist = glm_vec3_norm(ct.n);
+
+                    if (ct.dist >= h)
+                        continue;
+
+                    if (ct.dist > 1e-6f)
+                    {
+                        glm_vec3_divs(ct.n, ct.dist, ct.n);
+                    }
+                    else
+                    {
+                        // Exactly on the triangle, pick a side
+                        vec3 ab, ac;
+                        glm_vec3_sub(corners[1], corners[0], ab);
+                        glm_vec3_sub(corners[2], corners[0], ac);
+                        glm_vec3_crossn(ab, ac, ct.n);
+                    }
+
+                    ct.v[0] = v;
+                    ct.w[0] = 1.f;
+
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        ct.v[i + 1] = tri[i];
+                        ct.w[i + 1] = -bary[i];
+                    }
+
+                    push_contact(l, &ct);
+                }
+            }
+        }
+    }
+}
+
+
+static void edge_edge_job(void *arg, size_t begin, size_t end)
+{
+    struct DetectJob *j = arg;
+    struct Mesh *m = j->m;
+    struct SelfCollide *c = j->c;
+    struct HashGrid *g = c->mids;
+    float h = j->h;
+
+    unsigned int cells[MAX_CELLS];
+
+    for (size_t ch = begin; ch < end; ++ch)
+    {
+        struct ContactList *l = &c->lists[COLLIDE_CHUNKS + ch];
+        l->n = 0;
+
+        for (size_t e = c->nedges * ch / COLLIDE_CHUNKS; e < c->nedges * (ch + 1) / COLLIDE_CHUNKS; ++e)
+        {
+            unsigned int a0 = c->edges[e * 2], a1 = c->edges[e * 2 + 1];
+
+            if (a0 == a1)
+                continue;
+
+            vec3 ends[2];
+            glm_vec3_copy(m->pos[a0], ends[0]);
+            glm_vec3_copy(m->pos[a1], ends[1]);
+
+            vec3 lo, hi;
+            bounds(ends, 2, h, lo, hi);
+
+            float reach = c->max_edge + h;
+
+            // Any point of a close edge is within h of this box, and its
+            // midpoint is within half an edge of that point
+            vec3 qlo, qhi;
+            glm_vec3_subs(lo, c->max_edge * .5f, qlo);
+            glm_vec3_adds(hi, c->max_edge * .5f, qhi);
+
+            size_t ncells = hashgrid_query(g, qlo, qhi, cells, MAX_CELLS);
+
+            for (size_t ci = 0; ci < ncells; ++ci)
+            {
+                unsigned int b = cells[ci] & (g->nbuckets - 1);
+
+                // Buckets are in index order, walking them backwards stops
+                // at the first edge already paired with this one
+                for (unsigned int k = g->start[b + 1]; k-- > g->start[b];)
+                {
+                    unsigned int f = g->items[k];
+
+                    if (f <= e)
+                        break;
+
+                    // Midpoints of close edges are at most an edge and the
+                    // thickness apart
+                    if (g->hashes[k] != cells[ci] ||
+                        glm_vec3_distance2(c->mid[e], c->mid[f]) > reach * reach)
+                        continue;
+
+                    unsigned int b0 = c->edges[f * 2], b1 = c->edges[f * 2 + 1];
+
+                    if (b0 == b1 || same_mass(m, b0, a0) || same_mass(m, b0, a1) || same_mass(m, b1, a0) || same_mass(m, b1, a1))
+                        continue;
+
+                    vec3 blo, bhi;
+                    glm_vec3_minv(m->pos[b0], m->pos[b1], blo);
+                    glm_vec3_maxv(m->pos[b0], m->pos[b1], bhi);
+
+                    if (blo[0] > hi[0] || blo[1] > hi[1] || blo[2] > hi[2] ||
+                        bhi[0] < lo[0] || bhi[1] < lo[1] || bhi[2] < lo[2])
+                        continue;
+
+                    float s, t;
+                    geom_closest_seg(ends[0], ends[1], m->pos[b0], m->pos[b1], &s, &t);
+
+                    vec3 p, q;
+                    glm_vec3_lerp(ends[0], ends[1], s, p);
+                    glm_vec3_lerp(m->pos[b0], m->pos[b1], t, q);
+
+                    struct Contact ct;
+                    glm_vec3_sub(p, q, ct.n);
+                    ct.dist = glm_vec3_norm(ct.n);
+
+                    if (ct.dist >= h)
+                        continue;
+
+                    if (ct.dist > 1e-6f)
+                    {
+                        glm_vec3_divs(ct.n, ct.dist, ct.n);
+                    }
+                    else
+                    {
+                        vec3 da, db;
+                        glm_vec3_sub(ends[1], ends[0], da);
+                        glm_vec3_sub(m->pos[b1], m->pos[b0], db);
+                        glm_vec3_cross(da, db, ct.n);
+
+                        float len = glm_vec3_norm(ct.n);
+
+                        // Parallel and touching, no usable direction
+                        if (len < 1e-12f)
+                            continue;
+
+                        glm_vec3_divs(ct.n, len, ct.n);
+                    }
+
+                    unsigned int v[4] = { a0, a1, b0, b1 };
+                    float w[4] = { 1.f - s, s, t - 1.f, -t };
+                    memcpy(ct.v, v, sizeof(v));
+                    memcpy(ct.w, w, sizeof(w));
+
+                    push_contact(l, &ct);
+                }
+            }
+        }
+    }
+}
+
+
+static void resolve(struct Mesh *m, struct Contact *ct, float h, float dt)
+{
+    float vn = 0.f, denom = 0.f;
+
+    for (int k = 0; k < 4; ++k)
+    {
+        vn += ct->w[k] * glm_vec3_dot(m->vel[ct->v[k]], ct->n);
+        denom += ct->w[k] * ct->w[k] * m->inv_mass[ct->v[k]];
+    }
+
+    // Approaching, or separating too slowly to clear the thickness
+    float target = (h - ct->dist) * COLLIDE_PUSH / dt;
+
+    if (denom <= 0.f || vn >= target)
+        return;
+
+    float impulse = (target - vn) / denom;
+
+    for (int k = 0; k < 4; ++k)
+    {
+        unsigned int i = ct->v[k];
+        float dv = impulse * ct->w[k] * m->inv_mass[i];
+
+        glm_vec3_muladds(ct->n, dv, m->vel[i]);
+        glm_vec3_muladds(ct->n, dv * dt, m->pos[i]);
+    }
+}
+
+
+void selfcollide_step(struct Mesh *m, float dt)
+{
+    struct SelfCollide *c = m->self_collide;
+    struct Pool *pool = pool_global();
+
+    struct DetectJob j;
+    j.m = m;
+    j.c = c;
+    j.h = c->thickness;
+
+    pool_for(pool, COLLIDE_CHUNKS, 1, edge_job, &j);
+
+    c->max_edge = 0.f;
+
+    for (size_t ch = 0; ch < COLLIDE_CHUNKS; ++ch)
+        c->max_edge = fmaxf(c->max_edge, j.max_edge[ch]);
+
+    // A padded triangle spans at most two vertex cells per axis, a padded
+    // edge query at most three midpoint cells
+    hashgrid_build(c->verts, m->pos, m->nmasses, c->max_edge + 2.f * j.h);
+    hashgrid_build(c->mids, c->mid, c->nedges, c->max_edge + j.h);
+
+    pool_for(pool, COLLIDE_CHUNKS, 1, vert_tri_job, &j);
+    pool_for(pool, COLLIDE_CHUNKS, 1, edge_edge_job, &j);
+
+    c->ncontacts = 0;
+
+    for (size_t i = 0; i < COLLIDE_CHUNKS * 2; ++i)
+    {
+        struct ContactList *l = &c->lists[i];
+
+        for (size_t k = 0; k < l->n; ++k)
+            resolve(m, &l->contacts[k], j.h, dt);
+
+        c->ncontacts += l->n;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef SELFCOLLIDE_H
+#define SELFCOLLIDE_H
+
+#include "hashgrid.h"
+#include <cglm/cglm.h>
+#include <stdint.h>
+
+struct Mesh;
+
+// Relative velocity sum(w[i] * vel[v[i]]) along n must not be approaching
+struct Contact
+{
+    unsigned int v[4];
+    float w[4];
+
+    vec3 n;
+    float dist;
+};
+
+struct ContactList
+{
+    struct Contact *contacts;
+    size_t n, cap;
+};
+
+// Keeps every vertex-triangle and edge-edge pair of the mesh at least
+// thickness apart with velocity impulses after each step
+struct SelfCollide
+{
+    float thickness;
+
+    // Unique edges of Mesh::indices, two per entry, and the number of
+    // triangles on each. Edges tearing took every triangle off have both
+    // ends on their first mass.
+    unsigned int *edges;
+    unsigned int *edge_tris;
+    size_t nedges, edges_cap;
+    vec3 *mid;
+
+    // Edge of every sorted vertex pair, open addressing with 0 for empty.
+    // Only kept for torn meshes.
+    uint64_t *keys;
+    unsigned int *key_edge;
+    size_t keys_cap;
+
+    struct HashGrid *verts, *mids;
+
+    // Longest edge as of the last step, bounds how far a query must reach
+    float max_edge;
+
+    // Filled in parallel, one list per chunk, resolved in chunk order
+    struct ContactList *lists;
+    size_t ncontacts;
+};
+
+struct SelfCollide *selfcollide_alloc(struct Mesh *m, float thickness);
+void selfcollide_free(struct SelfCollide *c);
+
+// Edges for the triangles the last tear_step changed
+void selfcollide_tear(struct Mesh *m);
+
+void selfcollide_step(struct Mesh *m, float dt);
+
+#endif
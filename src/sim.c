@@ -0,0 +1,147 @@
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void sim_exec(struct Sim *s, struct SimCmd *cmd)
+{
+    if (cmd->mesh >= s->scene->nbodies)
+        return;
+
+    struct Mesh *m = s->scene->bodies[cmd->mesh].mesh;
+
+    switch (cmd->type)
+    {
+    case SIM_PIN:
+    case SIM_UNPIN:
+        if (cmd->i < m->nmasses)
+            mesh_pin(m, cmd->i, cmd->type == SIM_PIN);
+        break;
+    case SIM_SCALE_STIFFNESS:
+        for (size_t i = 0; i < m->nsprings; ++i)
+            m->springs[i].k *= cmd->value;
+
+        m->forces_changed = true;
+        break;
+    case SIM_TOGGLE_PAUSE:
+        s->paused = !s->paused;
+        break;
+    case SIM_SELF_COLLISION:
+        mesh_set_self_collision(m, cmd->value);
+        break;
+    }
+}
+
+
+static void *sim_run(void *arg)
+{
+    struct Sim *s = arg;
+    struct Scene *scene = s->scene;
+
+    double prev_time = now();
+    float acc = 0.f;
+
+    while (!atomic_load(&s->quit))
+    {
+        struct SimCmd cmd;
+        while (queue_pop(s->cmds, &cmd))
+            sim_exec(s, &cmd);
+
+        double time = now();
+        acc += time - prev_time;
+        prev_time = time;
+
+        if (s->paused)
+            acc = 0.f;
+
+        if (acc > SIM_DT * SIM_MAX_STEPS)
+            acc = SIM_DT * SIM_MAX_STEPS;
+
+        if (acc < SIM_DT)
+        {
+            // Nothing is due until the next step
+            float wait = s->paused ? SIM_DT : SIM_DT - acc;
+            struct timespec ts = { 0, (long)(wait * 1e9f) };
+            nanosleep(&ts, 0);
+            continue;
+        }
+
+        while (acc >= SIM_DT)
+        {
+            if (acc < SIM_DT * 2.f)
+                scene_snapshot(scene);
+
+            scene_step(scene, SIM_DT);
+            acc -= SIM_DT;
+        }
+
+        scene_pack(scene, acc / SIM_DT, s->slots[s->frames.back]);
+        triple_publish(&s->frames);
+    }
+
+    return 0;
+}
+
+
+struct Sim *sim_alloc(struct Scene *scene)
+{
+    struct Sim *s = malloc(sizeof(struct Sim));
+    s->scene = scene;
+    atomic_init(&s->quit, false);
+    s->paused = false;
+
+    triple_init(&s->frames);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        s->slots[i] = malloc(scene_frame_size(scene));
+        scene_pack(scene, 1.f, s->slots[i]);
+    }
+
+    s->cmds = queue_alloc(sizeof(struct SimCmd), 256);
+
+    if (pthread_create(&s->thread, 0, sim_run, s) != 0)
+    {
+        fprintf(stderr, "[sim_alloc] Failed to create simulation thread.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return s;
+}
+
+
+void sim_free(struct Sim *s)
+{
+    atomic_store(&s->quit, true);
+    pthread_join(s->thread, 0);
+
+    for (int i = 0; i < 3; ++i)
+        free(s->slots[i]);
+
+    queue_free(s->cmds);
+    free(s);
+}
+
+
+bool sim_send(struct Sim *s, struct SimCmd cmd)
+{
+    return queue_push(s->cmds, &cmd);
+}
+
+
+void *sim_acquire(struct Sim *s)
+{
+    if (!triple_acquire(&s->frames))
+        return 0;
+
+    return s->slots[s->frames.front];
+}
@@ -0,0 +1,62 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "scene.h"
+#include "queue.h"
+#include "triple.h"
+#include <pthread.h>
+
+#define SIM_DT .01f
+// Batches longer than this many steps drop simulated time instead of
+// falling further behind
+#define SIM_MAX_STEPS 8
+
+enum
+{
+    SIM_PIN,
+    SIM_UNPIN,
+    // Multiplies every spring's k by value
+    SIM_SCALE_STIFFNESS,
+    SIM_TOGGLE_PAUSE,
+    // Self collision with thickness value, off if it is 0
+    SIM_SELF_COLLISION
+};
+
+struct SimCmd
+{
+    int type;
+
+    size_t i;
+    float value;
+
+    // Scene index of the mesh the command applies to
+    size_t mesh;
+};
+
+// Runs scene_step on its own thread at a fixed SIM_DT and hands finished
+// scene_pack frames to the render thread through a triple buffer
+struct Sim
+{
+    struct Scene *scene;
+    pthread_t thread;
+    atomic_bool quit;
+
+    bool paused;
+
+    struct Triple frames;
+    void *slots[3];
+
+    // Render thread to sim thread
+    struct Queue *cmds;
+};
+
+// The scene belongs to the sim thread until sim_free returns
+struct Sim *sim_alloc(struct Scene *scene);
+void sim_free(struct Sim *s);
+
+bool sim_send(struct Sim *s, struct SimCmd cmd);
+
+// Newest finished frame if it changed since the last call, otherwise null
+void *sim_acquire(struct Sim *s);
+
+#endif
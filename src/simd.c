@@ -0,0 +1,310 @@
+#include "simd.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+struct Simd simd = { "scalar", 1, simd_springs_scalar, simd_aero_scalar, simd_wind_scalar };
+
+
+void simd_springs_scalar(const struct Spring *s, size_t n, vec3 *pos,
+                         float *inv_mass, vec3 *out, float scale)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        const struct Spring *sp = &s[i];
+
+        vec3 diff;
+        glm_vec3_sub(pos[sp->a], pos[sp->b], diff);
+
+        float dist = glm_vec3_norm(diff);
+        float c = sp->k * (sp->eq_len - dist) / dist * scale;
+
+        float wa = inv_mass ? inv_mass[sp->a] : 1.f;
+        float wb = inv_mass ? inv_mass[sp->b] : 1.f;
+
+        glm_vec3_muladds(diff, c * wa, out[sp->a]);
+        glm_vec3_muladds(diff, -c * wb, out[sp->b]);
+    }
+}
+
+void simd_aero_scalar(const unsigned int *tris, size_t stride, size_t n, vec3 *vel,
+                      float *const norm[3], float *const force[3], vec3 wind,
+                      float drag, float lift, float friction, float k)
+{
+    for (size_t t = 0; t < n; ++t)
+    {
+        const unsigned int *tri = tris + t * stride;
+        float u[3], nv[3];
+
+        for (int c = 0; c < 3; ++c)
+        {
+            u[c] = (vel[tri[0]][c] + vel[tri[1]][c] + vel[tri[2]][c]) * (1.f / 3.f) - wind[c];
+            nv[c] = norm[c][t];
+        }
+
+        // With n^ = n / |n| and area |n| / 2, drag is -drag area |u| (u.n^) n^,
+        // lift is -lift area |u| (u.n^) (n^ - (n^.u^) u^) and friction is
+        // -friction area |u| (u - (u.n^) n^), a third of each per corner
+        float len = sqrtf(nv[0] * nv[0] + nv[1] * nv[1] + nv[2] * nv[2]);
+        float u2 = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+        float un = u[0] * nv[0] + u[1] * nv[1] + u[2] * nv[2];
+
+        float speed = sqrtf(u2);
+        float lim = k * len;
+        speed = speed * lim > 1.f ? 1.f / lim : speed;
+
+        float inv_len = len > 0.f ? 1.f / len : 0.f;
+        float inv_u2 = u2 > 1e-12f ? 1.f / u2 : 0.f;
+
+        float sc = speed * (1.f / 6.f);
+        float along = -sc * (drag + lift - friction) * un * inv_len;
+        float across = -sc * (friction * len - lift * un * un * inv_len * inv_u2);
+
+        for (int c = 0; c < 3; ++c)
+            force[c][t] = along * nv[c] + across * u[c];
+    }
+}
+
+// Offsets into Wind::vel of the samples on both sides of every point along
+// axis a, and the weight of the upper one
+static void wind_axis(struct Wind *w, int a, vec3 *pos, size_t n, int *lo, int *hi, float *f)
+{
+    int d = w->dims[a];
+    int stride = a == 0 ? 1 : a == 1 ? w->dims[0] : w->dims[0] * w->dims[1];
+    float origin = w->origin[a];
+    float inv_cell = 1.f / w->cell;
+
+    if (w->tiled)
+    {
+        float inv_d = 1.f / d;
+
+        #pragma omp simd
+        for (size_t j = 0; j < n; ++j)
+        {
+            float g = (pos[j][a] - origin) * inv_cell;
+            g -= floorf(g * inv_d) * d;
+
+            int i0 = (int)g;
+            i0 = i0 < d - 1 ? i0 : d - 1;
+            int i1 = i0 + 1 < d ? i0 + 1 : 0;
+
+            lo[j] = i0 * stride;
+            hi[j] = i1 * stride;
+            f[j] = g - i0;
+        }
+    }
+    else
+    {
+        #pragma omp simd
+        for (size_t j = 0; j < n; ++j)
+        {
+            float g = (pos[j][a] - origin) * inv_cell;
+            g = g > 0.f ? g : 0.f;
+            g = g < d - 1 ? g : d - 1;
+
+            int i0 = (int)g;
+            i0 = i0 < d - 2 ? i0 : d - 2;
+
+            lo[j] = i0 * stride;
+            hi[j] = lo[j] + stride;
+            f[j] = g - i0;
+        }
+    }
+}
+
+
+void simd_wind_scalar(struct Wind *w, vec3 *pos, size_t n, vec3 *out)
+{
+    // Blocks of points are swept once per axis, then once per component
+    for (size_t b = 0; b < n; b += WIND_BLOCK)
+    {
+        size_t len = n - b < WIND_BLOCK ? n - b : WIND_BLOCK;
+
+        int lo[3][WIND_BLOCK], hi[3][WIND_BLOCK];
+        float f[3][WIND_BLOCK];
+
+        for (int a = 0; a < 3; ++a)
+            wind_axis(w, a, pos + b, len, lo[a], hi[a], f[a]);
+
+        // Each component gathers the same eight corners, still in cache
+        // from the one before
+        for (int c = 0; c < 3; ++c)
+        {
+            const float *v = w->vel[c];
+
+            #pragma omp simd
+            for (size_t j = 0; j < len; ++j)
+            {
+                int x0 = lo[0][j], x1 = hi[0][j];
+                int y0 = lo[1][j], y1 = hi[1][j];
+                int z0 = lo[2][j], z1 = hi[2][j];
+
+                float v00 = v[x0 + y0 + z0] + (v[x1 + y0 + z0] - v[x0 + y0 + z0]) * f[0][j];
+                float v10 = v[x0 + y1 + z0] + (v[x1 + y1 + z0] - v[x0 + y1 + z0]) * f[0][j];
+                float v01 = v[x0 + y0 + z1] + (v[x1 + y0 + z1] - v[x0 + y0 + z1]) * f[0][j];
+                float v11 = v[x0 + y1 + z1] + (v[x1 + y1 + z1] - v[x0 + y1 + z1]) * f[0][j];
+
+                float v0 = v00 + (v10 - v00) * f[1][j];
+                float v1 = v01 + (v11 - v01) * f[1][j];
+
+                out[b + j][c] = v0 + (v1 - v0) * f[2][j];
+            }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+
+#define AERO_NAME aero_sse2
+#define KERNEL_NAME springs_sse2
+#define KERNEL_TARGET "sse2"
+#define KERNEL_WIDTH 4
+#define KERNEL_SQRT(x) ((vf)_mm_sqrt_ps((__m128)(x)))
+#define KERNEL_GATHER(base, idx) ((vf){ (base)[(idx)[0]], (base)[(idx)[1]], (base)[(idx)[2]], (base)[(idx)[3]] })
+#define KERNEL_GATHER_INT(base, idx) ((vi){ (base)[(idx)[0]], (base)[(idx)[1]], (base)[(idx)[2]], (base)[(idx)[3]] })
+#define KERNEL_IOTA ((vi){ 0, 1, 2, 3 })
+#include "simd_aero.h"
+#include "simd_springs.h"
+
+#define AERO_NAME aero_avx2
+#define WIND_NAME wind_avx2
+#define KERNEL_NAME springs_avx2
+#define KERNEL_TARGET "avx2"
+#define KERNEL_WIDTH 8
+#define KERNEL_SQRT(x) ((vf)_mm256_sqrt_ps((__m256)(x)))
+#define KERNEL_GATHER(base, idx) ((vf)_mm256_i32gather_ps((base), (__m256i)(idx), 4))
+#define KERNEL_GATHER_INT(base, idx) ((vi)_mm256_i32gather_epi32((base), (__m256i)(idx), 4))
+#define KERNEL_IOTA ((vi){ 0, 1, 2, 3, 4, 5, 6, 7 })
+#include "simd_aero.h"
+#include "simd_wind.h"
+#include "simd_springs.h"
+
+#define AERO_NAME aero_avx512
+#define WIND_NAME wind_avx512
+#define KERNEL_NAME springs_avx512
+#define KERNEL_TARGET "avx512f"
+#define KERNEL_WIDTH 16
+#define KERNEL_SQRT(x) ((vf)_mm512_sqrt_ps((__m512)(x)))
+#define KERNEL_GATHER(base, idx) ((vf)_mm512_i32gather_ps((__m512i)(idx), (base), 4))
+#define KERNEL_GATHER_INT(base, idx) ((vi)_mm512_i32gather_epi32((__m512i)(idx), (base), 4))
+#define KERNEL_IOTA ((vi){ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 })
+#include "simd_aero.h"
+#include "simd_wind.h"
+#include "simd_springs.h"
+
+#endif
+
+
+// Largest difference between kernel and simd_springs_scalar on a jittered
+// grid of masses, relative to the largest scalar result. The spring count
+// leaves a tail for every width.
+static float springs_error(SpringKernel kernel)
+{
+    enum { SIDE = 17, MASSES = SIDE * SIDE, SPRINGS = 2 * SIDE * (SIDE - 1) };
+
+    static vec3 pos[MASSES], a[MASSES], b[MASSES];
+    static float inv_mass[MASSES];
+    static struct Spring s[SPRINGS];
+
+    uint32_t h = 0x9e3779b9u;
+    size_t ns = 0;
+
+    for (int i = 0; i < MASSES; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            h = h * 1664525u + 1013904223u;
+            pos[i][c] = (c == 0 ? i % SIDE : c == 1 ? i / SIDE : 0) + (h >> 8) / 16777216.f * .2f;
+        }
+
+        // Every seventh mass pinned
+        inv_mass[i] = i % 7 ? 1.f + i % 3 : 0.f;
+
+        if (i % SIDE < SIDE - 1)
+            s[ns++] = (struct Spring){ .a = i, .b = i + 1, .k = 1000.f + i, .eq_len = 1.f };
+
+        if (i / SIDE < SIDE - 1)
+            s[ns++] = (struct Spring){ .a = i, .b = i + SIDE, .k = 500.f + i, .eq_len = .9f };
+    }
+
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    simd_springs_scalar(s, ns, pos, inv_mass, a, 1.f / 60.f);
+    kernel(s, ns, pos, inv_mass, b, 1.f / 60.f);
+
+    float max = 0.f, err = 0.f;
+
+    for (int i = 0; i < MASSES; ++i)
+    {
+        max = fmaxf(max, glm_vec3_norm(a[i]));
+        err = fmaxf(err, glm_vec3_distance(a[i], b[i]));
+    }
+
+    return max > 0.f ? err / max : err;
+}
+
+
+void simd_init(void)
+{
+    static const struct Simd sets[] = {
+#ifdef SIMD_X86
+        { "avx512", 16, springs_avx512, aero_avx512, wind_avx512 },
+        { "avx2", 8, springs_avx2, aero_avx2, wind_avx2 },
+        // Gathers emulated one lane at a time lose to the blocked scalar loop
+        { "sse2", 4, springs_sse2, aero_sse2, simd_wind_scalar },
+#endif
+        { "scalar", 1, simd_springs_scalar, simd_aero_scalar, simd_wind_scalar }
+    };
+
+    size_t nsets = sizeof(sets) / sizeof(sets[0]);
+    const char *force = getenv("CLOTH_SIMD");
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    bool supported[] = {
+        __builtin_cpu_supports("avx512f"),
+        __builtin_cpu_supports("avx2"),
+        __builtin_cpu_supports("sse2"),
+        true
+    };
+#else
+    bool supported[] = { true };
+#endif
+
+    for (size_t i = 0; i < nsets; ++i)
+    {
+        if (!supported[i])
+            continue;
+
+        if (force && strcmp(force, sets[i].name) != 0)
+            continue;
+
+        simd = sets[i];
+
+        // A forced set is checked against the scalar kernel, the documented
+        // bound is a relative 1e-5
+        if (force)
+        {
+            float err = springs_error(simd.springs);
+
+            if (err > 1e-5f)
+            {
+                fprintf(stderr, "[simd_init] %s springs differ from scalar by %g, using scalar.\n",
+                        simd.name, err);
+                simd = sets[nsets - 1];
+            }
+        }
+
+        return;
+    }
+
+    if (force)
+        fprintf(stderr, "[simd_init] Instruction set '%s' is unknown or unsupported, using %s.\n", force, simd.name);
+}
@@ -0,0 +1,48 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "mesh.h"
+
+// Accumulates every spring's force into out[a] and -force into out[b],
+// each scaled by scale * inv_mass of the receiving mass, or by scale alone
+// when inv_mass is null.
+typedef void (*SpringKernel)(const struct Spring *s, size_t n, vec3 *pos,
+                             float *inv_mass, vec3 *out, float scale);
+
+// Writes the share of the air force on each corner of n triangles, see
+// aero.h. The corners of triangle j are tris[j * stride + 0, 1, 2], its face
+// normal is norm[0, 1, 2][j] and its force goes to force[0, 1, 2][j]. k caps
+// the speed used for the force.
+typedef void (*AeroKernel)(const unsigned int *tris, size_t stride, size_t n, vec3 *vel,
+                           float *const norm[3], float *const force[3], vec3 wind,
+                           float drag, float lift, float friction, float k);
+
+// Trilinear velocity of w at n points, see wind_sample_many
+typedef void (*WindKernel)(struct Wind *w, vec3 *pos, size_t n, vec3 *out);
+
+struct Simd
+{
+    const char *name;
+    int width;
+
+    SpringKernel springs;
+    AeroKernel aero;
+    WindKernel wind;
+};
+
+// Selected kernels, scalar until simd_init is called
+extern struct Simd simd;
+
+// Picks the widest instruction set the cpu supports. CLOTH_SIMD can be set to
+// scalar, sse2, avx2 or avx512 to force a specific one, which is then checked
+// against the scalar springs and dropped if it is off by more than 1e-5.
+void simd_init(void);
+
+void simd_springs_scalar(const struct Spring *s, size_t n, vec3 *pos,
+                         float *inv_mass, vec3 *out, float scale);
+void simd_aero_scalar(const unsigned int *tris, size_t stride, size_t n, vec3 *vel,
+                      float *const norm[3], float *const force[3], vec3 wind,
+                      float drag, float lift, float friction, float k);
+void simd_wind_scalar(struct Wind *w, vec3 *pos, size_t n, vec3 *out);
+
+#endif
@@ -0,0 +1,80 @@
+// Aero kernel body, included by simd.c once per instruction set before
+// simd_springs.h, which undefines the shared KERNEL_ macros. AERO_NAME is
+// undefined here.
+//
+// Corner velocities are gathered through the index list, face normals are
+// loaded straight from their component arrays and every lane handles one
+// triangle. Clamps and divisions by zero are resolved with masks so the
+// lanes never branch. Matches simd_aero_scalar up to contracted
+// multiply-adds.
+
+__attribute__((target(KERNEL_TARGET)))
+static void AERO_NAME(const unsigned int *tris, size_t stride, size_t n, vec3 *vel,
+                      float *const norm[3], float *const force[3], vec3 wind,
+                      float drag, float lift, float friction, float k)
+{
+    typedef float vf __attribute__((vector_size(KERNEL_WIDTH * sizeof(float))));
+    typedef int vi __attribute__((vector_size(KERNEL_WIDTH * sizeof(int))));
+
+    const float *vp = (const float*)vel;
+    const int *tp = (const int*)tris;
+
+    size_t t = 0;
+
+    for (; t + KERNEL_WIDTH <= n; t += KERNEL_WIDTH)
+    {
+        vf u[3], nv[3];
+
+#ifdef KERNEL_GATHER
+        vi idx = KERNEL_IOTA * (int)stride + (int)(t * stride);
+        vi i0 = KERNEL_GATHER_INT(tp, idx) * 3;
+        vi i1 = KERNEL_GATHER_INT(tp, idx + 1) * 3;
+        vi i2 = KERNEL_GATHER_INT(tp, idx + 2) * 3;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            u[c] = (KERNEL_GATHER(vp + c, i0) + KERNEL_GATHER(vp + c, i1) +
+                    KERNEL_GATHER(vp + c, i2)) * (1.f / 3.f) - wind[c];
+        }
+#else
+        for (int j = 0; j < KERNEL_WIDTH; ++j)
+        {
+            const unsigned int *tri = tris + (t + j) * stride;
+
+            for (int c = 0; c < 3; ++c)
+                u[c][j] = (vel[tri[0]][c] + vel[tri[1]][c] + vel[tri[2]][c]) * (1.f / 3.f) - wind[c];
+        }
+#endif
+
+        for (int c = 0; c < 3; ++c)
+            memcpy(&nv[c], norm[c] + t, sizeof(vf));
+
+        vf len = KERNEL_SQRT(nv[0] * nv[0] + nv[1] * nv[1] + nv[2] * nv[2]);
+        vf u2 = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+        vf un = u[0] * nv[0] + u[1] * nv[1] + u[2] * nv[2];
+
+        vf speed = KERNEL_SQRT(u2);
+        vf lim = k * len;
+        vi over = speed * lim > 1.f;
+        speed = (vf)(((vi)(1.f / lim) & over) | ((vi)speed & ~over));
+
+        vf inv_len = (vf)((vi)(1.f / len) & (len > 0.f));
+        vf inv_u2 = (vf)((vi)(1.f / u2) & (u2 > 1e-12f));
+
+        vf sc = speed * (1.f / 6.f);
+        vf along = -sc * (drag + lift - friction) * un * inv_len;
+        vf across = -sc * (friction * len - lift * un * un * inv_len * inv_u2);
+
+        for (int c = 0; c < 3; ++c)
+        {
+            vf f = along * nv[c] + across * u[c];
+            memcpy(force[c] + t, &f, sizeof(vf));
+        }
+    }
+
+    float *const rest_norm[3] = { norm[0] + t, norm[1] + t, norm[2] + t };
+    float *const rest_force[3] = { force[0] + t, force[1] + t, force[2] + t };
+    simd_aero_scalar(tris + t * stride, stride, n - t, vel, rest_norm, rest_force, wind, drag, lift, friction, k);
+}
+
+#undef AERO_NAME
@@ -0,0 +1,99 @@
+// Wind sampling kernel body, included by simd.c for every instruction set
+// with hardware gathers, before simd_springs.h, which undefines the shared
+// KERNEL_ macros. WIND_NAME is undefined here.
+//
+// Every lane handles one point. Positions are gathered out of the vec3
+// array, cell indices are found with truncating conversions and masks in
+// place of floorf and clamps, and each component gathers its eight corners
+// straight from Wind::vel. Matches simd_wind_scalar up to contracted
+// multiply-adds.
+
+__attribute__((target(KERNEL_TARGET)))
+static void WIND_NAME(struct Wind *w, vec3 *pos, size_t n, vec3 *out)
+{
+    typedef float vf __attribute__((vector_size(KERNEL_WIDTH * sizeof(float))));
+    typedef int vi __attribute__((vector_size(KERNEL_WIDTH * sizeof(int))));
+
+    const float *pp = (const float*)pos;
+    const int stride[3] = { 1, w->dims[0], w->dims[0] * w->dims[1] };
+    const float inv_cell = 1.f / w->cell;
+
+    size_t t = 0;
+
+    for (; t + KERNEL_WIDTH <= n; t += KERNEL_WIDTH)
+    {
+        vi lo[3], hi[3];
+        vf f[3];
+
+        vi idx = KERNEL_IOTA * 3 + (int)(t * 3);
+
+        for (int a = 0; a < 3; ++a)
+        {
+            int d = w->dims[a];
+            vf g = (KERNEL_GATHER(pp + a, idx) - w->origin[a]) * inv_cell;
+            vi i0;
+
+            if (w->tiled)
+            {
+                // Truncation rounds negative quotients up, the mask of -1
+                // takes them back down
+                vf q = g * (1.f / d);
+                vi qi = __builtin_convertvector(q, vi);
+                qi += q < __builtin_convertvector(qi, vf);
+                g -= __builtin_convertvector(qi, vf) * (float)d;
+
+                i0 = __builtin_convertvector(g, vi);
+                vi over = i0 > d - 1;
+                i0 = (i0 & ~over) | ((d - 1) & over);
+
+                vi i1 = i0 + 1;
+                hi[a] = (i1 & (i1 < d)) * stride[a];
+            }
+            else
+            {
+                g = (vf)((vi)g & (g > 0.f));
+                vi over = g > (float)(d - 1);
+                g = (vf)(((vi)g & ~over) | ((vi)((vf){} + (float)(d - 1)) & over));
+
+                i0 = __builtin_convertvector(g, vi);
+                over = i0 > d - 2;
+                i0 = (i0 & ~over) | ((d - 2) & over);
+
+                hi[a] = (i0 + 1) * stride[a];
+            }
+
+            lo[a] = i0 * stride[a];
+            f[a] = g - __builtin_convertvector(i0, vf);
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            const float *v = w->vel[c];
+
+            vf v000 = KERNEL_GATHER(v, lo[0] + lo[1] + lo[2]);
+            vf v100 = KERNEL_GATHER(v, hi[0] + lo[1] + lo[2]);
+            vf v010 = KERNEL_GATHER(v, lo[0] + hi[1] + lo[2]);
+            vf v110 = KERNEL_GATHER(v, hi[0] + hi[1] + lo[2]);
+            vf v001 = KERNEL_GATHER(v, lo[0] + lo[1] + hi[2]);
+            vf v101 = KERNEL_GATHER(v, hi[0] + lo[1] + hi[2]);
+            vf v011 = KERNEL_GATHER(v, lo[0] + hi[1] + hi[2]);
+            vf v111 = KERNEL_GATHER(v, hi[0] + hi[1] + hi[2]);
+
+            vf v00 = v000 + (v100 - v000) * f[0];
+            vf v10 = v010 + (v110 - v010) * f[0];
+            vf v01 = v001 + (v101 - v001) * f[0];
+            vf v11 = v011 + (v111 - v011) * f[0];
+
+            vf v0 = v00 + (v10 - v00) * f[1];
+            vf v1 = v01 + (v11 - v01) * f[1];
+            vf r = v0 + (v1 - v0) * f[2];
+
+            for (int j = 0; j < KERNEL_WIDTH; ++j)
+                out[t + j][c] = r[j];
+        }
+    }
+
+    simd_wind_scalar(w, pos + t, n - t, out + t);
+}
+
+#undef WIND_NAME
@@ -0,0 +1,564 @@
+#include "tear.h"
+#include "mesh.h"
+#include <stdlib.h>
+#include <string.h>
+#include <glad/glad.h>
+
+// Triangles around one vertex considered for a split, more than any sane
+// mesh puts around a vertex
+#define MAX_FAN 32
+#define MAX_SPRINGS (MAX_FAN * 4)
+
+
+static void *grow(void *p, size_t *cap, size_t need, size_t size)
+{
+    if (need <= *cap)
+        return p;
+
+    while (*cap < need)
+        *cap = *cap ? *cap * 2 : 64;
+
+    return realloc(p, *cap * size);
+}
+
+
+static uint64_t side_key(unsigned int a, unsigned int b)
+{
+    return a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+}
+
+
+static size_t cut_slot(uint64_t *keys, size_t cap, uint64_t key)
+{
+    // splitmix64 finalizer
+    uint64_t h = key;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+
+    size_t i = h & (cap - 1);
+
+    while (keys[i] && keys[i] != key)
+        i = (i + 1) & (cap - 1);
+
+    return i;
+}
+
+
+static bool cut_has(struct Tear *t, unsigned int a, unsigned int b)
+{
+    uint64_t key = side_key(a, b);
+    return t->ncut && t->cut[cut_slot(t->cut, t->cut_cap, key)] == key;
+}
+
+
+static void cut_insert(struct Tear *t, unsigned int a, unsigned int b)
+{
+    // Kept at most half full
+    if ((t->ncut + 1) * 2 > t->cut_cap)
+    {
+        size_t cap = t->cut_cap * 2;
+        uint64_t *keys = calloc(cap, sizeof(uint64_t));
+
+        for (size_t i = 0; i < t->cut_cap; ++i)
+        {
+            if (t->cut[i])
+                keys[cut_slot(keys, cap, t->cut[i])] = t->cut[i];
+        }
+
+        free(t->cut);
+        t->cut = keys;
+        t->cut_cap = cap;
+    }
+
+    uint64_t key = side_key(a, b);
+    size_t i = cut_slot(t->cut, t->cut_cap, key);
+
+    if (!t->cut[i])
+    {
+        t->cut[i] = key;
+        ++t->ncut;
+    }
+}
+
+
+struct Tear *tear_alloc(struct Mesh *m, float strain)
+{
+    struct Tear *t = malloc(sizeof(struct Tear));
+    t->strain = strain;
+
+    size_t cap = m->mass_cap;
+
+    // Springs around every vertex, the same layout as Mesh::vtri
+    t->vs_start = calloc(cap + 1, sizeof(unsigned int));
+    t->vs_end = malloc(sizeof(unsigned int) * (cap + 1));
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        ++t->vs_start[m->springs[i].a + 1];
+        ++t->vs_start[m->springs[i].b + 1];
+    }
+
+    for (size_t i = 0; i < m->nmasses; ++i)
+        t->vs_start[i + 1] += t->vs_start[i];
+
+    t->vs_len = m->nsprings * 2;
+    t->vs_cap = t->vs_len * 2 + 64;
+    t->vs = malloc(sizeof(unsigned int) * t->vs_cap);
+
+    memcpy(t->vs_end, t->vs_start, sizeof(unsigned int) * m->nmasses);
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        t->vs[t->vs_end[m->springs[i].a]++] = i;
+        t->vs[t->vs_end[m->springs[i].b]++] = i;
+    }
+
+    // Room for the triangle lists of vertices still to come
+    t->vtri_len = m->nindices;
+    t->vtri_cap = m->nindices * 2 + 64;
+    m->vtri = realloc(m->vtri, sizeof(unsigned int) * t->vtri_cap);
+    m->vtri_start = realloc(m->vtri_start, sizeof(unsigned int) * (cap + 1));
+    m->vtri_end = realloc(m->vtri_end, sizeof(unsigned int) * (cap + 1));
+
+    t->cut_cap = 1024;
+    t->cut = calloc(t->cut_cap, sizeof(uint64_t));
+    t->ncut = 0;
+
+    t->dirty = 0;
+    t->ndirty = 0;
+    t->dirty_cap = 0;
+
+    t->edits = 0;
+    t->nedits = 0;
+    t->edits_cap = 0;
+
+    t->backlog = 0;
+    t->nbacklog = 0;
+    t->backlog_cap = 0;
+    t->serial = 0;
+
+    t->patches = queue_alloc(sizeof(struct IndexPatch), 4096);
+    t->has_held = false;
+
+    return t;
+}
+
+
+void tear_free(struct Tear *t)
+{
+    queue_free(t->patches);
+    free(t->backlog);
+    free(t->dirty);
+    free(t->edits);
+    free(t->cut);
+    free(t->vs);
+    free(t->vs_start);
+    free(t->vs_end);
+    free(t);
+}
+
+
+static bool tri_has(unsigned int *tri, unsigned int v)
+{
+    return tri[0] == v || tri[1] == v || tri[2] == v;
+}
+
+
+static bool shares_tri(struct Mesh *m, unsigned int a, unsigned int b)
+{
+    for (unsigned int k = m->vtri_start[a]; k < m->vtri_end[a]; ++k)
+    {
+        if (tri_has(m->indices + m->vtri[k] * 3, b))
+            return true;
+    }
+
+    return false;
+}
+
+
+static unsigned int find(unsigned int *parent, unsigned int i)
+{
+    while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+
+    return i;
+}
+
+
+// Records that tri had corners from before its current ones
+static void push_patch(struct Tear *t, struct Mesh *m, unsigned int tri, unsigned int *from)
+{
+    t->backlog = grow(t->backlog, &t->backlog_cap, t->nbacklog + 1, sizeof(struct IndexPatch));
+
+    struct IndexPatch *p = &t->backlog[t->nbacklog++];
+    p->serial = 0;
+    p->tri = tri;
+    memcpy(p->idx, m->indices + tri * 3, sizeof(p->idx));
+
+    t->edits = grow(t->edits, &t->edits_cap, t->nedits + 1, sizeof(struct TriEdit));
+
+    struct TriEdit *e = &t->edits[t->nedits++];
+    e->tri = tri;
+    memcpy(e->from, from, sizeof(e->from));
+    memcpy(e->to, p->idx, sizeof(e->to));
+}
+
+
+// Lowest group of the fan with a triangle touching w. Bend and shear
+// springs reach past the fan, they go with the triangle closest to w.
+static int group_of(struct Mesh *m, unsigned int *tris, int *group, unsigned int n, unsigned int w)
+{
+    int best = -1;
+
+    for (unsigned int k = 0; k < n; ++k)
+    {
+        if (tri_has(m->indices + tris[k] * 3, w) && (best < 0 || group[k] < best))
+            best = group[k];
+    }
+
+    if (best >= 0)
+        return best;
+
+    float best_d = 0.f;
+
+    for (unsigned int k = 0; k < n; ++k)
+    {
+        unsigned int *tri = m->indices + tris[k] * 3;
+
+        vec3 c;
+        glm_vec3_add(m->pos[tri[0]], m->pos[tri[1]], c);
+        glm_vec3_add(c, m->pos[tri[2]], c);
+        glm_vec3_scale(c, 1.f / 3.f, c);
+
+        float d = glm_vec3_distance2(c, m->pos[w]);
+
+        if (best < 0 || d < best_d)
+        {
+            best = group[k];
+            best_d = d;
+        }
+    }
+
+    return best;
+}
+
+
+// Whether both sides of tri at v are cut
+static bool hanging(struct Tear *t, unsigned int *tri, unsigned int v)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        if (tri[c] != v && !cut_has(t, v, tri[c]))
+            return false;
+    }
+
+    return true;
+}
+
+
+// Takes tri out of the fans of its corners and collapses it to a point,
+// corners left without triangles lose their springs
+static void drop(struct Mesh *m, struct Tear *t, unsigned int tri)
+{
+    unsigned int *idx = m->indices + tri * 3;
+
+    for (int c = 0; c < 3; ++c)
+    {
+        unsigned int v = idx[c];
+        unsigned int kept = m->vtri_start[v];
+
+        for (unsigned int k = m->vtri_start[v]; k < m->vtri_end[v]; ++k)
+        {
+            if (m->vtri[k] != tri)
+                m->vtri[kept++] = m->vtri[k];
+        }
+
+        m->vtri_end[v] = kept;
+
+        // A mass without triangles is no longer part of the cloth
+        if (kept == m->vtri_start[v])
+        {
+            for (unsigned int k = t->vs_start[v]; k < t->vs_end[v]; ++k)
+                m->springs[t->vs[k]].k = 0.f;
+        }
+    }
+
+    unsigned int from[3] = { idx[0], idx[1], idx[2] };
+
+    idx[1] = idx[2] = idx[0];
+    push_patch(t, m, tri, from);
+}
+
+
+// Triangles hanging on v by two cut sides are dropped, the rest are grouped
+// by the sides at v that are not cut. v keeps the group of its first
+// triangle, every other group moves to a copy of v.
+static bool split(struct Mesh *m, struct Tear *t, unsigned int v)
+{
+    bool dropped = false;
+
+    for (unsigned int k = m->vtri_start[v]; k < m->vtri_end[v];)
+    {
+        unsigned int tri = m->vtri[k];
+
+        if (!hanging(t, m->indices + tri * 3, v))
+        {
+            ++k;
+            continue;
+        }
+
+        // Shifts the rest of the fan down onto k
+        drop(m, t, tri);
+        dropped = true;
+    }
+
+    unsigned int n = m->vtri_end[v] - m->vtri_start[v];
+    unsigned int nsp = t->vs_end[v] - t->vs_start[v];
+
+    if (n < 2 || n > MAX_FAN || nsp > MAX_SPRINGS)
+        return dropped;
+
+    unsigned int tris[MAX_FAN], parent[MAX_FAN];
+    memcpy(tris, m->vtri + m->vtri_start[v], sizeof(unsigned int) * n);
+
+    for (unsigned int i = 0; i < n; ++i)
+        parent[i] = i;
+
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        unsigned int *a = m->indices + tris[i] * 3;
+
+        for (unsigned int j = i + 1; j < n; ++j)
+        {
+            unsigned int *b = m->indices + tris[j] * 3;
+
+            for (int c = 0; c < 3; ++c)
+            {
+                if (a[c] != v && tri_has(b, a[c]) && !cut_has(t, v, a[c]))
+                    parent[find(parent, i)] = find(parent, j);
+            }
+        }
+    }
+
+    int group[MAX_FAN], root_group[MAX_FAN];
+    int ngroups = 0;
+
+    for (unsigned int i = 0; i < n; ++i)
+        root_group[i] = -1;
+
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        unsigned int r = find(parent, i);
+
+        if (root_group[r] < 0)
+            root_group[r] = ngroups++;
+
+        group[i] = root_group[r];
+    }
+
+    if (ngroups < 2 || m->nmasses + ngroups - 1 > m->mass_cap)
+        return dropped;
+
+    // Mass every group ends up on
+    unsigned int mass[MAX_FAN];
+
+    mass[0] = v;
+
+    for (int g = 1; g < ngroups; ++g)
+    {
+        unsigned int nv = m->nmasses++;
+        mass[g] = nv;
+
+        glm_vec3_copy(m->pos[v], m->pos[nv]);
+        glm_vec3_copy(m->vel[v], m->vel[nv]);
+        glm_vec3_copy(m->prev_pos[v], m->prev_pos[nv]);
+        glm_vec3_copy(m->draw_pos[v], m->draw_pos[nv]);
+        glm_vec3_copy(m->norm[v], m->norm[nv]);
+        glm_vec3_zero(m->force[nv]);
+        m->torn_from[nv] = m->torn_from[v];
+
+        for (size_t w = 0; w < m->nwork; ++w)
+            glm_vec3_copy(m->work[w * m->mass_cap + v], m->work[w * m->mass_cap + nv]);
+
+        // Pins stay with v, pieces torn off a pin fall
+        m->inv_mass[nv] = m->inv_mass[v] == 0.f ? 1.f / m->mass : m->inv_mass[v];
+
+        // Triangles of the group move over
+        if (t->vtri_len + n > t->vtri_cap)
+            m->vtri = grow(m->vtri, &t->vtri_cap, t->vtri_len + n, sizeof(unsigned int));
+
+        m->vtri_start[nv] = t->vtri_len;
+
+        for (unsigned int k = 0; k < n; ++k)
+        {
+            if (group[k] != g)
+                continue;
+
+            unsigned int *tri = m->indices + tris[k] * 3;
+            unsigned int from[3] = { tri[0], tri[1], tri[2] };
+
+            for (int c = 0; c < 3; ++c)
+            {
+                if (tri[c] == v)
+                    tri[c] = nv;
+            }
+
+            m->vtri[t->vtri_len++] = tris[k];
+            push_patch(t, m, tris[k], from);
+        }
+
+        m->vtri_end[nv] = t->vtri_len;
+
+        // Sides that were cut stay cut on both copies
+        for (unsigned int k = m->vtri_start[nv]; k < m->vtri_end[nv]; ++k)
+        {
+            unsigned int *tri = m->indices + m->vtri[k] * 3;
+
+            for (int c = 0; c < 3; ++c)
+            {
+                if (tri[c] != nv && cut_has(t, v, tri[c]))
+                    cut_insert(t, nv, tri[c]);
+            }
+        }
+    }
+
+    unsigned int kept = m->vtri_start[v];
+
+    for (unsigned int k = 0; k < n; ++k)
+    {
+        if (group[k] == 0)
+            m->vtri[kept++] = tris[k];
+    }
+
+    m->vtri_end[v] = kept;
+
+    // Springs follow the copy whose triangles are at their other end
+    unsigned int *list = t->vs + t->vs_start[v];
+    int spring_group[MAX_SPRINGS];
+
+    for (unsigned int k = 0; k < nsp; ++k)
+    {
+        struct Spring *s = &m->springs[list[k]];
+        spring_group[k] = group_of(m, tris, group, n, s->a == v ? s->b : s->a);
+    }
+
+    t->vs = grow(t->vs, &t->vs_cap, t->vs_len + nsp * (ngroups - 1), sizeof(unsigned int));
+    list = t->vs + t->vs_start[v];
+
+    for (int g = 1; g < ngroups; ++g)
+    {
+        unsigned int nv = mass[g];
+        t->vs_start[nv] = t->vs_len;
+
+        for (unsigned int k = 0; k < nsp; ++k)
+        {
+            if (spring_group[k] != g)
+                continue;
+
+            struct Spring *s = &m->springs[list[k]];
+
+            if (s->a == v)
+                s->a = nv;
+            else
+                s->b = nv;
+
+            t->vs[t->vs_len++] = list[k];
+        }
+
+        t->vs_end[nv] = t->vs_len;
+    }
+
+    unsigned int remain = 0;
+
+    for (unsigned int k = 0; k < nsp; ++k)
+    {
+        if (spring_group[k] == 0)
+            list[remain++] = list[k];
+    }
+
+    t->vs_end[v] = t->vs_start[v] + remain;
+
+    m->nverts = m->nmasses;
+
+    return true;
+}
+
+
+bool tear_step(struct Mesh *m)
+{
+    struct Tear *t = m->tear;
+
+    float limit = (1.f + t->strain) * (1.f + t->strain);
+    bool changed = false;
+
+    t->ndirty = 0;
+    t->nedits = 0;
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        struct Spring *s = &m->springs[i];
+
+        if (s->k == 0.f || glm_vec3_distance2(m->pos[s->a], m->pos[s->b]) <= limit * s->eq_len * s->eq_len)
+            continue;
+
+        s->k = 0.f;
+        changed = true;
+
+        // Springs that are not triangle sides just go slack
+        if (!shares_tri(m, s->a, s->b))
+            continue;
+
+        cut_insert(t, s->a, s->b);
+
+        t->dirty = grow(t->dirty, &t->dirty_cap, t->ndirty + 2, sizeof(unsigned int));
+        t->dirty[t->ndirty++] = s->a;
+        t->dirty[t->ndirty++] = s->b;
+    }
+
+    for (size_t i = 0; i < t->ndirty; ++i)
+        split(m, t, t->dirty[i]);
+
+    return changed;
+}
+
+
+uint64_t tear_flush(struct Tear *t)
+{
+    ++t->serial;
+
+    size_t sent = 0;
+
+    for (; sent < t->nbacklog; ++sent)
+    {
+        t->backlog[sent].serial = t->serial;
+
+        // Whatever does not fit goes with a later frame
+        if (!queue_push(t->patches, &t->backlog[sent]))
+            break;
+    }
+
+    memmove(t->backlog, t->backlog + sent, sizeof(struct IndexPatch) * (t->nbacklog - sent));
+    t->nbacklog -= sent;
+
+    return t->serial;
+}
+
+
+void tear_apply(struct Tear *t, uint64_t serial)
+{
+    while (t->has_held || queue_pop(t->patches, &t->held))
+    {
+        t->has_held = true;
+
+        // Its vertices are not in the frame yet
+        if (t->held.serial > serial)
+            return;
+
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * 3 * t->held.tri,
+                        sizeof(t->held.idx), t->held.idx);
+        t->has_held = false;
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef TEAR_H
+#define TEAR_H
+
+#include "queue.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct Mesh;
+
+// New corners of triangle tri, applied to the index buffer by the render
+// thread once it draws frame serial or later
+struct IndexPatch
+{
+    uint64_t serial;
+    unsigned int tri;
+    unsigned int idx[3];
+};
+
+// Triangle tri went from corners from to corners to during the last
+// tear_step, a triangle edited twice shows up twice in order
+struct TriEdit
+{
+    unsigned int tri;
+    unsigned int from[3], to[3];
+};
+
+// Springs break once stretched past 1 + strain times their rest length.
+// Broken springs keep their slot with k = 0. A broken spring along a
+// triangle side cuts that side, and every vertex whose triangles are no
+// longer connected through uncut sides is duplicated once per group.
+// Triangles left hanging on a vertex by two cut sides collapse to a point.
+struct Tear
+{
+    float strain;
+
+    // Springs at vertex i are vs[vs_start[i], vs_end[i]), lists of new
+    // vertices are appended to vs and Mesh::vtri
+    unsigned int *vs_start, *vs_end, *vs;
+    size_t vs_len, vs_cap;
+    size_t vtri_len, vtri_cap;
+
+    // Cut triangle sides as sorted vertex pairs, open addressing, 0 is empty
+    uint64_t *cut;
+    size_t ncut, cut_cap;
+
+    // Vertices touched by a broken spring this step
+    unsigned int *dirty;
+    size_t ndirty, dirty_cap;
+
+    // Triangles changed this step, for state built from the triangles
+    struct TriEdit *edits;
+    size_t nedits, edits_cap;
+
+    // Patches wait here until mesh_pack hands them out with its serial
+    struct IndexPatch *backlog;
+    size_t nbacklog, backlog_cap;
+    uint64_t serial;
+
+    // Sim thread to render thread
+    struct Queue *patches;
+
+    // Render thread only, popped but for a frame not yet drawn
+    struct IndexPatch held;
+    bool has_held;
+};
+
+struct Tear *tear_alloc(struct Mesh *m, float strain);
+void tear_free(struct Tear *t);
+
+// Breaks springs and splits vertices, returns whether the topology changed.
+// New masses are appended in id order, springs at mass i are then
+// vs[vs_start[i], vs_end[i]) and its integrator work rows copy its parent's.
+bool tear_step(struct Mesh *m);
+
+// Sim thread, call once per mesh_pack. Returns the serial of the frame.
+uint64_t tear_flush(struct Tear *t);
+// Render thread, applies every patch up to serial to the bound index buffer
+void tear_apply(struct Tear *t, uint64_t serial);
+
+#endif
@@ -0,0 +1,266 @@
+#include "topology.h"
+#include "mesh.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Edge
+{
+    unsigned int a, b;
+
+    // Third vertex of the first two triangles using the edge
+    unsigned int opp[2];
+    unsigned int nopp;
+};
+
+// Open addressing table of 64 bit keys, power of two sized, slots hold
+// index + 1 so that 0 marks an empty slot
+struct Table
+{
+    uint64_t *keys;
+    unsigned int *slots;
+    size_t mask;
+};
+
+
+static uint64_t mix(uint64_t x)
+{
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+
+static void table_init(struct Table *t, size_t n)
+{
+    size_t cap = 16;
+
+    while (cap < n * 2)
+        cap *= 2;
+
+    t->keys = malloc(sizeof(uint64_t) * cap);
+    t->slots = calloc(cap, sizeof(unsigned int));
+    t->mask = cap - 1;
+}
+
+
+static void table_free(struct Table *t)
+{
+    free(t->keys);
+    free(t->slots);
+}
+
+
+// Slot holding key, or the empty slot it would go in
+static size_t table_find(struct Table *t, uint64_t key)
+{
+    size_t i = mix(key) & t->mask;
+
+    while (t->slots[i] && t->keys[i] != key)
+        i = (i + 1) & t->mask;
+
+    return i;
+}
+
+
+size_t topology_weld(vec3 *verts, size_t n, unsigned int *remap)
+{
+    struct Table t;
+    table_init(&t, n);
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32_t bits[3];
+        memcpy(bits, verts[i], sizeof(bits));
+
+        // -0 and 0 are the same point
+        for (int k = 0; k < 3; ++k)
+            bits[k] = bits[k] == 0x80000000u ? 0 : bits[k];
+
+        uint64_t key = mix((uint64_t)bits[0] << 32 | bits[1]) ^ bits[2];
+        size_t s = mix(key) & t.mask;
+
+        // Different points can share a key, so compare the positions too
+        while (t.slots[s] && (t.keys[s] != key || memcmp(verts[t.slots[s] - 1], verts[i], sizeof(vec3)) != 0))
+            s = (s + 1) & t.mask;
+
+        if (!t.slots[s])
+        {
+            glm_vec3_copy(verts[i], verts[count]);
+            t.keys[s] = key;
+            t.slots[s] = ++count;
+        }
+
+        remap[i] = t.slots[s] - 1;
+    }
+
+    table_free(&t);
+
+    return count;
+}
+
+
+// Index of the edge between a and b, added if it is new
+static unsigned int find_edge(struct Table *t, struct Edge *edges, size_t *nedges, unsigned int a, unsigned int b)
+{
+    if (a > b)
+    {
+        unsigned int tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    uint64_t key = (uint64_t)a << 32 | b;
+    size_t s = table_find(t, key);
+
+    if (!t->slots[s])
+    {
+        edges[*nedges] = (struct Edge){ a, b, { 0, 0 }, 0 };
+        t->keys[s] = key;
+        t->slots[s] = ++*nedges;
+    }
+
+    return t->slots[s] - 1;
+}
+
+
+static void add_spring(struct Mesh *m, unsigned int a, unsigned int b, float k)
+{
+    m->springs[m->nsprings++] = (struct Spring){ a, b, k, glm_vec3_distance(m->pos[a], m->pos[b]) };
+}
+
+
+// Whether a to b is the longest side of triangle a, b, c
+static bool longest(struct Mesh *m, unsigned int a, unsigned int b, unsigned int c)
+{
+    float ab = glm_vec3_distance2(m->pos[a], m->pos[b]);
+    return ab >= glm_vec3_distance2(m->pos[b], m->pos[c]) &&
+           ab >= glm_vec3_distance2(m->pos[c], m->pos[a]);
+}
+
+
+void topology_springs(struct Mesh *m, float k)
+{
+    size_t ntris = m->nindices / 3;
+
+    struct Table t;
+    table_init(&t, ntris * 3);
+
+    struct Edge *edges = malloc(sizeof(struct Edge) * (ntris * 3 + 1));
+    size_t nedges = 0;
+
+    for (size_t i = 0; i < ntris; ++i)
+    {
+        unsigned int *tri = m->indices + i * 3;
+
+        for (int s = 0; s < 3; ++s)
+        {
+            struct Edge *e = &edges[find_edge(&t, edges, &nedges, tri[s], tri[(s + 1) % 3])];
+
+            // Non manifold edges only keep their first two triangles
+            if (e->nopp < 2)
+                e->opp[e->nopp] = tri[(s + 2) % 3];
+
+            ++e->nopp;
+        }
+    }
+
+    table_free(&t);
+
+    // One structural spring per edge, at most one more across it
+    m->springs = malloc(sizeof(struct Spring) * (nedges * 2 + 1));
+    m->nsprings = 0;
+
+    for (size_t i = 0; i < nedges; ++i)
+        add_spring(m, edges[i].a, edges[i].b, k);
+
+    for (size_t i = 0; i < nedges; ++i)
+    {
+        struct Edge *e = &edges[i];
+
+        if (e->nopp < 2 || e->opp[0] == e->opp[1])
+            continue;
+
+        bool diagonal = longest(m, e->a, e->b, e->opp[0]) && longest(m, e->a, e->b, e->opp[1]);
+        add_spring(m, e->opp[0], e->opp[1], diagonal ? k : k * TOPOLOGY_BEND);
+    }
+
+    free(edges);
+}
+
+
+void topology_color(struct Mesh *m)
+{
+    // Greedy coloring never needs more than twice the highest degree
+    unsigned int *degree = calloc(m->nmasses, sizeof(unsigned int));
+    unsigned int max_degree = 0;
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        unsigned int da = ++degree[m->springs[i].a], db = ++degree[m->springs[i].b];
+        max_degree = da > max_degree ? da : max_degree;
+        max_degree = db > max_degree ? db : max_degree;
+    }
+
+    free(degree);
+
+    size_t words = (max_degree * 2) / 64 + 1;
+    uint64_t *used = calloc(m->nmasses * words, sizeof(uint64_t));
+    unsigned int *color = malloc(sizeof(unsigned int) * (m->nsprings + 1));
+
+    m->ncolors = 0;
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+    {
+        uint64_t *ua = used + m->springs[i].a * words, *ub = used + m->springs[i].b * words;
+        size_t c = 0;
+
+        for (size_t w = 0; w < words; ++w)
+        {
+            uint64_t free_bits = ~(ua[w] | ub[w]);
+
+            if (free_bits)
+            {
+                c = w * 64 + __builtin_ctzll(free_bits);
+                break;
+            }
+        }
+
+        ua[c / 64] |= 1ull << (c % 64);
+        ub[c / 64] |= 1ull << (c % 64);
+        color[i] = c;
+
+        if (c + 1 > m->ncolors)
+            m->ncolors = c + 1;
+    }
+
+    free(used);
+
+    // Counting sort by color
+    m->colors = calloc(m->ncolors + 1, sizeof(size_t));
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+        ++m->colors[color[i] + 1];
+
+    for (size_t c = 0; c < m->ncolors; ++c)
+        m->colors[c + 1] += m->colors[c];
+
+    struct Spring *sorted = malloc(sizeof(struct Spring) * (m->nsprings + 1));
+    size_t *next = malloc(sizeof(size_t) * (m->ncolors + 1));
+    memcpy(next, m->colors, sizeof(size_t) * (m->ncolors + 1));
+
+    for (size_t i = 0; i < m->nsprings; ++i)
+        sorted[next[color[i]]++] = m->springs[i];
+
+    free(next);
+    free(color);
+    free(m->springs);
+    m->springs = sorted;
+}
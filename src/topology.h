@@ -0,0 +1,25 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cglm/cglm.h>
+#include <stddef.h>
+
+struct Mesh;
+
+// Bending springs are this much softer than structural and shear ones
+#define TOPOLOGY_BEND .1f
+
+// Merges vertices with bitwise identical positions, which assimp keeps
+// apart when their normals or uvs differ. Writes the new index of every
+// vertex to remap and returns the welded count, verts is compacted in place.
+size_t topology_weld(vec3 *verts, size_t n, unsigned int *remap);
+
+// Structural springs along every edge of Mesh::indices. Across every edge
+// shared by two triangles the opposite vertices get a shear spring if the
+// edge is the diagonal of a quad, otherwise a bending spring.
+void topology_springs(struct Mesh *m, float k);
+
+// Greedy coloring, sorts Mesh::springs by color and fills Mesh::colors
+void topology_color(struct Mesh *m);
+
+#endif
@@ -0,0 +1,28 @@
+#include "triple.h"
+
+
+void triple_init(struct Triple *t)
+{
+    t->back = 0;
+    atomic_init(&t->middle, 1);
+    t->front = 2;
+}
+
+
+void triple_publish(struct Triple *t)
+{
+    int prev = atomic_exchange_explicit(&t->middle, t->back | TRIPLE_FRESH, memory_order_acq_rel);
+    t->back = prev & ~TRIPLE_FRESH;
+}
+
+
+bool triple_acquire(struct Triple *t)
+{
+    if (!(atomic_load_explicit(&t->middle, memory_order_relaxed) & TRIPLE_FRESH))
+        return false;
+
+    int prev = atomic_exchange_explicit(&t->middle, t->front, memory_order_acq_rel);
+    t->front = prev & ~TRIPLE_FRESH;
+
+    return true;
+}
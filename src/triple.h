@@ -0,0 +1,28 @@
+#ifndef TRIPLE_H
+#define TRIPLE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Lock-free triple buffer. The writer fills slot back and publishes it, the
+// reader always picks up the newest published slot as front. Neither side
+// ever waits, older frames the reader never saw are overwritten.
+struct Triple
+{
+    int back, front;
+
+    // Slot in the middle, with TRIPLE_FRESH set if the reader hasn't taken it
+    atomic_int middle;
+};
+
+#define TRIPLE_FRESH 4
+
+void triple_init(struct Triple *t);
+
+// Writer side, back is the slot to fill next
+void triple_publish(struct Triple *t);
+
+// Reader side, true if front changed to a newer slot
+bool triple_acquire(struct Triple *t);
+
+#endif
@@ -40,6 +40,22 @@ char *util_read_file(const char *path)
 }
 
 
+void *util_alloc_aligned(size_t size)
+{
+    // aligned_alloc requires size to be a multiple of the alignment
+    size_t align = 64;
+    void *p = aligned_alloc(align, (size + align - 1) / align * align);
+
+    if (!p)
+    {
+        fprintf(stderr, "[util_alloc_aligned] Failed to allocate %zu bytes.\n", size);
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+
 void util_quat_from_rot(vec3 rot, vec4 dest)
 {
     vec4 yaw, pitch;
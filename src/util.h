@@ -5,6 +5,9 @@
 
 char *util_read_file(const char *path);
 
+// Cache line aligned allocation, free with free()
+void *util_alloc_aligned(size_t size);
+
 void util_quat_from_rot(vec3 rot, vec4 dest);
 void util_eul2quat(vec3 rot, vec4 dest);
 
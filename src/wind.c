@@ -0,0 +1,439 @@
+#include "wind.h"
+#include "pool.h"
+#include "simd.h"
+#include "util.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_MAGIC 0x444e4957 // "WIND"
+#define FILE_VERSION 1
+
+#define ADVECT_GRAIN (WIND_BLOCK * 16)
+
+struct FileHeader
+{
+    uint32_t magic, version;
+    int32_t dims[3];
+    int32_t tiled;
+    float origin[3], cell;
+};
+
+// Samples src at every grid point moved by dt times its velocity relative
+// to the mean, into dst
+struct AdvectJob
+{
+    struct Wind *w;
+    float dt;
+    float **src, **dst;
+};
+
+
+static struct Wind *alloc(int dims[3], float cell, bool tiled)
+{
+    struct Wind *w = malloc(sizeof(struct Wind));
+    glm_vec3_zero(w->origin);
+    w->cell = cell;
+    memcpy(w->dims, dims, sizeof(w->dims));
+    w->tiled = tiled;
+    glm_vec3_zero(w->mean);
+
+    w->nsamples = (size_t)dims[0] * dims[1] * dims[2];
+
+    for (int c = 0; c < 3; ++c)
+    {
+        w->vel[c] = util_alloc_aligned(sizeof(float) * w->nsamples);
+        w->next[c] = util_alloc_aligned(sizeof(float) * w->nsamples);
+        w->fwd[c] = util_alloc_aligned(sizeof(float) * w->nsamples);
+    }
+
+    return w;
+}
+
+
+// Only tiled fields drift, clamped ones would leave their own edges behind
+static void find_mean(struct Wind *w)
+{
+    glm_vec3_zero(w->mean);
+
+    if (!w->tiled)
+        return;
+
+    for (int c = 0; c < 3; ++c)
+    {
+        double sum = 0.;
+
+        for (size_t i = 0; i < w->nsamples; ++i)
+            sum += w->vel[c][i];
+
+        w->mean[c] = (float)(sum / w->nsamples);
+    }
+}
+
+
+struct Wind *wind_load(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "[wind_load] Couldn't find '%s'.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct FileHeader hdr;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        hdr.magic != FILE_MAGIC || hdr.version != FILE_VERSION ||
+        hdr.dims[0] < 2 || hdr.dims[1] < 2 || hdr.dims[2] < 2 || !(hdr.cell > 0.f))
+    {
+        fprintf(stderr, "[wind_load] '%s' is not a wind field.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct Wind *w = alloc(hdr.dims, hdr.cell, hdr.tiled);
+    glm_vec3_copy(hdr.origin, w->origin);
+
+    // Interleaved on disk, split per component in memory
+    vec3 *data = malloc(sizeof(vec3) * w->nsamples);
+    bool ok = fread(data, sizeof(vec3), w->nsamples, fp) == w->nsamples;
+    fclose(fp);
+
+    if (!ok)
+    {
+        fprintf(stderr, "[wind_load] '%s' ends after its header.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < w->nsamples; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+            w->vel[c][i] = data[i][c];
+    }
+
+    free(data);
+    find_mean(w);
+
+    return w;
+}
+
+
+void wind_save(struct Wind *w, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "[wind_save] Couldn't write %s\n", path);
+        return;
+    }
+
+    struct FileHeader hdr = {
+        FILE_MAGIC, FILE_VERSION,
+        { w->dims[0], w->dims[1], w->dims[2] }, w->tiled,
+        { w->origin[0], w->origin[1], w->origin[2] }, w->cell
+    };
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+
+    for (size_t i = 0; i < w->nsamples; ++i)
+    {
+        float v[3] = { w->vel[0][i], w->vel[1][i], w->vel[2][i] };
+        fwrite(v, sizeof(v), 1, fp);
+    }
+
+    fclose(fp);
+}
+
+
+// Uniform in [-1, 1] for every lattice point and component
+static float lattice(int x, int y, int z, int c, unsigned int seed)
+{
+    uint32_t h = seed ^ (uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u ^
+                 (uint32_t)z * 0xcb1ab31fu ^ (uint32_t)c * 0x165667b1u;
+
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+
+    return h / 2147483648.f - 1.f;
+}
+
+
+// Smoothly interpolated lattice values, the lattice wraps after n[a] points
+// so that the noise tiles
+static float value_noise(vec3 u, int n[3], int c, unsigned int seed)
+{
+    int i0[3], i1[3];
+    float f[3];
+
+    for (int a = 0; a < 3; ++a)
+    {
+        int i = (int)floorf(u[a]);
+        float t = u[a] - i;
+
+        i0[a] = i % n[a];
+        i1[a] = (i + 1) % n[a];
+        f[a] = t * t * (3.f - 2.f * t);
+    }
+
+    float v = 0.f;
+
+    for (int k = 0; k < 8; ++k)
+    {
+        int x = k & 1 ? i1[0] : i0[0];
+        int y = k & 2 ? i1[1] : i0[1];
+        int z = k & 4 ? i1[2] : i0[2];
+
+        float wt = (k & 1 ? f[0] : 1.f - f[0]) *
+                   (k & 2 ? f[1] : 1.f - f[1]) *
+                   (k & 4 ? f[2] : 1.f - f[2]);
+
+        v += wt * lattice(x, y, z, c, seed);
+    }
+
+    return v;
+}
+
+
+struct Wind *wind_curl_noise(int dims[3], float cell, int scale, vec3 mean, float gust, unsigned int seed)
+{
+    struct Wind *w = alloc(dims, cell, true);
+
+    int n[3];
+    for (int a = 0; a < 3; ++a)
+        n[a] = dims[a] / scale > 1 ? dims[a] / scale : 1;
+
+    // Vector potential, held in next until the curl is taken
+    float **psi = w->next;
+
+    for (int z = 0; z < dims[2]; ++z)
+    {
+        for (int y = 0; y < dims[1]; ++y)
+        {
+            for (int x = 0; x < dims[0]; ++x)
+            {
+                vec3 u = {
+                    (float)x * n[0] / dims[0],
+                    (float)y * n[1] / dims[1],
+                    (float)z * n[2] / dims[2]
+                };
+
+                size_t i = ((size_t)z * dims[1] + y) * dims[0] + x;
+
+                for (int c = 0; c < 3; ++c)
+                    psi[c][i] = value_noise(u, n, c, seed);
+            }
+        }
+    }
+
+    // Central differences across the wrapped edges keep the curl tiling
+    size_t stride[3] = { 1, dims[0], (size_t)dims[0] * dims[1] };
+    float max = 0.f;
+
+    for (int z = 0; z < dims[2]; ++z)
+    {
+        for (int y = 0; y < dims[1]; ++y)
+        {
+            for (int x = 0; x < dims[0]; ++x)
+            {
+                int p[3] = { x, y, z };
+                size_t i = ((size_t)z * dims[1] + y) * dims[0] + x;
+
+                // d[c][a] is the derivative of psi[c] along a
+                float d[3][3];
+
+                for (int a = 0; a < 3; ++a)
+                {
+                    size_t lo = i + ((p[a] + dims[a] - 1) % dims[a] - p[a]) * stride[a];
+                    size_t hi = i + ((p[a] + 1) % dims[a] - p[a]) * stride[a];
+
+                    for (int c = 0; c < 3; ++c)
+                        d[c][a] = (psi[c][hi] - psi[c][lo]) * .5f;
+                }
+
+                w->vel[0][i] = d[2][1] - d[1][2];
+                w->vel[1][i] = d[0][2] - d[2][0];
+                w->vel[2][i] = d[1][0] - d[0][1];
+
+                float len = sqrtf(w->vel[0][i] * w->vel[0][i] + w->vel[1][i] * w->vel[1][i] +
+                                  w->vel[2][i] * w->vel[2][i]);
+                max = fmaxf(max, len);
+            }
+        }
+    }
+
+    float s = max > 0.f ? gust / max : 0.f;
+
+    for (int c = 0; c < 3; ++c)
+    {
+        for (size_t i = 0; i < w->nsamples; ++i)
+            w->vel[c][i] = mean[c] + w->vel[c][i] * s;
+    }
+
+    find_mean(w);
+
+    return w;
+}
+
+
+void wind_free(struct Wind *w)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        free(w->vel[c]);
+        free(w->next[c]);
+        free(w->fwd[c]);
+    }
+
+    free(w);
+}
+
+
+void wind_sample(struct Wind *w, vec3 p, vec3 out)
+{
+    simd.wind(w, (vec3*)p, 1, (vec3*)out);
+}
+
+
+void wind_sample_many(struct Wind *w, vec3 *pos, size_t n, vec3 *out)
+{
+    simd.wind(w, pos, n, out);
+}
+
+
+static void advect_job(void *arg, size_t begin, size_t end)
+{
+    struct AdvectJob *j = arg;
+    struct Wind *w = j->w;
+
+    // The kernels sample Wind::vel, a copy points them at src
+    struct Wind field = *w;
+    memcpy(field.vel, j->src, sizeof(field.vel));
+
+    vec3 back[WIND_BLOCK], v[WIND_BLOCK];
+
+    for (size_t b = begin; b < end; b += WIND_BLOCK)
+    {
+        size_t len = end - b < WIND_BLOCK ? end - b : WIND_BLOCK;
+
+        for (size_t k = 0; k < len; ++k)
+        {
+            size_t i = b + k;
+            size_t x = i % w->dims[0];
+            size_t y = i / w->dims[0] % w->dims[1];
+            size_t z = i / ((size_t)w->dims[0] * w->dims[1]);
+
+            back[k][0] = w->origin[0] + x * w->cell + (w->vel[0][i] - w->mean[0]) * j->dt;
+            back[k][1] = w->origin[1] + y * w->cell + (w->vel[1][i] - w->mean[1]) * j->dt;
+            back[k][2] = w->origin[2] + z * w->cell + (w->vel[2][i] - w->mean[2]) * j->dt;
+        }
+
+        wind_sample_many(&field, back, len, v);
+
+        for (size_t k = 0; k < len; ++k)
+        {
+            for (int c = 0; c < 3; ++c)
+                j->dst[c][b + k] = v[k][c];
+        }
+    }
+}
+
+
+// Sample offsets along axis a of the two grid planes around g, in cells
+// from the origin, the same way the samplers pick them
+static void axis_planes(struct Wind *w, int a, float g, size_t *lo, size_t *hi)
+{
+    int d = w->dims[a];
+    int i0, i1;
+
+    if (w->tiled)
+    {
+        g -= floorf(g / d) * d;
+        i0 = (int)g < d - 1 ? (int)g : d - 1;
+        i1 = i0 + 1 < d ? i0 + 1 : 0;
+    }
+    else
+    {
+        g = g > 0.f ? g : 0.f;
+        g = g < d - 1 ? g : d - 1;
+        i0 = (int)g < d - 2 ? (int)g : d - 2;
+        i1 = i0 + 1;
+    }
+
+    size_t stride = a == 0 ? 1 : a == 1 ? (size_t)w->dims[0] : (size_t)w->dims[0] * w->dims[1];
+    *lo = i0 * stride;
+    *hi = i1 * stride;
+}
+
+
+// MacCormack correction, next is the semi-Lagrangian result and fwd that
+// traced forward again. Clamped to the corners the backward lookup
+// blended, which keeps the step from overshooting near sharp gusts.
+static void correct_job(void *arg, size_t begin, size_t end)
+{
+    struct AdvectJob *j = arg;
+    struct Wind *w = j->w;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        size_t p[3] = { i % w->dims[0], i / w->dims[0] % w->dims[1], i / ((size_t)w->dims[0] * w->dims[1]) };
+        size_t lo[3], hi[3];
+
+        for (int a = 0; a < 3; ++a)
+        {
+            float g = p[a] - (w->vel[a][i] - w->mean[a]) * j->dt / w->cell;
+            axis_planes(w, a, g, &lo[a], &hi[a]);
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            const float *v = w->vel[c];
+            float min = INFINITY, max = -INFINITY;
+
+            for (int k = 0; k < 8; ++k)
+            {
+                float s = v[(k & 1 ? hi[0] : lo[0]) + (k & 2 ? hi[1] : lo[1]) + (k & 4 ? hi[2] : lo[2])];
+                min = fminf(min, s);
+                max = fmaxf(max, s);
+            }
+
+            float r = w->next[c][i] + .5f * (v[i] - w->fwd[c][i]);
+            w->fwd[c][i] = fminf(fmaxf(r, min), max);
+        }
+    }
+}
+
+
+void wind_advect(struct Wind *w, float dt)
+{
+    // The mean flow only translates the pattern, a whole tile further on
+    // looks the same
+    for (int a = 0; a < 3; ++a)
+    {
+        float tile = w->dims[a] * w->cell;
+        w->origin[a] = fmodf(w->origin[a] + w->mean[a] * dt, tile);
+    }
+
+    // Gusts only evolve at a fraction of the drift, see WIND_EVOLVE
+    dt *= WIND_EVOLVE;
+
+    struct AdvectJob j = { w, -dt, w->vel, w->next };
+    pool_for(pool_global(), w->nsamples, ADVECT_GRAIN, advect_job, &j);
+
+    j = (struct AdvectJob){ w, dt, w->next, w->fwd };
+    pool_for(pool_global(), w->nsamples, ADVECT_GRAIN, advect_job, &j);
+
+    pool_for(pool_global(), w->nsamples, ADVECT_GRAIN, correct_job, &j);
+
+    for (int c = 0; c < 3; ++c)
+    {
+        float *tmp = w->vel[c];
+        w->vel[c] = w->fwd[c];
+        w->fwd[c] = tmp;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef WIND_H
+#define WIND_H
+
+#include <cglm/cglm.h>
+
+// Points sampled together by wind_sample_many, their cell indices and
+// weights stay in L1 while every component is gathered
+#define WIND_BLOCK 64
+// Gusts advect themselves this much slower than real time, the pattern as
+// a whole drifts along the mean at full speed
+#define WIND_EVOLVE .1f
+
+// Air velocity on a coarse regular grid, trilinear between samples. Tiled
+// fields repeat forever along every axis, anything else is clamped to its
+// edge samples.
+struct Wind
+{
+    vec3 origin;
+    // World distance between neighbouring samples
+    float cell;
+    // Samples per axis, at least 2
+    int dims[3];
+    bool tiled;
+
+    // Velocity components, vel[c][(z * dims[1] + y) * dims[0] + x]
+    float *vel[3];
+    // Scratch of wind_advect, the last one is swapped with vel
+    float *next[3], *fwd[3];
+    size_t nsamples;
+
+    // Average of vel for tiled fields, zero otherwise. wind_advect carries
+    // the whole pattern along it by moving origin, which is exact.
+    vec3 mean;
+};
+
+// Binary file of a header followed by every sample as 3 floats, x fastest,
+// see wind_save
+struct Wind *wind_load(const char *path);
+void wind_save(struct Wind *w, const char *path);
+// Tiled divergence free gusts of at most gust on top of mean, the curl of
+// value noise with a lattice point every scale samples
+struct Wind *wind_curl_noise(int dims[3], float cell, int scale, vec3 mean, float gust, unsigned int seed);
+void wind_free(struct Wind *w);
+
+void wind_sample(struct Wind *w, vec3 p, vec3 out);
+// wind_sample at every one of n points
+void wind_sample_many(struct Wind *w, vec3 *pos, size_t n, vec3 *out);
+
+// Moves tiled fields along their mean exactly, then advects what is left
+// by itself over WIND_EVOLVE * dt with a limited MacCormack step: a
+// semi-Lagrangian step, the same traced forward again, and half the
+// difference to the start added back. Trilinear lookups alone blurred
+// lattice scale gusts away within seconds. With the demo's gusts their
+// strength now stays within a few percent for the first ten seconds.
+// Nothing keeps the field divergence free, so over minutes gusts sharpen
+// into fronts, never above their starting peak.
+void wind_advect(struct Wind *w, float dt);
+
+#endif
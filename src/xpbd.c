@@ -0,0 +1,123 @@
+#include "xpbd.h"
+#include "mesh.h"
+#include "pool.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SPRING_GRAIN 4096
+
+struct SolveJob
+{
+    struct Mesh *m;
+    size_t first;
+    float alpha_scale;
+};
+
+
+struct Xpbd *xpbd_alloc(struct Mesh *m)
+{
+    struct Xpbd *x = malloc(sizeof(struct Xpbd));
+    x->prev = util_alloc_aligned(sizeof(vec3) * m->mass_cap);
+    x->lambda = util_alloc_aligned(sizeof(float) * m->nsprings);
+
+    x->substeps = 1;
+    x->iters = 10;
+
+    return x;
+}
+
+
+void xpbd_free(struct Xpbd *x)
+{
+    free(x->prev);
+    free(x->lambda);
+    free(x);
+}
+
+
+void xpbd_small_steps(struct Xpbd *x, int substeps)
+{
+    x->substeps = substeps;
+    x->iters = 1;
+}
+
+
+static void solve_job(void *arg, size_t begin, size_t end)
+{
+    struct SolveJob *j = arg;
+    struct Mesh *m = j->m;
+    float *lambda = m->xpbd->lambda;
+
+    for (size_t i = j->first + begin; i < j->first + end; ++i)
+    {
+        struct Spring *s = &m->springs[i];
+
+        float wa = m->inv_mass[s->a];
+        float wb = m->inv_mass[s->b];
+        float w = wa + wb;
+
+        // Pinned at both ends, or broken by tearing
+        if (w == 0.f || s->k == 0.f)
+            continue;
+
+        vec3 diff;
+        glm_vec3_sub(m->pos[s->a], m->pos[s->b], diff);
+        float dist = glm_vec3_norm(diff);
+
+        // alpha~ = alpha / h^2
+        float alpha = j->alpha_scale / s->k;
+        float c = dist - s->eq_len;
+        float dl = (-c - alpha * lambda[i]) / (w + alpha);
+        lambda[i] += dl;
+
+        glm_vec3_scale(diff, dl / dist, diff);
+        glm_vec3_muladds(diff, wa, m->pos[s->a]);
+        glm_vec3_muladds(diff, -wb, m->pos[s->b]);
+    }
+}
+
+
+void xpbd_step(struct Mesh *m, float dt)
+{
+    struct Xpbd *x = m->xpbd;
+    float h = dt / x->substeps;
+
+    for (int sub = 0; sub < x->substeps; ++sub)
+    {
+        memcpy(x->prev, m->pos, sizeof(vec3) * m->nmasses);
+
+        for (size_t i = 0; i < m->nmasses; ++i)
+        {
+            float unpinned = m->inv_mass[i] > 0.f;
+
+            m->vel[i][1] += GRAVITY * h * unpinned;
+            glm_vec3_muladds(m->vel[i], h * unpinned, m->pos[i]);
+        }
+
+        memset(x->lambda, 0, sizeof(float) * m->nsprings);
+
+        for (int it = 0; it < x->iters; ++it)
+        {
+            // Constraints of one color move disjoint masses
+            for (size_t c = 0; c < m->ncolors; ++c)
+            {
+                struct SolveJob j = { m, m->colors[c], 1.f / (h * h) };
+                pool_for(pool_global(), m->colors[c + 1] - m->colors[c], SPRING_GRAIN, solve_job, &j);
+            }
+        }
+
+        for (size_t i = 0; i < m->nmasses; ++i)
+        {
+            float unpinned = m->inv_mass[i] > 0.f;
+
+            vec3 v;
+            glm_vec3_sub(m->pos[i], x->prev[i], v);
+            glm_vec3_scale(v, unpinned / h, v);
+
+            // Pinned masses keep the velocity their target gave them
+            glm_vec3_scale(m->vel[i], 1.f - unpinned, m->vel[i]);
+            glm_vec3_add(m->vel[i], v, m->vel[i]);
+        }
+    }
+}
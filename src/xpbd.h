@@ -0,0 +1,28 @@
+#ifndef XPBD_H
+#define XPBD_H
+
+#include <cglm/cglm.h>
+
+struct Mesh;
+
+// Extended position based dynamics, springs become distance constraints
+// with compliance 1 / k so stiffness does not depend on dt or iterations
+struct Xpbd
+{
+    vec3 *prev;
+    float *lambda;
+
+    // Every step does substeps * iters constraint sweeps, no early exit
+    int substeps;
+    int iters;
+};
+
+struct Xpbd *xpbd_alloc(struct Mesh *m);
+void xpbd_free(struct Xpbd *x);
+
+// Small steps mode, many substeps with a single iteration each
+void xpbd_small_steps(struct Xpbd *x, int substeps);
+
+void xpbd_step(struct Mesh *m, float dt);
+
+#endif